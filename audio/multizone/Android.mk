@@ -30,9 +30,17 @@ LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 
 LOCAL_SRC_FILES := \
 	AudioHw.cpp \
+	AudioPortMixer.cpp \
+	AudioPcmDevice.cpp \
+	AudioOutPort.cpp \
+	AudioDsp.cpp \
+	AudioRing.cpp \
+	AudioStats.cpp \
+	AudioChime.cpp \
 	audio_hw.cpp
 
 LOCAL_C_INCLUDES += \
+	external/tinyalsa/include \
 	system/media/audio_utils/include \
 	system/media/audio_effects/include \
 	device/ti/common-open/audio/utils/include
@@ -40,6 +48,7 @@ LOCAL_C_INCLUDES += \
 LOCAL_SHARED_LIBRARIES := \
 	liblog \
 	libtiaudioutils \
+	libtinyalsa \
 	libcutils \
 	libutils
 
@@ -51,3 +60,105 @@ LOCAL_STATIC_LIBRARIES := libmedia_helper
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := multizone_mixbench
+
+LOCAL_SRC_FILES := \
+	AudioMixBench.cpp \
+	AudioDsp.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	liblog \
+	libcutils
+
+LOCAL_SHARED_LIBRARIES += libstlport
+include external/stlport/libstlport.mk
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := multizone_writebench
+
+LOCAL_SRC_FILES := \
+	AudioWriteBench.cpp \
+	AudioPortMixer.cpp \
+	AudioPcmDevice.cpp \
+	AudioOutPort.cpp \
+	AudioDsp.cpp \
+	AudioRing.cpp \
+	AudioStats.cpp \
+	AudioChime.cpp
+
+LOCAL_C_INCLUDES += \
+	external/tinyalsa/include \
+	device/ti/common-open/audio/utils/include
+
+LOCAL_SHARED_LIBRARIES := \
+	liblog \
+	libtiaudioutils \
+	libtinyalsa \
+	libcutils \
+	libutils
+
+LOCAL_SHARED_LIBRARIES += libstlport
+include external/stlport/libstlport.mk
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := multizone_pcmbench
+
+LOCAL_SRC_FILES := \
+	AudioPcmBench.cpp \
+	AudioPortMixer.cpp \
+	AudioPcmDevice.cpp \
+	AudioOutPort.cpp \
+	AudioDsp.cpp \
+	AudioRing.cpp \
+	AudioStats.cpp \
+	AudioChime.cpp
+
+LOCAL_C_INCLUDES += \
+	external/tinyalsa/include \
+	device/ti/common-open/audio/utils/include
+
+LOCAL_SHARED_LIBRARIES := \
+	liblog \
+	libtiaudioutils \
+	libtinyalsa \
+	libcutils \
+	libutils
+
+LOCAL_SHARED_LIBRARIES += libstlport
+include external/stlport/libstlport.mk
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := multizone_openbench
+
+LOCAL_SRC_FILES := \
+	AudioOpenBench.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	liblog \
+	libhardware \
+	libcutils
+
+LOCAL_SHARED_LIBRARIES += libstlport
+include external/stlport/libstlport.mk
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioChime"
+// #define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <cutils/atomic.h>
+
+#include <AudioChime.h>
+
+namespace android {
+
+AudioChime::AudioChime(const char *name, uint32_t channels)
+    : mName(name), mChannels(channels), mSourceRate(0),
+      mToneFreq(0.0f), mToneLengthMs(0), mToneDecayMs(0), mNumVariants(0)
+{
+}
+
+AudioChime::~AudioChime()
+{
+    for (int32_t i = 0; i < mNumVariants; i++)
+        delete mVariants[i].pcm;
+}
+
+/* Little-endian fields of the RIFF headers */
+static uint32_t readLe32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t readLe16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/* 16-bit PCM WAV file, mono or stereo, any rate */
+sp<AudioChime> AudioChime::loadWav(const char *name, const char *path)
+{
+    ALOGV("AudioChime: load '%s' from %s", name, path);
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        ALOGE("AudioChime: failed to open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    uint8_t header[12];
+    if ((fread(header, sizeof(header), 1, file) != 1) ||
+        memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4)) {
+        ALOGE("AudioChime: %s is not a WAV file", path);
+        fclose(file);
+        return NULL;
+    }
+
+    sp<AudioChime> chime;
+    uint32_t rate = 0;
+    uint16_t channels = 0;
+    uint16_t bits = 0;
+    uint8_t chunk[8];
+
+    while (fread(chunk, sizeof(chunk), 1, file) == 1) {
+        uint32_t size = readLe32(chunk + 4);
+
+        if (!memcmp(chunk, "fmt ", 4) && (size >= 16)) {
+            uint8_t fmt[16];
+            if (fread(fmt, sizeof(fmt), 1, file) != 1)
+                break;
+            if (readLe16(fmt) != 1) /* WAVE_FORMAT_PCM */
+                break;
+            channels = readLe16(fmt + 2);
+            rate = readLe32(fmt + 4);
+            bits = readLe16(fmt + 14);
+            fseek(file, size - sizeof(fmt) + (size & 1), SEEK_CUR);
+        } else if (!memcmp(chunk, "data", 4) && rate) {
+            if ((bits != 16) || (channels < 1) || (channels > 2) ||
+                (size / (2 * channels) > (kMaxLengthMs * rate) / 1000))
+                break;
+
+            chime = new AudioChime(name, channels);
+            chime->mSourceRate = rate;
+            chime->mSource.resize(size / 2);
+            if (fread(&chime->mSource[0], 2, chime->mSource.size(), file) !=
+                chime->mSource.size())
+                chime.clear();
+            break;
+        } else {
+            fseek(file, size + (size & 1), SEEK_CUR);
+        }
+    }
+
+    fclose(file);
+
+    if (chime == NULL)
+        ALOGE("AudioChime: %s is not a supported WAV file", path);
+
+    return chime;
+}
+
+/*
+ * Sine tone with short linear ramps at both ends, and an exponential
+ * decay if 'decayMs' isn't 0 (e.g. a chime). It's synthesized at the
+ * exact rate of each port it's prepared for.
+ */
+sp<AudioChime> AudioChime::createTone(const char *name, float freq, uint32_t lengthMs,
+                                      uint32_t decayMs)
+{
+    ALOGV("AudioChime: tone '%s' %.1f Hz, %u ms, decay %u ms", name, freq, lengthMs, decayMs);
+
+    if ((freq <= 0.0f) || !lengthMs || (lengthMs > kMaxLengthMs))
+        return NULL;
+
+    sp<AudioChime> chime = new AudioChime(name, 1);
+    chime->mToneFreq = freq;
+    chime->mToneLengthMs = lengthMs;
+    chime->mToneDecayMs = decayMs;
+
+    return chime;
+}
+
+void AudioChime::synthesize(uint32_t rate, vector<int16_t> &pcm) const
+{
+    uint32_t frames = (mToneLengthMs * rate) / 1000;
+    uint32_t ramp = (kToneRampMs * rate) / 1000;
+    double step = 2.0 * M_PI * mToneFreq / rate;
+    double decay = mToneDecayMs ? exp(-1000.0 / ((double)mToneDecayMs * rate)) : 1.0;
+    double envelope = kToneLevel * 32767;
+
+    pcm.resize(frames);
+    for (uint32_t i = 0; i < frames; i++) {
+        double gain = envelope;
+        if (i < ramp)
+            gain *= (double)i / ramp;
+        if (frames - i < ramp)
+            gain *= (double)(frames - i) / ramp;
+
+        pcm[i] = (int16_t)lrint(gain * sin(step * i));
+        envelope *= decay;
+    }
+}
+
+/* Linear interpolation, it's done once per rate and off the render threads */
+void AudioChime::resample(uint32_t rate, vector<int16_t> &pcm) const
+{
+    uint32_t srcFrames = mSource.size() / mChannels;
+    uint32_t frames = (uint32_t)(((uint64_t)srcFrames * rate) / mSourceRate);
+
+    if (rate == mSourceRate) {
+        pcm = mSource;
+        return;
+    }
+
+    pcm.resize(frames * mChannels);
+    for (uint32_t i = 0; i < frames; i++) {
+        double pos = (double)i * mSourceRate / rate;
+        uint32_t j = (uint32_t)pos;
+        double frac = pos - j;
+        uint32_t k = (j + 1 < srcFrames) ? j + 1 : j;
+
+        for (uint32_t ch = 0; ch < mChannels; ch++) {
+            double a = mSource[j * mChannels + ch];
+            double b = mSource[k * mChannels + ch];
+            pcm[i * mChannels + ch] = (int16_t)lrint(a + (b - a) * frac);
+        }
+    }
+}
+
+int AudioChime::prepare(uint32_t rate)
+{
+    uint32_t frames;
+
+    if (getPcm(rate, frames))
+        return 0;
+
+    if (mNumVariants == (int32_t)kMaxRates) {
+        ALOGE("AudioChime: '%s' is already prepared for %u rates", getName(), kMaxRates);
+        return -ENOMEM;
+    }
+
+    vector<int16_t> *pcm = new vector<int16_t>();
+    if (mToneFreq > 0.0f)
+        synthesize(rate, *pcm);
+    else
+        resample(rate, *pcm);
+
+    if (pcm->empty()) {
+        delete pcm;
+        return -EINVAL;
+    }
+
+    ALOGV("AudioChime: '%s' prepared at %u Hz, %u frames", getName(), rate,
+          pcm->size() / mChannels);
+
+    /* Published only once complete, readers don't lock */
+    mVariants[mNumVariants].rate = rate;
+    mVariants[mNumVariants].pcm = pcm;
+    android_atomic_release_store(mNumVariants + 1, &mNumVariants);
+
+    return 0;
+}
+
+const int16_t *AudioChime::getPcm(uint32_t rate, uint32_t &frames) const
+{
+    int32_t count = android_atomic_acquire_load(&mNumVariants);
+
+    for (int32_t i = 0; i < count; i++) {
+        if (mVariants[i].rate == rate) {
+            frames = mVariants[i].pcm->size() / mChannels;
+            return &(*mVariants[i].pcm)[0];
+        }
+    }
+
+    return NULL;
+}
+
+}; // namespace android
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUDIO_CHIME_H_
+#define _AUDIO_CHIME_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+#include <utils/RefBase.h>
+
+namespace android {
+
+using std::string;
+using std::vector;
+
+/**
+ * Short sound played by the port mixers without a stream, e.g. a turn
+ * signal click or a seatbelt chime: a 16-bit mono or stereo WAV clip
+ * preloaded from the file system, or a synthesized tone. The PCM data is
+ * prepared once per port rate, outside of the render threads, and never
+ * changes afterwards, so the render threads read it without locking.
+ *
+ * prepare() is not thread-safe, the owner serializes it.
+ */
+class AudioChime : public RefBase {
+ public:
+    static sp<AudioChime> loadWav(const char *name, const char *path);
+    static sp<AudioChime> createTone(const char *name, float freq, uint32_t lengthMs,
+                                     uint32_t decayMs);
+    virtual ~AudioChime();
+
+    const char *getName() const { return mName.c_str(); }
+    uint32_t getChannels() const { return mChannels; }
+
+    int prepare(uint32_t rate);
+    const int16_t *getPcm(uint32_t rate, uint32_t &frames) const;
+
+    static const uint32_t kMaxRates = 4;
+    static const uint32_t kMaxLengthMs = 10000;
+    static const uint32_t kToneRampMs = 2;
+    static const float kToneLevel = 0.5f; /* -6 dBFS */
+
+ protected:
+    AudioChime(const char *name, uint32_t channels);
+
+    void synthesize(uint32_t rate, vector<int16_t> &pcm) const;
+    void resample(uint32_t rate, vector<int16_t> &pcm) const;
+
+    struct Variant {
+        uint32_t rate;
+        vector<int16_t> *pcm;
+    };
+
+    string mName;
+    uint32_t mChannels;
+    uint32_t mSourceRate;
+    vector<int16_t> mSource;
+    float mToneFreq;
+    uint32_t mToneLengthMs;
+    uint32_t mToneDecayMs;
+    Variant mVariants[kMaxRates];
+    volatile int32_t mNumVariants;
+};
+
+}; // namespace android
+
+#endif /* _AUDIO_CHIME_H_ */
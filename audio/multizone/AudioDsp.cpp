@@ -0,0 +1,1462 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioDsp"
+// #define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <cutils/atomic.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include <AudioDsp.h>
+
+namespace android {
+
+/* Q30 to Q15, saturated to the largest positive Q15 value */
+static inline int16_t toQ15(int32_t gain)
+{
+    int32_t g = gain >> 15;
+    return (g > 0x7fff) ? 0x7fff : g;
+}
+
+/* Same rounding as NEON's VQRDMULH, no saturation needed for gain >= 0 */
+static inline int16_t mulQ15(int16_t sample, int16_t gain)
+{
+    return ((int32_t)sample * gain + (1 << 14)) >> 15;
+}
+
+void scaleQ15(const int16_t *in, int16_t *out, uint32_t samples, int16_t gain)
+{
+#if defined(__ARM_NEON__)
+    int16x8_t g = vdupq_n_s16(gain);
+
+    for (; samples >= 8; samples -= 8) {
+        vst1q_s16(out, vqrdmulhq_s16(vld1q_s16(in), g));
+        in += 8;
+        out += 8;
+    }
+#endif
+
+    while (samples--)
+        *out++ = mulQ15(*in++, gain);
+}
+
+void scaleStereoQ15(const int16_t *in, int16_t *out, uint32_t frames,
+                    int16_t left, int16_t right)
+{
+#if defined(__ARM_NEON__)
+    const int16_t pattern[8] = { left, right, left, right, left, right, left, right };
+    int16x8_t g = vld1q_s16(pattern);
+
+    for (; frames >= 4; frames -= 4) {
+        vst1q_s16(out, vqrdmulhq_s16(vld1q_s16(in), g));
+        in += 8;
+        out += 8;
+    }
+#endif
+
+    while (frames--) {
+        *out++ = mulQ15(*in++, left);
+        *out++ = mulQ15(*in++, right);
+    }
+}
+
+void rampStereoQ15(const int16_t *in, int16_t *out, uint32_t frames,
+                   int32_t left, int32_t leftStep, int32_t right, int32_t rightStep)
+{
+#if defined(__ARM_NEON__)
+    /* Per-frame gains of 4 consecutive frames, one vector per channel */
+    const int32_t lg[4] = { left, left + leftStep, left + 2 * leftStep, left + 3 * leftStep };
+    const int32_t rg[4] = { right, right + rightStep, right + 2 * rightStep, right + 3 * rightStep };
+    int32x4_t gl = vld1q_s32(lg);
+    int32x4_t gr = vld1q_s32(rg);
+    int32x4_t dl = vdupq_n_s32(4 * leftStep);
+    int32x4_t dr = vdupq_n_s32(4 * rightStep);
+
+    for (; frames >= 4; frames -= 4) {
+        int16x4x2_t v = vld2_s16(in);
+        v.val[0] = vqrdmulh_s16(v.val[0], vqshrn_n_s32(gl, 15));
+        v.val[1] = vqrdmulh_s16(v.val[1], vqshrn_n_s32(gr, 15));
+        vst2_s16(out, v);
+        gl = vaddq_s32(gl, dl);
+        gr = vaddq_s32(gr, dr);
+        left += 4 * leftStep;
+        right += 4 * rightStep;
+        in += 8;
+        out += 8;
+    }
+#endif
+
+    while (frames--) {
+        *out++ = mulQ15(*in++, toQ15(left));
+        *out++ = mulQ15(*in++, toQ15(right));
+        left += leftStep;
+        right += rightStep;
+    }
+}
+
+static inline int16_t saturate16(int32_t sample)
+{
+    if (sample > 32767)
+        return 32767;
+    if (sample < -32768)
+        return -32768;
+    return sample;
+}
+
+void accumulateQ15(int32_t *acc, const int16_t *in, uint32_t samples)
+{
+#if defined(__ARM_NEON__)
+    for (; samples >= 8; samples -= 8) {
+        int16x8_t v = vld1q_s16(in);
+        vst1q_s32(acc, vaddw_s16(vld1q_s32(acc), vget_low_s16(v)));
+        vst1q_s32(acc + 4, vaddw_s16(vld1q_s32(acc + 4), vget_high_s16(v)));
+        in += 8;
+        acc += 8;
+    }
+#endif
+
+    while (samples--)
+        *acc++ += *in++;
+}
+
+void saturateQ15(const int32_t *acc, int16_t *out, uint32_t samples)
+{
+#if defined(__ARM_NEON__)
+    for (; samples >= 8; samples -= 8) {
+        int16x4_t lo = vqmovn_s32(vld1q_s32(acc));
+        int16x4_t hi = vqmovn_s32(vld1q_s32(acc + 4));
+        vst1q_s16(out, vcombine_s16(lo, hi));
+        acc += 8;
+        out += 8;
+    }
+#endif
+
+    while (samples--)
+        *out++ = saturate16(*acc++);
+}
+
+void scaleSaturateQ15(const int32_t *acc, int16_t *out, uint32_t samples, int32_t gain)
+{
+#if defined(__ARM_NEON__)
+    int32x4_t g = vdupq_n_s32(gain);
+
+    for (; samples >= 8; samples -= 8) {
+        int16x4_t lo = vqmovn_s32(vqrdmulhq_s32(vld1q_s32(acc), g));
+        int16x4_t hi = vqmovn_s32(vqrdmulhq_s32(vld1q_s32(acc + 4), g));
+        vst1q_s16(out, vcombine_s16(lo, hi));
+        acc += 8;
+        out += 8;
+    }
+#endif
+
+    /* Same rounding as NEON's VQRDMULH */
+    while (samples--)
+        *out++ = saturate16(((int64_t)*acc++ * gain + (1LL << 30)) >> 31);
+}
+
+/* Same as scaleSaturateQ15() but with a Q31 gain per slot */
+void scaleSaturateSlotsQ15(const int32_t *acc, int16_t *out, uint32_t frames,
+                           uint32_t channels, const int32_t *gains)
+{
+#if defined(__ARM_NEON__)
+    if (channels == 2) {
+        const int32_t g[4] = { gains[0], gains[1], gains[0], gains[1] };
+        int32x4_t gv = vld1q_s32(g);
+
+        for (; frames >= 4; frames -= 4) {
+            int16x4_t lo = vqmovn_s32(vqrdmulhq_s32(vld1q_s32(acc), gv));
+            int16x4_t hi = vqmovn_s32(vqrdmulhq_s32(vld1q_s32(acc + 4), gv));
+            vst1q_s16(out, vcombine_s16(lo, hi));
+            acc += 8;
+            out += 8;
+        }
+    } else if (!(channels & 3) && (channels <= 16)) {
+        int32x4_t gv[4];
+        uint32_t vectors = channels / 4;
+
+        for (uint32_t v = 0; v < vectors; v++)
+            gv[v] = vld1q_s32(gains + 4 * v);
+
+        for (; frames; frames--) {
+            for (uint32_t v = 0; v < vectors; v++) {
+                vst1_s16(out, vqmovn_s32(vqrdmulhq_s32(vld1q_s32(acc), gv[v])));
+                acc += 4;
+                out += 4;
+            }
+        }
+    }
+#endif
+
+    while (frames--) {
+        for (uint32_t ch = 0; ch < channels; ch++)
+            *out++ = saturate16(((int64_t)*acc++ * gains[ch] + (1LL << 30)) >> 31);
+    }
+}
+
+void accumulateRampQ15(int32_t *acc, const int16_t *in, uint32_t frames, uint32_t channels,
+                       const int32_t *gains, const int32_t *steps)
+{
+    uint32_t zones = channels / 2;
+
+#if defined(__ARM_NEON__)
+    if (channels == 2) {
+        /* Two frames per vector, the second one a step ahead */
+        const int32_t g[4] = { gains[0], gains[0], gains[0] + steps[0], gains[0] + steps[0] };
+        int32x4_t gv = vld1q_s32(g);
+        int32x4_t dv = vdupq_n_s32(2 * steps[0]);
+        int32_t gain = gains[0];
+
+        for (; frames >= 2; frames -= 2) {
+            int32x4_t prod = vmull_s16(vld1_s16(in), vqshrn_n_s32(gv, 15));
+            vst1q_s32(acc, vrsraq_n_s32(vld1q_s32(acc), prod, 15));
+            gv = vaddq_s32(gv, dv);
+            gain += 2 * steps[0];
+            in += 4;
+            acc += 4;
+        }
+
+        if (frames) {
+            int16_t g16 = toQ15(gain);
+            *acc++ += mulQ15(*in++, g16);
+            *acc++ += mulQ15(*in++, g16);
+        }
+        return;
+    }
+
+    /* Two zones per vector, e.g. the 8 slots of JAMR3 are two vectors */
+    if (!(channels & 3) && (channels <= 16)) {
+        int32x4_t gv[4], dv[4];
+        uint32_t vectors = channels / 4;
+
+        for (uint32_t v = 0; v < vectors; v++) {
+            const int32_t g[4] = { gains[2 * v], gains[2 * v],
+                                   gains[2 * v + 1], gains[2 * v + 1] };
+            const int32_t d[4] = { steps[2 * v], steps[2 * v],
+                                   steps[2 * v + 1], steps[2 * v + 1] };
+            gv[v] = vld1q_s32(g);
+            dv[v] = vld1q_s32(d);
+        }
+
+        while (frames--) {
+            for (uint32_t v = 0; v < vectors; v++) {
+                int32x4_t prod = vmull_s16(vld1_s16(in), vqshrn_n_s32(gv[v], 15));
+                vst1q_s32(acc, vrsraq_n_s32(vld1q_s32(acc), prod, 15));
+                gv[v] = vaddq_s32(gv[v], dv[v]);
+                in += 4;
+                acc += 4;
+            }
+        }
+        return;
+    }
+#endif
+
+    for (uint32_t i = 0; i < frames; i++) {
+        for (uint32_t z = 0; z < zones; z++) {
+            int16_t g16 = toQ15(gains[z] + (int32_t)i * steps[z]);
+            *acc++ += mulQ15(*in++, g16);
+            *acc++ += mulQ15(*in++, g16);
+        }
+    }
+}
+
+/* Scalar on purpose, the scan stops as soon as all zones have an onset */
+void findOnsetsQ15(const int16_t *in, uint32_t frames, uint32_t channels, int16_t threshold,
+                   uint32_t base, uint32_t *onsets)
+{
+    uint32_t zones = channels / 2;
+    uint32_t pending = 0;
+
+    for (uint32_t z = 0; z < zones; z++) {
+        if (onsets[z] == kNoOnset)
+            pending++;
+    }
+
+    for (uint32_t i = 0; (i < frames) && pending; i++) {
+        for (uint32_t z = 0; z < zones; z++, in += 2) {
+            if (onsets[z] != kNoOnset)
+                continue;
+            if ((abs(in[0]) > threshold) || (abs(in[1]) > threshold)) {
+                onsets[z] = base + i;
+                pending--;
+            }
+        }
+    }
+}
+
+/* Q8.23 samples are in [-256.0, 256.0), floats beyond that are saturated */
+void floatToQ23(const float *in, int32_t *out, uint32_t samples)
+{
+#if defined(__ARM_NEON__)
+    for (; samples >= 4; samples -= 4) {
+        vst1q_s32(out, vcvtq_n_s32_f32(vld1q_f32(in), 23));
+        in += 4;
+        out += 4;
+    }
+#endif
+
+    while (samples--) {
+        float f = *in++ * (float)(1 << 23);
+        if (f >= 2147483647.0f)
+            *out++ = 0x7fffffff;
+        else if (f <= -2147483648.0f)
+            *out++ = (int32_t)0x80000000;
+        else
+            *out++ = (int32_t)f;
+    }
+}
+
+#if defined(__ARM_NEON__)
+/* Channels 4-7 of a 6 or 8 channel frame, 6 channels are padded with zeros */
+static inline int16x4_t loadHigh(const int16_t *in, uint32_t channels)
+{
+    if (channels == 8)
+        return vld1_s16(in + 4);
+
+    int32x2_t v = vld1_lane_s32((const int32_t *)(in + 4), vdup_n_s32(0), 0);
+    return vreinterpret_s16_s32(v);
+}
+
+static inline float32x4_t loadHigh(const float *in, uint32_t channels)
+{
+    if (channels == 8)
+        return vld1q_f32(in + 4);
+
+    return vcombine_f32(vld1_f32(in + 4), vdup_n_f32(0.0f));
+}
+
+/* Left and right sums of the products, as [L, R] */
+static inline int32x2_t sumLR(int32x4_t left, int32x4_t right)
+{
+    return vpadd_s32(vpadd_s32(vget_low_s32(left), vget_high_s32(left)),
+                     vpadd_s32(vget_low_s32(right), vget_high_s32(right)));
+}
+
+static inline float32x2_t sumLR(float32x4_t left, float32x4_t right)
+{
+    return vpadd_f32(vpadd_f32(vget_low_f32(left), vget_high_f32(left)),
+                     vpadd_f32(vget_low_f32(right), vget_high_f32(right)));
+}
+#endif
+
+void downmixQ15(const int16_t *in, int16_t *out, uint32_t frames, uint32_t channels,
+                const int16_t *coefs)
+{
+#if defined(__ARM_NEON__)
+    int16x4_t l0 = vld1_s16(coefs);
+    int16x4_t l1 = vld1_s16(coefs + 4);
+    int16x4_t r0 = vld1_s16(coefs + 8);
+    int16x4_t r1 = vld1_s16(coefs + 12);
+
+    /* Two frames per iteration, rounded and saturated together */
+    for (; frames >= 2; frames -= 2) {
+        int32x2_t lr[2];
+        for (uint32_t f = 0; f < 2; f++) {
+            int16x4_t lo = vld1_s16(in);
+            int16x4_t hi = loadHigh(in, channels);
+            int32x4_t left = vmlal_s16(vmull_s16(lo, l0), hi, l1);
+            int32x4_t right = vmlal_s16(vmull_s16(lo, r0), hi, r1);
+            lr[f] = sumLR(left, right);
+            in += channels;
+        }
+        vst1_s16(out, vqrshrn_n_s32(vcombine_s32(lr[0], lr[1]), 14));
+        out += 4;
+    }
+#endif
+
+    while (frames--) {
+        int32_t left = 0, right = 0;
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            left += in[ch] * coefs[ch];
+            right += in[ch] * coefs[8 + ch];
+        }
+        *out++ = saturate16((left + (1 << 13)) >> 14);
+        *out++ = saturate16((right + (1 << 13)) >> 14);
+        in += channels;
+    }
+}
+
+static inline int32_t sampleToQ23(float f)
+{
+    f *= (float)(1 << 23);
+    if (f >= 2147483647.0f)
+        return 0x7fffffff;
+    if (f <= -2147483648.0f)
+        return (int32_t)0x80000000;
+    return (int32_t)f;
+}
+
+void downmixFloatToQ23(const float *in, int32_t *out, uint32_t frames, uint32_t channels,
+                       const float *coefs)
+{
+#if defined(__ARM_NEON__)
+    float32x4_t l0 = vld1q_f32(coefs);
+    float32x4_t l1 = vld1q_f32(coefs + 4);
+    float32x4_t r0 = vld1q_f32(coefs + 8);
+    float32x4_t r1 = vld1q_f32(coefs + 12);
+
+    for (; frames; frames--) {
+        float32x4_t lo = vld1q_f32(in);
+        float32x4_t hi = loadHigh(in, channels);
+        float32x4_t left = vmlaq_f32(vmulq_f32(lo, l0), hi, l1);
+        float32x4_t right = vmlaq_f32(vmulq_f32(lo, r0), hi, r1);
+        vst1_s32(out, vcvt_n_s32_f32(sumLR(left, right), 23));
+        in += channels;
+        out += 2;
+    }
+#endif
+
+    while (frames--) {
+        float left = 0.0f, right = 0.0f;
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            left += in[ch] * coefs[ch];
+            right += in[ch] * coefs[8 + ch];
+        }
+        *out++ = sampleToQ23(left);
+        *out++ = sampleToQ23(right);
+        in += channels;
+    }
+}
+
+/* In float, Q8.23 sums of up to 8 channels could overflow 32 bits */
+void downmixQ23(const int32_t *in, int32_t *out, uint32_t frames, uint32_t channels,
+                const float *coefs)
+{
+    const float scale = 1.0f / (1 << 23);
+
+    while (frames--) {
+        float left = 0.0f, right = 0.0f;
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            float sample = in[ch] * scale;
+            left += sample * coefs[ch];
+            right += sample * coefs[8 + ch];
+        }
+        *out++ = sampleToQ23(left);
+        *out++ = sampleToQ23(right);
+        in += channels;
+    }
+}
+
+void scaleQ23(const int32_t *in, int32_t *out, uint32_t samples, int32_t gain)
+{
+#if defined(__ARM_NEON__)
+    int32x4_t g = vdupq_n_s32(gain);
+
+    for (; samples >= 4; samples -= 4) {
+        vst1q_s32(out, vqrdmulhq_s32(vld1q_s32(in), g));
+        in += 4;
+        out += 4;
+    }
+#endif
+
+    /* Same rounding as NEON's VQRDMULH, no saturation needed for gain < 1.0 */
+    while (samples--)
+        *out++ = ((int64_t)*in++ * gain + (1LL << 30)) >> 31;
+}
+
+void narrowQ23(const int32_t *in, int16_t *out, uint32_t samples)
+{
+#if defined(__ARM_NEON__)
+    for (; samples >= 8; samples -= 8) {
+        int16x4_t lo = vqrshrn_n_s32(vld1q_s32(in), 8);
+        int16x4_t hi = vqrshrn_n_s32(vld1q_s32(in + 4), 8);
+        vst1q_s16(out, vcombine_s16(lo, hi));
+        in += 8;
+        out += 8;
+    }
+#endif
+
+    /* Same rounding as NEON's VQRSHRN, 64-bit to not overflow near full scale */
+    while (samples--)
+        *out++ = saturate16(((int64_t)*in++ + (1 << 7)) >> 8);
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+MasterVolume::MasterVolume()
+    : mState(GainRamp::kUnityQ30)
+{
+}
+
+void MasterVolume::setVolume(float volume)
+{
+    int32_t gain;
+
+    if (volume <= 0.0f)
+        gain = 0;
+    else if (volume >= 1.0f)
+        gain = GainRamp::kUnityQ30;
+    else
+        gain = (int32_t)(volume * GainRamp::kUnityQ30);
+
+    int32_t oldState, newState;
+    do {
+        oldState = android_atomic_acquire_load(&mState);
+        newState = (oldState & kMuteFlag) | gain;
+    } while (android_atomic_release_cas(oldState, newState, &mState));
+}
+
+float MasterVolume::getVolume() const
+{
+    return (float)getGain(getState()) / GainRamp::kUnityQ30;
+}
+
+void MasterVolume::setMute(bool mute)
+{
+    if (mute)
+        android_atomic_or(kMuteFlag, &mState);
+    else
+        android_atomic_and(~kMuteFlag, &mState);
+}
+
+bool MasterVolume::getMute() const
+{
+    return getState() & kMuteFlag;
+}
+
+int32_t MasterVolume::getState() const
+{
+    return android_atomic_acquire_load(&mState);
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+/* Bound to const references, e.g. as the fill value of a vector */
+const int32_t GainRamp::kUnityQ30;
+
+GainRamp::GainRamp(uint32_t rampFrames)
+    : mRampLength(rampFrames), mRampFrames(0)
+{
+    reset(1.0f, 1.0f);
+}
+
+int32_t GainRamp::toQ30(float gain)
+{
+    if (gain <= 0.0f)
+        return 0;
+    if (gain >= 1.0f)
+        return kUnityQ30;
+
+    return (int32_t)(gain * kUnityQ30);
+}
+
+void GainRamp::setTarget(float left, float right)
+{
+    android_atomic_release_store(toQ30(left), &mTarget[0]);
+    android_atomic_release_store(toQ30(right), &mTarget[1]);
+}
+
+void GainRamp::reset(float left, float right)
+{
+    mTarget[0] = mGain[0] = mEnd[0] = toQ30(left);
+    mTarget[1] = mGain[1] = mEnd[1] = toQ30(right);
+    mStep[0] = mStep[1] = 0;
+    mRampFrames = 0;
+}
+
+bool GainRamp::isUnity() const
+{
+    return !mRampFrames &&
+           (mGain[0] == kUnityQ30) && (mGain[1] == kUnityQ30) &&
+           (android_atomic_acquire_load(&mTarget[0]) == kUnityQ30) &&
+           (android_atomic_acquire_load(&mTarget[1]) == kUnityQ30);
+}
+
+bool GainRamp::isMuted() const
+{
+    return !mRampFrames &&
+           !mGain[0] && !mGain[1] &&
+           !android_atomic_acquire_load(&mTarget[0]) &&
+           !android_atomic_acquire_load(&mTarget[1]);
+}
+
+/* Start a new ramp from the current gain if the target changed */
+void GainRamp::update()
+{
+    int32_t target[2];
+
+    target[0] = android_atomic_acquire_load(&mTarget[0]);
+    target[1] = android_atomic_acquire_load(&mTarget[1]);
+
+    if ((target[0] == mEnd[0]) && (target[1] == mEnd[1]))
+        return;
+
+    for (uint32_t i = 0; i < 2; i++) {
+        mEnd[i] = target[i];
+        if (mRampLength)
+            mStep[i] = (mEnd[i] - mGain[i]) / (int32_t)mRampLength;
+        else
+            mGain[i] = mEnd[i];
+    }
+
+    mRampFrames = mRampLength;
+}
+
+void GainRamp::process(const int16_t *in, int16_t *out, uint32_t frames, uint32_t channels)
+{
+    update();
+
+    if (mRampFrames) {
+        uint32_t n = (frames < mRampFrames) ? frames : mRampFrames;
+
+        if (channels == 2) {
+            rampStereoQ15(in, out, n, mGain[0], mStep[0], mGain[1], mStep[1]);
+            mGain[0] += mStep[0] * n;
+            mGain[1] += mStep[1] * n;
+        } else {
+            for (uint32_t i = 0; i < n; i++) {
+                for (uint32_t ch = 0; ch < channels; ch++)
+                    *out++ = mulQ15(*in++, toQ15(mGain[ch & 1]));
+                mGain[0] += mStep[0];
+                mGain[1] += mStep[1];
+            }
+        }
+
+        mRampFrames -= n;
+        if (!mRampFrames) {
+            /* Land exactly on the target, the steps are truncated */
+            mGain[0] = mEnd[0];
+            mGain[1] = mEnd[1];
+        }
+
+        frames -= n;
+        if (channels == 2) {
+            in += n * channels;
+            out += n * channels;
+        }
+    }
+
+    if (!frames)
+        return;
+
+    if ((mGain[0] == kUnityQ30) && (mGain[1] == kUnityQ30)) {
+        if (in != out)
+            memcpy(out, in, frames * channels * sizeof(int16_t));
+        return;
+    }
+
+    int16_t left = toQ15(mGain[0]);
+    int16_t right = toQ15(mGain[1]);
+
+    if ((left == right) || (channels == 1)) {
+        scaleQ15(in, out, frames * channels, left);
+    } else if (!(channels & 1)) {
+        scaleStereoQ15(in, out, (frames * channels) / 2, left, right);
+    } else {
+        for (uint32_t i = 0; i < frames; i++)
+            for (uint32_t ch = 0; ch < channels; ch++)
+                *out++ = mulQ15(*in++, (ch & 1) ? right : left);
+    }
+}
+
+/*
+ * Same as the 16-bit version. Ramps are short, they are done per frame
+ * in 64 bits, while flat gains use the vectorized Q8.23 kernel. Both round
+ * to nearest, so the end of a ramp doesn't step against the flat gain.
+ */
+void GainRamp::process(const int32_t *in, int32_t *out, uint32_t frames, uint32_t channels)
+{
+    update();
+
+    if (mRampFrames) {
+        uint32_t n = (frames < mRampFrames) ? frames : mRampFrames;
+
+        for (uint32_t i = 0; i < n; i++) {
+            for (uint32_t ch = 0; ch < channels; ch++)
+                *out++ = ((int64_t)*in++ * mGain[ch & 1] + (1LL << 29)) >> 30;
+            mGain[0] += mStep[0];
+            mGain[1] += mStep[1];
+        }
+
+        mRampFrames -= n;
+        if (!mRampFrames) {
+            mGain[0] = mEnd[0];
+            mGain[1] = mEnd[1];
+        }
+
+        frames -= n;
+    }
+
+    if (!frames)
+        return;
+
+    if ((mGain[0] == kUnityQ30) && (mGain[1] == kUnityQ30)) {
+        if (in != out)
+            memcpy(out, in, frames * channels * sizeof(int32_t));
+        return;
+    }
+
+    /* Q30 to Q31, unity is just below 1.0 in Q31 */
+    int32_t left = (mGain[0] < kUnityQ30) ? (mGain[0] << 1) : 0x7fffffff;
+    int32_t right = (mGain[1] < kUnityQ30) ? (mGain[1] << 1) : 0x7fffffff;
+
+    if ((left == right) || (channels == 1)) {
+        scaleQ23(in, out, frames * channels, left);
+    } else {
+        for (uint32_t i = 0; i < frames; i++)
+            for (uint32_t ch = 0; ch < channels; ch++)
+                *out++ = ((int64_t)*in++ * ((ch & 1) ? right : left) + (1LL << 30)) >> 31;
+    }
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+Crossfade::Crossfade(uint32_t frames)
+    : mLength(frames ? frames : 1), mPosition(mLength)
+{
+    mOutCurve.resize(mLength + 1);
+    mInCurve.resize(mLength + 1);
+
+    for (uint32_t i = 0; i <= mLength; i++) {
+        double angle = (M_PI / 2) * i / mLength;
+        mOutCurve[i] = (int16_t)lrint(cos(angle) * 32767);
+        mInCurve[i] = (int16_t)lrint(sin(angle) * 32767);
+    }
+}
+
+void Crossfade::process(const int16_t *in, int16_t *fadeOut, int16_t *fadeIn,
+                        uint32_t frames, uint32_t channels)
+{
+    uint32_t n = mLength - mPosition;
+    if (n > frames)
+        n = frames;
+
+    const int16_t *outGain = &mOutCurve[mPosition];
+    const int16_t *inGain = &mInCurve[mPosition];
+    uint32_t i = 0;
+
+#if defined(__ARM_NEON__)
+    /* Four frames per iteration, each gain duplicated for the left and right slots */
+    if (channels == 2) {
+        for (; i + 4 <= n; i += 4) {
+            int16x4x2_t go = vzip_s16(vld1_s16(outGain + i), vld1_s16(outGain + i));
+            int16x4x2_t gi = vzip_s16(vld1_s16(inGain + i), vld1_s16(inGain + i));
+            int16x8_t g0 = vcombine_s16(go.val[0], go.val[1]);
+            int16x8_t g1 = vcombine_s16(gi.val[0], gi.val[1]);
+            int16x8_t x = vld1q_s16(in);
+
+            vst1q_s16(fadeOut, vqrdmulhq_s16(x, g0));
+            vst1q_s16(fadeIn, vqrdmulhq_s16(x, g1));
+            in += 8;
+            fadeOut += 8;
+            fadeIn += 8;
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            *fadeOut++ = mulQ15(*in, outGain[i]);
+            *fadeIn++ = mulQ15(*in++, inGain[i]);
+        }
+    }
+
+    mPosition += n;
+    frames -= n;
+
+    if (frames) {
+        memset(fadeOut, 0, frames * channels * sizeof(int16_t));
+        memcpy(fadeIn, in, frames * channels * sizeof(int16_t));
+    }
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+ZoneGains::ZoneGains()
+    : mChannels(0)
+{
+    setChannels(2);
+}
+
+/* All zones go back to unity gain */
+void ZoneGains::setChannels(uint32_t channels)
+{
+    Zone zone;
+    zone.gain = zone.end = GainRamp::kUnityQ30;
+    zone.step = 0;
+    zone.delay = zone.length = zone.ramp = 0;
+    zone.pending = false;
+
+    mChannels = channels;
+    mZones.assign(channels / 2, zone);
+    mGains.resize(channels / 2);
+    mSteps.resize(channels / 2);
+}
+
+/* Ramp starts 'delayFrames' into the next accumulate(), the current one is dropped */
+void ZoneGains::setTarget(uint32_t zone, int32_t target, uint32_t rampFrames,
+                          uint32_t delayFrames)
+{
+    Zone &z = mZones[zone];
+
+    if (target == z.end)
+        return;
+
+    z.end = target;
+    z.delay = delayFrames;
+    z.length = rampFrames ? rampFrames : 1;
+    z.ramp = 0;
+    z.pending = true;
+}
+
+bool ZoneGains::isUnity() const
+{
+    for (vector<Zone>::const_iterator i = mZones.begin(); i != mZones.end(); ++i) {
+        if (i->pending || i->ramp || (i->gain != GainRamp::kUnityQ30))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Accumulate in chunks, split where a ramp starts or ends so that the
+ * kernel only sees linear segments. Unity chunks are a plain accumulate.
+ */
+void ZoneGains::accumulate(int32_t *acc, const int16_t *in, uint32_t frames)
+{
+    uint32_t zones = mZones.size();
+
+    while (frames) {
+        uint32_t n = frames;
+        bool unity = true;
+
+        for (uint32_t i = 0; i < zones; i++) {
+            Zone &z = mZones[i];
+
+            if (z.pending && !z.delay) {
+                z.step = (z.end - z.gain) / (int32_t)z.length;
+                z.ramp = z.length;
+                z.pending = false;
+            }
+
+            if (z.pending) {
+                if (n > z.delay)
+                    n = z.delay;
+            } else if (z.ramp) {
+                if (n > z.ramp)
+                    n = z.ramp;
+            }
+
+            mGains[i] = z.gain;
+            mSteps[i] = z.ramp ? z.step : 0;
+            if (z.ramp || (z.gain != GainRamp::kUnityQ30))
+                unity = false;
+        }
+
+        if (unity)
+            accumulateQ15(acc, in, n * mChannels);
+        else
+            accumulateRampQ15(acc, in, n, mChannels, &mGains[0], &mSteps[0]);
+
+        for (uint32_t i = 0; i < zones; i++) {
+            Zone &z = mZones[i];
+
+            if (z.pending) {
+                z.delay -= n;
+            } else if (z.ramp) {
+                z.gain += z.step * (int32_t)n;
+                z.ramp -= n;
+                /* Land exactly on the target, the steps are truncated */
+                if (!z.ramp)
+                    z.gain = z.end;
+            }
+        }
+
+        acc += n * mChannels;
+        in += n * mChannels;
+        frames -= n;
+    }
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+ZoneEq::ZoneEq()
+    : mChannels(0), mRate(48000), mSections(0)
+{
+    setChannels(2);
+}
+
+/* Zones are all reset to no filtering */
+void ZoneEq::setChannels(uint32_t channels)
+{
+    mChannels = channels;
+    mSpecs.assign(channels / 2, vector<BiquadSpec>());
+    design();
+}
+
+void ZoneEq::setSampleRate(uint32_t rate)
+{
+    if (rate == mRate)
+        return;
+
+    mRate = rate;
+    design();
+}
+
+int ZoneEq::setZone(uint32_t zone, const vector<BiquadSpec> &specs)
+{
+    if ((zone >= mSpecs.size()) || (specs.size() > kMaxSections))
+        return -EINVAL;
+
+    for (uint32_t i = 0; i < specs.size(); i++) {
+        if (!isValid(specs[i], mRate))
+            return -EINVAL;
+    }
+
+    mSpecs[zone] = specs;
+    design();
+
+    return 0;
+}
+
+uint32_t ZoneEq::getZoneMask() const
+{
+    uint32_t mask = 0;
+
+    for (uint32_t zone = 0; zone < mSpecs.size(); zone++) {
+        if (!mSpecs[zone].empty())
+            mask |= 1 << zone;
+    }
+
+    return mask;
+}
+
+void ZoneEq::reset()
+{
+    mState.assign(mState.size(), 0.0f);
+}
+
+/* Only frequencies below Nyquist give a stable biquad */
+bool ZoneEq::isValid(const BiquadSpec &spec, uint32_t rate)
+{
+    return (spec.freq > 0.0f) && (spec.freq < rate / 2.0f) && (spec.q > 0.0f);
+}
+
+/*
+ * Coefficients of all the sections, zones with fewer sections than the
+ * longest cascade are padded with pass-through sections. Sections set at
+ * a higher rate may be above Nyquist at the current one, they are
+ * bypassed until the rate allows them again.
+ */
+void ZoneEq::design()
+{
+    mSections = 0;
+    for (uint32_t zone = 0; zone < mSpecs.size(); zone++) {
+        if (mSpecs[zone].size() > mSections)
+            mSections = mSpecs[zone].size();
+    }
+
+    /* Filter states are kept as long as the layout doesn't change */
+    mCoefs.assign(mSections * NUM_COEFS * mChannels, 0.0f);
+    if (mState.size() != mSections * 2 * mChannels)
+        mState.assign(mSections * 2 * mChannels, 0.0f);
+
+    for (uint32_t s = 0; s < mSections; s++) {
+        for (uint32_t ch = 0; ch < mChannels; ch++) {
+            const vector<BiquadSpec> &specs = mSpecs[ch / 2];
+            float coefs[NUM_COEFS] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+            if ((s < specs.size()) && isValid(specs[s], mRate))
+                designSection(specs[s], mRate, coefs);
+            else if ((s < specs.size()) && !(ch & 1))
+                ALOGW("ZoneEq: section %u of zone %u at %.0f Hz bypassed at %u Hz",
+                      s, ch / 2, specs[s].freq, mRate);
+
+            for (uint32_t c = 0; c < NUM_COEFS; c++)
+                mCoefs[(s * NUM_COEFS + c) * mChannels + ch] = coefs[c];
+        }
+    }
+}
+
+void ZoneEq::designSection(const BiquadSpec &spec, uint32_t rate, float *coefs)
+{
+    double w0 = 2.0 * M_PI * spec.freq / rate;
+    double cosw = cos(w0);
+    double alpha = sin(w0) / (2.0 * spec.q);
+    double A = pow(10.0, spec.gainDb / 40.0);
+    double sqA = 2.0 * sqrt(A) * alpha;
+    double b0, b1, b2, a0, a1, a2;
+
+    switch (spec.type) {
+    case BiquadSpec::LOW_SHELF:
+        b0 = A * ((A + 1) - (A - 1) * cosw + sqA);
+        b1 = 2 * A * ((A - 1) - (A + 1) * cosw);
+        b2 = A * ((A + 1) - (A - 1) * cosw - sqA);
+        a0 = (A + 1) + (A - 1) * cosw + sqA;
+        a1 = -2 * ((A - 1) + (A + 1) * cosw);
+        a2 = (A + 1) + (A - 1) * cosw - sqA;
+        break;
+    case BiquadSpec::HIGH_SHELF:
+        b0 = A * ((A + 1) + (A - 1) * cosw + sqA);
+        b1 = -2 * A * ((A - 1) + (A + 1) * cosw);
+        b2 = A * ((A + 1) + (A - 1) * cosw - sqA);
+        a0 = (A + 1) - (A - 1) * cosw + sqA;
+        a1 = 2 * ((A - 1) - (A + 1) * cosw);
+        a2 = (A + 1) - (A - 1) * cosw - sqA;
+        break;
+    case BiquadSpec::LOW_PASS:
+        b0 = (1 - cosw) / 2;
+        b1 = 1 - cosw;
+        b2 = (1 - cosw) / 2;
+        a0 = 1 + alpha;
+        a1 = -2 * cosw;
+        a2 = 1 - alpha;
+        break;
+    case BiquadSpec::HIGH_PASS:
+        b0 = (1 + cosw) / 2;
+        b1 = -(1 + cosw);
+        b2 = (1 + cosw) / 2;
+        a0 = 1 + alpha;
+        a1 = -2 * cosw;
+        a2 = 1 - alpha;
+        break;
+    case BiquadSpec::PEAK:
+    default:
+        b0 = 1 + alpha * A;
+        b1 = -2 * cosw;
+        b2 = 1 - alpha * A;
+        a0 = 1 + alpha / A;
+        a1 = -2 * cosw;
+        a2 = 1 - alpha / A;
+        break;
+    }
+
+    coefs[B0] = b0 / a0;
+    coefs[B1] = b1 / a0;
+    coefs[B2] = b2 / a0;
+    coefs[A1] = a1 / a0;
+    coefs[A2] = a2 / a0;
+}
+
+/*
+ * Transposed direct form II, in place on the 32-bit mix. Samples are in
+ * Q15 units with the mix headroom, float keeps the precision of the low
+ * frequency sections. Channels are filtered in groups of 4 (or 2 for the
+ * CPU port), each group runs through all its frames before the next one.
+ */
+void ZoneEq::process(int32_t *acc, uint32_t frames)
+{
+    if (!mSections)
+        return;
+
+    uint32_t ch = 0;
+
+#if defined(__ARM_NEON__)
+    for (; ch + 4 <= mChannels; ch += 4) {
+        float32x4_t b0[kMaxSections], b1[kMaxSections], b2[kMaxSections];
+        float32x4_t a1[kMaxSections], a2[kMaxSections];
+        float32x4_t z1[kMaxSections], z2[kMaxSections];
+
+        for (uint32_t s = 0; s < mSections; s++) {
+            const float *c = &mCoefs[s * NUM_COEFS * mChannels + ch];
+            b0[s] = vld1q_f32(c + B0 * mChannels);
+            b1[s] = vld1q_f32(c + B1 * mChannels);
+            b2[s] = vld1q_f32(c + B2 * mChannels);
+            a1[s] = vld1q_f32(c + A1 * mChannels);
+            a2[s] = vld1q_f32(c + A2 * mChannels);
+            z1[s] = vld1q_f32(&mState[(2 * s) * mChannels + ch]);
+            z2[s] = vld1q_f32(&mState[(2 * s + 1) * mChannels + ch]);
+        }
+
+        int32_t *p = acc + ch;
+        for (uint32_t i = 0; i < frames; i++, p += mChannels) {
+            float32x4_t x = vcvtq_f32_s32(vld1q_s32(p));
+            for (uint32_t s = 0; s < mSections; s++) {
+                float32x4_t y = vmlaq_f32(z1[s], b0[s], x);
+                z1[s] = vmlsq_f32(vmlaq_f32(z2[s], b1[s], x), a1[s], y);
+                z2[s] = vmlsq_f32(vmulq_f32(b2[s], x), a2[s], y);
+                x = y;
+            }
+            vst1q_s32(p, vcvtq_s32_f32(x));
+        }
+
+        for (uint32_t s = 0; s < mSections; s++) {
+            vst1q_f32(&mState[(2 * s) * mChannels + ch], z1[s]);
+            vst1q_f32(&mState[(2 * s + 1) * mChannels + ch], z2[s]);
+        }
+    }
+
+    for (; ch + 2 <= mChannels; ch += 2) {
+        float32x2_t b0[kMaxSections], b1[kMaxSections], b2[kMaxSections];
+        float32x2_t a1[kMaxSections], a2[kMaxSections];
+        float32x2_t z1[kMaxSections], z2[kMaxSections];
+
+        for (uint32_t s = 0; s < mSections; s++) {
+            const float *c = &mCoefs[s * NUM_COEFS * mChannels + ch];
+            b0[s] = vld1_f32(c + B0 * mChannels);
+            b1[s] = vld1_f32(c + B1 * mChannels);
+            b2[s] = vld1_f32(c + B2 * mChannels);
+            a1[s] = vld1_f32(c + A1 * mChannels);
+            a2[s] = vld1_f32(c + A2 * mChannels);
+            z1[s] = vld1_f32(&mState[(2 * s) * mChannels + ch]);
+            z2[s] = vld1_f32(&mState[(2 * s + 1) * mChannels + ch]);
+        }
+
+        int32_t *p = acc + ch;
+        for (uint32_t i = 0; i < frames; i++, p += mChannels) {
+            float32x2_t x = vcvt_f32_s32(vld1_s32(p));
+            for (uint32_t s = 0; s < mSections; s++) {
+                float32x2_t y = vmla_f32(z1[s], b0[s], x);
+                z1[s] = vmls_f32(vmla_f32(z2[s], b1[s], x), a1[s], y);
+                z2[s] = vmls_f32(vmul_f32(b2[s], x), a2[s], y);
+                x = y;
+            }
+            vst1_s32(p, vcvt_s32_f32(x));
+        }
+
+        for (uint32_t s = 0; s < mSections; s++) {
+            vst1_f32(&mState[(2 * s) * mChannels + ch], z1[s]);
+            vst1_f32(&mState[(2 * s + 1) * mChannels + ch], z2[s]);
+        }
+    }
+#endif
+
+    for (; ch < mChannels; ch++) {
+        int32_t *p = acc + ch;
+        for (uint32_t i = 0; i < frames; i++, p += mChannels) {
+            float x = (float)*p;
+            for (uint32_t s = 0; s < mSections; s++) {
+                const float *c = &mCoefs[s * NUM_COEFS * mChannels + ch];
+                float &z1 = mState[(2 * s) * mChannels + ch];
+                float &z2 = mState[(2 * s + 1) * mChannels + ch];
+                float y = c[B0 * mChannels] * x + z1;
+                z1 = c[B1 * mChannels] * x - c[A1 * mChannels] * y + z2;
+                z2 = c[B2 * mChannels] * x - c[A2 * mChannels] * y;
+                x = y;
+            }
+            *p = (int32_t)x;
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+ZoneLimiter::ZoneLimiter()
+    : mDelayPos(0), mChannels(0), mRate(48000), mReleaseCoef(0.0f),
+      mThreshold(0x7fff), mFrame(0), mEnabled(false)
+{
+    setChannels(2);
+    setSampleRate(mRate);
+}
+
+void ZoneLimiter::setChannels(uint32_t channels)
+{
+    mChannels = channels;
+    mZones.resize(channels / 2);
+    mDelay.resize((kLookahead - 1) * channels);
+    reset();
+}
+
+/* One-pole release, about 63% of the way back to unity in kReleaseMs */
+void ZoneLimiter::setSampleRate(uint32_t rate)
+{
+    mRate = rate;
+    mReleaseCoef = 1.0f - expf(-1000.0f / (kReleaseMs * rate));
+}
+
+/* Threshold in dBFS of a single 16-bit stream, the mix has more headroom */
+void ZoneLimiter::setThreshold(float dbfs)
+{
+    if (dbfs > 0.0f)
+        dbfs = 0.0f;
+
+    mThreshold = (int32_t)(32767.0f * powf(10.0f, dbfs / 20.0f));
+    if (mThreshold < 1)
+        mThreshold = 1;
+}
+
+float ZoneLimiter::getThreshold() const
+{
+    return 20.0f * log10f(mThreshold / 32767.0f);
+}
+
+void ZoneLimiter::setEnabled(bool enabled)
+{
+    if (enabled != mEnabled) {
+        mEnabled = enabled;
+        reset();
+    }
+}
+
+void ZoneLimiter::reset()
+{
+    for (vector<Zone>::iterator i = mZones.begin(); i != mZones.end(); ++i) {
+        i->release = 1.0f;
+        i->head = 0;
+        i->count = 0;
+        for (uint32_t j = 0; j < kLookahead; j++)
+            i->box[j] = GainRamp::kUnityQ30;
+        i->boxSum = (int64_t)GainRamp::kUnityQ30 * kLookahead;
+        i->periodMin = GainRamp::kUnityQ30;
+        i->maxReduction = GainRamp::kUnityQ30;
+    }
+
+    mDelay.assign(mDelay.size(), 0);
+    mDelayPos = 0;
+    mFrame = 0;
+}
+
+float ZoneLimiter::getReduction(uint32_t zone) const
+{
+    return -20.0f * log10f((float)mZones[zone].periodMin / GainRamp::kUnityQ30);
+}
+
+float ZoneLimiter::getMaxReduction(uint32_t zone) const
+{
+    return -20.0f * log10f((float)mZones[zone].maxReduction / GainRamp::kUnityQ30);
+}
+
+/* Peak of each zone of each frame, max(|left|, |right|) */
+void ZoneLimiter::findPeaks(const int32_t *acc, uint32_t frames)
+{
+    int32_t *peaks = &mPeaks[0];
+    uint32_t samples = frames * mChannels;
+
+#if defined(__ARM_NEON__)
+    /* 4 samples are 2 zones of a frame, or zone 0 of 2 frames on CPU */
+    if ((mChannels == 2) || !(mChannels & 3)) {
+        for (; samples >= 4; samples -= 4) {
+            int32x4_t a = vqabsq_s32(vld1q_s32(acc));
+            vst1_s32(peaks, vpmax_s32(vget_low_s32(a), vget_high_s32(a)));
+            acc += 4;
+            peaks += 2;
+        }
+    }
+#endif
+
+    for (; samples; samples -= 2) {
+        int32_t l = abs(acc[0]);
+        int32_t r = abs(acc[1]);
+        *peaks++ = (l > r) ? l : r;
+        acc += 2;
+    }
+}
+
+/* Smoothed gain (Q30) of each zone of each frame */
+void ZoneLimiter::computeGains(uint32_t frames)
+{
+    uint32_t zones = mZones.size();
+
+    for (uint32_t z = 0; z < zones; z++) {
+        Zone &zone = mZones[z];
+        zone.periodMin = GainRamp::kUnityQ30;
+
+        for (uint32_t i = 0; i < frames; i++) {
+            uint32_t frame = mFrame + i;
+            int32_t peak = mPeaks[i * zones + z];
+
+            /* Instant attack, exponential release */
+            float required = (peak > mThreshold) ? (float)mThreshold / peak : 1.0f;
+            zone.release += (1.0f - zone.release) * mReleaseCoef;
+            if (required < zone.release)
+                zone.release = required;
+            int32_t gain = (int32_t)(zone.release * GainRamp::kUnityQ30);
+
+            /* Sliding minimum over the look-ahead, monotonic queue */
+            if (zone.count && (frame - zone.minFrame[zone.head] >= kLookahead)) {
+                zone.head = (zone.head + 1) % kLookahead;
+                zone.count--;
+            }
+            while (zone.count &&
+                   (zone.minGain[(zone.head + zone.count - 1) % kLookahead] >= gain))
+                zone.count--;
+            uint32_t tail = (zone.head + zone.count) % kLookahead;
+            zone.minGain[tail] = gain;
+            zone.minFrame[tail] = frame;
+            zone.count++;
+            int32_t hold = zone.minGain[zone.head];
+
+            /* Box filter over the look-ahead */
+            uint32_t pos = frame % kLookahead;
+            zone.boxSum += hold - zone.box[pos];
+            zone.box[pos] = hold;
+            int32_t smooth = (int32_t)(zone.boxSum / kLookahead);
+
+            mGains[i * zones + z] = smooth;
+            if (smooth < zone.periodMin)
+                zone.periodMin = smooth;
+        }
+
+        if (zone.periodMin < zone.maxReduction)
+            zone.maxReduction = zone.periodMin;
+    }
+
+    mFrame += frames;
+}
+
+/* Delayed mix times the gains, the incoming frames go into the delay line */
+void ZoneLimiter::applyGains(int32_t *acc, uint32_t frames)
+{
+    uint32_t zones = mZones.size();
+    const int32_t *gains = &mGains[0];
+    uint32_t delayFrames = kLookahead - 1;
+
+    for (uint32_t i = 0; i < frames; i++, gains += zones) {
+        int32_t *delay = &mDelay[mDelayPos * mChannels];
+        uint32_t ch = 0;
+
+#if defined(__ARM_NEON__)
+        for (; ch + 4 <= mChannels; ch += 4) {
+            uint32_t z = ch / 2;
+            /* Q30 to Q31, unity is saturated to the largest Q31 value */
+            int32x2_t g = vqshl_n_s32(vld1_s32(gains + z), 1);
+            int32x4_t gv = vcombine_s32(vdup_lane_s32(g, 0), vdup_lane_s32(g, 1));
+            int32x4_t in = vld1q_s32(acc + ch);
+            vst1q_s32(acc + ch, vqrdmulhq_s32(vld1q_s32(delay + ch), gv));
+            vst1q_s32(delay + ch, in);
+        }
+#endif
+
+        for (; ch < mChannels; ch++) {
+            int32_t g = gains[ch / 2];
+            int32_t in = acc[ch];
+            acc[ch] = ((int64_t)delay[ch] * g + (1 << 29)) >> 30;
+            delay[ch] = in;
+        }
+
+        acc += mChannels;
+        mDelayPos = (mDelayPos + 1) % delayFrames;
+    }
+}
+
+void ZoneLimiter::process(int32_t *acc, uint32_t frames)
+{
+    if (!mEnabled || !frames)
+        return;
+
+    uint32_t zones = mZones.size();
+    if (mPeaks.size() < frames * zones) {
+        mPeaks.resize(frames * zones);
+        mGains.resize(frames * zones);
+    }
+
+    findPeaks(acc, frames);
+    computeGains(frames);
+    applyGains(acc, frames);
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+DriftResampler::DriftResampler()
+    : mChannels(0), mPhase(0), mRatio(kUnity)
+{
+}
+
+/* 'maxFrames' is the largest output frame count of a single call */
+void DriftResampler::setChannels(uint32_t channels, uint32_t maxFrames)
+{
+    mChannels = channels;
+    mBuffer.resize((kHistory + maxFrames + maxFrames / 256 + 2) * channels);
+    reset();
+}
+
+/* Input is delayed by two frames, the interpolation is centered on the history */
+void DriftResampler::reset()
+{
+    memset(&mBuffer[0], 0, mBuffer.size() * sizeof(int32_t));
+    mPhase = 2 * kUnity;
+}
+
+void DriftResampler::setRatio(double ratio)
+{
+    double max = kMaxPpm / 1000000.0;
+
+    if (ratio > 1.0 + max)
+        ratio = 1.0 + max;
+    else if (ratio < 1.0 - max)
+        ratio = 1.0 - max;
+
+    mRatio = (uint64_t)(ratio * kUnity + 0.5);
+}
+
+/*
+ * The last output frame interpolates around buffer frame floor(p), which
+ * needs one more frame after it. Phase is kept within [2, 3) frames of
+ * the start of the history, it stays there after the buffer is shifted
+ * by the input frames consumed.
+ */
+uint32_t DriftResampler::getInputFrames(uint32_t frames) const
+{
+    if (!frames)
+        return 0;
+
+    uint64_t last = mPhase + (frames - 1) * mRatio;
+
+    return (uint32_t)(last >> 32) - 1;
+}
+
+void DriftResampler::process(int32_t *out, uint32_t frames)
+{
+    uint32_t consumed = getInputFrames(frames);
+    const int32_t *buf = &mBuffer[0];
+
+    for (uint32_t f = 0; f < frames; f++) {
+        uint32_t i = (uint32_t)(mPhase >> 32);
+        float t = (float)(uint32_t)mPhase / kUnity;
+        float t2 = t * t;
+        float t3 = t2 * t;
+
+        /* Catmull-Rom weights of frames i - 1 to i + 2 */
+        float w0 = -0.5f * t3 + t2 - 0.5f * t;
+        float w1 = 1.5f * t3 - 2.5f * t2 + 1.0f;
+        float w2 = -1.5f * t3 + 2.0f * t2 + 0.5f * t;
+        float w3 = 0.5f * t3 - 0.5f * t2;
+
+        const int32_t *x = buf + (i - 1) * mChannels;
+        uint32_t ch = 0;
+
+#if defined(__ARM_NEON__)
+        for (; ch + 4 <= mChannels; ch += 4) {
+            float32x4_t y = vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(x + ch)), w0);
+            y = vmlaq_n_f32(y, vcvtq_f32_s32(vld1q_s32(x + mChannels + ch)), w1);
+            y = vmlaq_n_f32(y, vcvtq_f32_s32(vld1q_s32(x + 2 * mChannels + ch)), w2);
+            y = vmlaq_n_f32(y, vcvtq_f32_s32(vld1q_s32(x + 3 * mChannels + ch)), w3);
+            vst1q_s32(out + ch, vcvtq_s32_f32(y));
+        }
+        for (; ch + 2 <= mChannels; ch += 2) {
+            float32x2_t y = vmul_n_f32(vcvt_f32_s32(vld1_s32(x + ch)), w0);
+            y = vmla_n_f32(y, vcvt_f32_s32(vld1_s32(x + mChannels + ch)), w1);
+            y = vmla_n_f32(y, vcvt_f32_s32(vld1_s32(x + 2 * mChannels + ch)), w2);
+            y = vmla_n_f32(y, vcvt_f32_s32(vld1_s32(x + 3 * mChannels + ch)), w3);
+            vst1_s32(out + ch, vcvt_s32_f32(y));
+        }
+#endif
+
+        for (; ch < mChannels; ch++) {
+            float y = x[ch] * w0 + x[mChannels + ch] * w1 +
+                      x[2 * mChannels + ch] * w2 + x[3 * mChannels + ch] * w3;
+            out[ch] = (int32_t)y;
+        }
+
+        out += mChannels;
+        mPhase += mRatio;
+    }
+
+    /* Last frames become the history of the next call */
+    memmove(&mBuffer[0], &mBuffer[consumed * mChannels], kHistory * mChannels * sizeof(int32_t));
+    mPhase -= (uint64_t)consumed << 32;
+}
+
+}; // namespace android
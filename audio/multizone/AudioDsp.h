@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUDIO_DSP_H_
+#define _AUDIO_DSP_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace android {
+
+using std::vector;
+
+/**
+ * Gain stage for interleaved 16-bit or 32-bit frames. Even channels use the left
+ * gain and odd channels use the right gain. Gain changes are applied
+ * as sample-accurate linear ramps, and unity gain is a bypass.
+ *
+ * The target gain can be updated from any thread, it's picked up by
+ * the next call to process().
+ */
+class GainRamp {
+ public:
+    GainRamp(uint32_t rampFrames = 0);
+
+    void setTarget(float left, float right);
+    void setRampFrames(uint32_t frames) { mRampLength = frames; }
+    void reset(float left, float right);
+    bool isUnity() const;
+    bool isMuted() const;
+
+    void process(const int16_t *in, int16_t *out, uint32_t frames, uint32_t channels);
+    void process(const int32_t *in, int32_t *out, uint32_t frames, uint32_t channels);
+
+    /* Q15 unity gain, expressed in Q30 for the ramp accumulators */
+    static const int32_t kUnityQ30 = 1 << 30;
+
+ protected:
+    void update();
+
+    static int32_t toQ30(float gain);
+
+    volatile int32_t mTarget[2];
+    int32_t mGain[2];
+    int32_t mStep[2];
+    int32_t mEnd[2];
+    uint32_t mRampLength;
+    uint32_t mRampFrames;
+};
+
+/**
+ * Master volume and mute shared by all output ports. Both are packed in
+ * a single word, so a change is seen at once by all the ports that read
+ * it on their next period.
+ */
+class MasterVolume {
+ public:
+    MasterVolume();
+
+    void setVolume(float volume);
+    float getVolume() const;
+    void setMute(bool mute);
+    bool getMute() const;
+
+    int32_t getState() const;
+    static int32_t getGain(int32_t state) { return state & ~kMuteFlag; }
+    static bool isMuted(int32_t state) { return (state & kMuteFlag) || !getGain(state); }
+
+ protected:
+    static const int32_t kMuteFlag = (int32_t)0x80000000;
+
+    volatile int32_t mState;
+};
+
+/**
+ * Equal-power crossfade between two routes of the same stream, e.g. when
+ * it moves from one zone to another. The outgoing route follows a cosine
+ * and the incoming one a sine, so the acoustic power of the two zones
+ * stays constant, where a linear fade dips by 3 dB halfway. Both routes
+ * are rendered in a single pass over the data.
+ *
+ * Not thread-safe, the owner serializes the access.
+ */
+class Crossfade {
+ public:
+    Crossfade(uint32_t frames);
+
+    void start() { mPosition = 0; }
+    bool isDone() const { return mPosition >= mLength; }
+
+    /* Frames past the end of the fade are silent on 'fadeOut', unity on 'fadeIn' */
+    void process(const int16_t *in, int16_t *fadeOut, int16_t *fadeIn,
+                 uint32_t frames, uint32_t channels);
+
+ protected:
+    /* Q15 gains of the fade, mLength + 1 points each */
+    vector<int16_t> mOutCurve;
+    vector<int16_t> mInCurve;
+    uint32_t mLength;
+    uint32_t mPosition;
+};
+
+/**
+ * Gain envelopes of a mixer input, one per zone (a stereo pair of slots),
+ * applied while the input is accumulated into the mix. A new target is
+ * reached with a linear ramp that can start at any frame of the next
+ * call, so the envelope is sample-accurate within a period.
+ *
+ * Not thread-safe, the owner serializes the access.
+ */
+class ZoneGains {
+ public:
+    ZoneGains();
+
+    void setChannels(uint32_t channels);
+    uint32_t getZones() const { return mZones.size(); }
+    void setTarget(uint32_t zone, int32_t target, uint32_t rampFrames, uint32_t delayFrames);
+    int32_t getGain(uint32_t zone) const { return mZones[zone].gain; }
+    bool isUnity() const;
+
+    void accumulate(int32_t *acc, const int16_t *in, uint32_t frames);
+
+ protected:
+    struct Zone {
+        int32_t gain;
+        int32_t end;
+        int32_t step;
+        uint32_t delay;
+        uint32_t length;
+        uint32_t ramp;
+        bool pending;
+    };
+
+    vector<Zone> mZones;
+    vector<int32_t> mGains;
+    vector<int32_t> mSteps;
+    uint32_t mChannels;
+};
+
+/* Second order section of a zone EQ, designed as in the RBJ Audio EQ Cookbook */
+struct BiquadSpec {
+    enum Type {
+        PEAK,
+        LOW_SHELF,
+        HIGH_SHELF,
+        LOW_PASS,
+        HIGH_PASS,
+    };
+
+    Type type;
+    float freq;
+    float gainDb;
+    float q;
+};
+
+/**
+ * Cascades of biquads run on the mix of a port, one per zone (a stereo
+ * pair of slots). All the channels of a frame are filtered at once, in
+ * float: 4 channels per NEON vector, e.g. the 8 JAMR3 slots take two.
+ * Zones without sections are passed through unfiltered.
+ *
+ * Not thread-safe, the owner serializes the access.
+ */
+class ZoneEq {
+ public:
+    ZoneEq();
+
+    void setChannels(uint32_t channels);
+    void setSampleRate(uint32_t rate);
+    int setZone(uint32_t zone, const vector<BiquadSpec> &specs);
+    uint32_t getZoneMask() const;
+    bool isEnabled() const { return mSections > 0; }
+    void reset();
+
+    void process(int32_t *acc, uint32_t frames);
+
+    static const uint32_t kMaxSections = 4;
+
+ protected:
+    void design();
+    static bool isValid(const BiquadSpec &spec, uint32_t rate);
+    static void designSection(const BiquadSpec &spec, uint32_t rate, float *coefs);
+
+    enum { B0, B1, B2, A1, A2, NUM_COEFS };
+
+    vector<vector<BiquadSpec> > mSpecs;
+    /* Per section and channel: coefficients, then the two state variables */
+    vector<float> mCoefs;
+    vector<float> mState;
+    uint32_t mChannels;
+    uint32_t mRate;
+    uint32_t mSections;
+};
+
+/**
+ * Look-ahead peak limiter of a port's mix, independent for each zone (a
+ * stereo pair of slots). The mix is delayed by kLookahead - 1 frames so
+ * that the gain is already down when a peak comes out: the required gain
+ * of each frame goes through a release envelope, a sliding minimum and a
+ * box filter, both over kLookahead frames. Attack is thus a smooth ramp
+ * over the look-ahead, and the output never exceeds the threshold.
+ *
+ * Runs in linear time: the sliding minimum is a monotonic queue. Peak
+ * detection and the gain stage are vectorized, only the gain computer
+ * is scalar (once per frame and zone).
+ *
+ * Not thread-safe, the owner serializes the access.
+ */
+class ZoneLimiter {
+ public:
+    ZoneLimiter();
+
+    void setChannels(uint32_t channels);
+    void setSampleRate(uint32_t rate);
+    void setThreshold(float dbfs);
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return mEnabled; }
+    float getThreshold() const;
+    uint32_t getDelay() const { return mEnabled ? kLookahead - 1 : 0; }
+    void reset();
+
+    void process(int32_t *acc, uint32_t frames);
+
+    /* Gain reduction in dB, in the last period and the largest since reset */
+    uint32_t getZones() const { return mZones.size(); }
+    float getReduction(uint32_t zone) const;
+    float getMaxReduction(uint32_t zone) const;
+
+    static const uint32_t kLookahead = 64;
+    static const uint32_t kReleaseMs = 100;
+
+ protected:
+    void findPeaks(const int32_t *acc, uint32_t frames);
+    void computeGains(uint32_t frames);
+    void applyGains(int32_t *acc, uint32_t frames);
+
+    struct Zone {
+        float release;
+        uint32_t head;
+        uint32_t count;
+        int32_t minGain[kLookahead];
+        uint32_t minFrame[kLookahead];
+        int32_t box[kLookahead];
+        int64_t boxSum;
+        int32_t periodMin;
+        int32_t maxReduction;
+    };
+
+    vector<Zone> mZones;
+    vector<int32_t> mPeaks;
+    vector<int32_t> mGains;
+    vector<int32_t> mDelay;
+    uint32_t mDelayPos;
+    uint32_t mChannels;
+    uint32_t mRate;
+    float mReleaseCoef;
+    int32_t mThreshold;
+    uint32_t mFrame;
+    bool mEnabled;
+};
+
+/**
+ * Resampler for ratios very close to 1.0, to make up for the drift between
+ * clocks (a few hundred ppm at most). Cubic Hermite interpolation of the
+ * 32-bit mix, with the phase and the ratio in Q32 so that the position
+ * never drifts by itself. The caller writes the input frames right after
+ * the history kept from the previous call, so there is no input copy.
+ *
+ * Not thread-safe, the owner serializes the access.
+ */
+class DriftResampler {
+ public:
+    DriftResampler();
+
+    void setChannels(uint32_t channels, uint32_t maxFrames);
+    void reset();
+    void setRatio(double ratio);
+    double getRatio() const { return (double)mRatio / kUnity; }
+
+    /* Input frames to write to getInputBuffer() for the next 'frames' output frames */
+    uint32_t getInputFrames(uint32_t frames) const;
+    int32_t *getInputBuffer() { return &mBuffer[kHistory * mChannels]; }
+    void process(int32_t *out, uint32_t frames);
+
+    static const uint32_t kMaxPpm = 1000;
+
+ protected:
+    static const uint32_t kHistory = 4;
+    static const uint64_t kUnity = 1ULL << 32;
+
+    vector<int32_t> mBuffer;
+    uint32_t mChannels;
+    uint64_t mPhase;
+    uint64_t mRatio;
+};
+
+/*
+ * Q15 gain kernels, 'in' and 'out' can be the same buffer. Flat gains are
+ * Q15, ramp gains and steps are Q30.
+ */
+void scaleQ15(const int16_t *in, int16_t *out, uint32_t samples, int16_t gain);
+void scaleStereoQ15(const int16_t *in, int16_t *out, uint32_t frames,
+                    int16_t left, int16_t right);
+void rampStereoQ15(const int16_t *in, int16_t *out, uint32_t frames,
+                   int32_t left, int32_t leftStep, int32_t right, int32_t rightStep);
+
+/*
+ * Mixing kernels. 16-bit samples are accumulated in 32 bits without
+ * saturation, the gain (Q31) and the saturation to 16 bits are applied
+ * in a single pass once all sources are mixed.
+ */
+void accumulateQ15(int32_t *acc, const int16_t *in, uint32_t samples);
+void saturateQ15(const int32_t *acc, int16_t *out, uint32_t samples);
+void scaleSaturateQ15(const int32_t *acc, int16_t *out, uint32_t samples, int32_t gain);
+void scaleSaturateSlotsQ15(const int32_t *acc, int16_t *out, uint32_t frames,
+                           uint32_t channels, const int32_t *gains);
+
+/*
+ * Accumulate with per-zone gain ramps, gains and steps (per frame) are Q30
+ * and there is one per stereo pair. The channel count must be even.
+ */
+void accumulateRampQ15(int32_t *acc, const int16_t *in, uint32_t frames, uint32_t channels,
+                       const int32_t *gains, const int32_t *steps);
+
+/*
+ * First frame where each zone goes above the threshold, only for the zones
+ * whose onset is still kNoOnset. Onsets are offset by 'base' frames.
+ */
+static const uint32_t kNoOnset = 0xffffffff;
+void findOnsetsQ15(const int16_t *in, uint32_t frames, uint32_t channels, int16_t threshold,
+                   uint32_t base, uint32_t *onsets);
+
+/*
+ * High resolution kernels. Samples are processed as 32-bit Q8.23 (same
+ * as AUDIO_FORMAT_PCM_8_24_BIT), which leaves 8 bits of headroom so that
+ * gains and sums don't clip. Saturation happens only once, when the
+ * samples are rounded down to 16 bits. Flat gains are Q31 and < 1.0.
+ */
+void floatToQ23(const float *in, int32_t *out, uint32_t samples);
+
+/*
+ * 5.1 and 7.1 to stereo downmix. 'coefs' is the 2 x 8 matrix, left row
+ * then right row, 7.1 order (FL FR FC LFE BL BR SL SR) and padded with
+ * zeros for 5.1. 16-bit coefficients are Q14. Float and 8.24 data is
+ * converted to Q8.23 in the same pass.
+ */
+void downmixQ15(const int16_t *in, int16_t *out, uint32_t frames, uint32_t channels,
+                const int16_t *coefs);
+void downmixFloatToQ23(const float *in, int32_t *out, uint32_t frames, uint32_t channels,
+                       const float *coefs);
+void downmixQ23(const int32_t *in, int32_t *out, uint32_t frames, uint32_t channels,
+                const float *coefs);
+void scaleQ23(const int32_t *in, int32_t *out, uint32_t samples, int32_t gain);
+void narrowQ23(const int32_t *in, int16_t *out, uint32_t samples);
+
+}; // namespace android
+
+#endif /* _AUDIO_DSP_H_ */
@@ -23,24 +23,83 @@
 #define ALOGVV(...) do { } while(0)
 #endif
 
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <cutils/log.h>
 #include <cutils/properties.h>
 #include <media/AudioParameter.h>
+#include <utils/String8.h>
+#include <system/thread_defs.h>
 
 #include <AudioHw.h>
 
 namespace android {
 
 AudioStreamOut::AudioStreamOut(AudioHwDevice *hwDev,
+                               AudioOutPort *port,
                                PcmWriter *writer,
                                const PcmParams &params,
                                const SlotMap &map,
-                               audio_devices_t devices)
-    : mHwDev(hwDev), mNullWriter(&mNullPort, params), mWriter(writer),
-      mParams(params), mDevices(devices), mStandby(true), mUsedForVoiceCall(false)
-{
-    if (mWriter)
+                               audio_devices_t devices,
+                               audio_format_t format,
+                               bool ringMode,
+                               bool nonBlocking,
+                               bool direct,
+                               const sp<OutStream> &pooled)
+    : mHwDev(hwDev), mNullWriter(&mNullPort, params), mPort(port), mWriter(writer),
+      mParams(params), mDevices(devices), mFormat(format),
+      mFrameSize(audio_bytes_per_sample(format) * params.channels),
+      mClientChannels(params.channels),
+      mStandby(true), mUsedForVoiceCall(false),
+      mFramesWritten(0), mFramesBase(0), mPortFramesBase(0),
+      mPrevFramesBase(0), mPrevPortFramesBase(0),
+      mVolume((params.sampleRate * AudioHwDevice::kVolumeRampMs) / 1000),
+      mRing(NULL), mNonBlocking(nonBlocking), mDirect(direct), mCallback(NULL), mCookie(NULL),
+      mWriteReadyPending(0), mDrainPending(0), mLockStats("lock hold"), mWriteStats("write()"),
+      mWriteRate("write() calls"), mFadeWriter(NULL),
+      mCrossfade((params.sampleRate * AudioHwDevice::kRouteFadeMs) / 1000),
+      mSwitchStats("route switch"), mIdlePending(false), mIdleDeadline(0),
+      mStandbyRequests(0), mIdles(0), mAvoidedResumes(0), mPoolSlots(0),
+      mPooled(pooled != NULL), mOpenTime(systemTime()), mFirstWrite(true),
+      mSlotMask(0), mSlotPort(NULL)
+{
+    if (!mWriter)
+        return;
+
+    /* Direct streams write to their own port, the PCM writer isn't used */
+    if (mDirect)
+        return;
+
+    /*
+     * In ring mode, write() only copies the data into a ring that is
+     * drained by the PcmWriter thread, so the stream lock is never held
+     * across the blocking hardware write. Non-blocking streams need the
+     * ring to accept only what fits.
+     */
+    if (ringMode || nonBlocking) {
+        uint32_t frames = (mParams.frameCount * mParams.sampleRate) /
+                          mWriter->getParams().sampleRate;
+        mRing = new AudioRing(mParams, AudioHwDevice::kRingPeriods * frames);
+        mStream = new OutStream(params, map, mRing);
+    } else if (pooled != NULL) {
+        mStream = pooled;
+    } else {
         mStream = new AdaptedOutStream(params, map);
+    }
+}
+
+AudioStreamOut::~AudioStreamOut()
+{
+    /* Stream must be gone before the ring it reads from */
+    mStream.clear();
+
+    if (mRing)
+        delete mRing;
 }
 
 int AudioStreamOut::initCheck() const
@@ -51,14 +110,26 @@ int AudioStreamOut::initCheck() const
         ALOGE("AudioStreamOut: initCheck() invalid AudioHwDevice");
         ret = -ENODEV;
     }
+    else if (!mPort) {
+        ALOGE("AudioStreamOut: initCheck() invalid PCM port");
+        ret = -ENODEV;
+    }
     else if (!mWriter || !mWriter->initCheck()) {
         ALOGE("AudioStreamOut: initCheck() invalid PCM writer");
         ret = -ENODEV;
     }
-    else if (mStream == NULL || !mStream->initCheck()) {
+    else if (!mDirect && (mStream == NULL || !mStream->initCheck())) {
         ALOGE("AudioStreamOut: initCheck() invalid Out Stream");
         ret = -ENODEV;
     }
+    else if (mRing && !mRing->initCheck()) {
+        ALOGE("AudioStreamOut: initCheck() invalid ring");
+        ret = -ENODEV;
+    }
+    else if (!mFrameSize) {
+        ALOGE("AudioStreamOut: initCheck() unsupported format 0x%x", mFormat);
+        ret = -EINVAL;
+    }
 
     ALOGV("AudioStreamOut: init check %d", ret);
 
@@ -85,10 +156,13 @@ size_t AudioStreamOut::getBufferSize() const
 {
     size_t size;
 
+    /* Writer is replaced when its port is reconfigured */
+    TimedAutoMutex lock(mLock, mLockStats);
+
     /* Take resampling ratio into account and align to the nearest
      * 16 frames as required by the AudioFlinger */
     size = (mParams.frameCount * mParams.sampleRate) / mWriter->getParams().sampleRate;
-    size = ((size + 15) & ~15) * mParams.frameSize();
+    size = ((size + 15) & ~15) * mFrameSize;
 
     ALOGVV("AudioStreamOut: getBufferSize() %u bytes", size);
 
@@ -97,7 +171,7 @@ size_t AudioStreamOut::getBufferSize() const
 
 audio_channel_mask_t AudioStreamOut::getChannels() const
 {
-    uint32_t channels = mParams.channels;
+    uint32_t channels = mClientChannels;
 
     ALOGVV("AudioStreamOut: getChannels() %u channels", channels);
 
@@ -106,21 +180,10 @@ audio_channel_mask_t AudioStreamOut::getChannels() const
 
 audio_format_t AudioStreamOut::getFormat() const
 {
-    uint32_t sampleBits = mParams.sampleBits;
-
-    ALOGVV("AudioStreamOut: getFormat() %u bits/sample", sampleBits);
+    ALOGVV("AudioStreamOut: getFormat() 0x%x", mFormat);
 
-    switch (sampleBits) {
-    case 8:
-        return AUDIO_FORMAT_PCM_8_BIT;
-    case 24:
-        return AUDIO_FORMAT_PCM_8_24_BIT;
-    case 32:
-        return AUDIO_FORMAT_PCM_32_BIT;
-    case 16:
-    default:
-        return AUDIO_FORMAT_PCM_16_BIT;
-    }
+    /* Client's format, the stream itself is converted to 16-bits/sample */
+    return mFormat;
 }
 
 int AudioStreamOut::setFormat(audio_format_t format)
@@ -135,7 +198,21 @@ int AudioStreamOut::setFormat(audio_format_t format)
 int AudioStreamOut::resume()
 {
     ALOGV("AudioStreamOut: resume using %s writer",
-          mUsedForVoiceCall ? "null" : "regular");
+          mDirect ? "no" : mUsedForVoiceCall ? "null" : "regular");
+
+    /* Direct streams own their port, it's only attached to the mixer while active */
+    if (mDirect) {
+        int ret = mPort->open(mParams);
+        if (ret) {
+            ALOGE("AudioStreamOut: failed to open direct port %d", ret);
+            return ret;
+        }
+
+        resetPosition(mPort);
+        mPort->addSlots(mSlotMask);
+        mSlotPort = mPort;
+        return 0;
+    }
 
     /*
      * Switching PCM writers is done under the assumption that the non-null
@@ -148,6 +225,10 @@ int AudioStreamOut::resume()
     else
         writer = mWriter;
 
+    /* Nobody reads from the ring yet, stale data from before standby is dropped */
+    if (mRing)
+        mRing->flush();
+
     int ret = writer->registerStream(mStream);
     if (ret) {
         ALOGE("AudioStreamOut: failed to register stream %d", ret);
@@ -158,9 +239,33 @@ int AudioStreamOut::resume()
     if (ret) {
         ALOGE("AudioStreamOut: failed to start stream %d", ret);
         writer->unregisterStream(mStream);
+        return ret;
     }
 
-    return ret;
+    /* Mixer's headroom accounts for the slots of the streams actually playing */
+    if (!mUsedForVoiceCall) {
+        mPort->addSlots(mSlotMask);
+        mSlotPort = mPort;
+    }
+
+    /* A zone of a broadcast that fails to start is skipped, not fatal */
+    for (BroadcastVect::iterator i = mBroadcasts.begin(); i != mBroadcasts.end(); ++i) {
+        if (mUsedForVoiceCall)
+            break;
+        if (i->writer->registerStream(i->stream)) {
+            ALOGE("AudioStreamOut: failed to register broadcast stream");
+            continue;
+        }
+        if (i->stream->start()) {
+            ALOGE("AudioStreamOut: failed to start broadcast stream");
+            i->writer->unregisterStream(i->stream);
+        }
+    }
+
+    /* Position is anchored on the port by the first write(), see anchorPosition() */
+    resetPosition(mPort);
+
+    return 0;
 }
 
 /* must be called with mLock */
@@ -169,6 +274,20 @@ void AudioStreamOut::idle()
     ALOGV("AudioStreamOut: idle using %s writer",
           mUsedForVoiceCall ? "null" : "regular");
 
+    if (mSlotPort) {
+        mSlotPort->removeSlots(mSlotMask);
+        mSlotPort = NULL;
+    }
+
+    if (mDirect) {
+        mPort->close();
+        mFramesBase = mFramesWritten;
+        return;
+    }
+
+    if (mFadeStream != NULL)
+        releaseFade();
+
     PcmWriter *writer;
     if (mUsedForVoiceCall)
         writer = &mNullWriter;
@@ -177,27 +296,74 @@ void AudioStreamOut::idle()
 
     mStream->stop();
     writer->unregisterStream(mStream);
+    mIdles++;
+
+    for (BroadcastVect::iterator i = mBroadcasts.begin(); i != mBroadcasts.end(); ++i) {
+        if (i->writer->isStreamRegistered(i->stream)) {
+            i->stream->stop();
+            i->writer->unregisterStream(i->stream);
+        }
+    }
+
+    /* Frames still queued are discarded, consider them as presented */
+    mFramesBase = mFramesWritten;
 }
 
+/*
+ * Standby requested by the framework. The stream is left registered and
+ * running on silence for the standby delay, and only goes idle if no
+ * write() comes in the meantime. Short sounds played back to back don't
+ * pay for an idle/resume cycle and don't power cycle the codec.
+ */
 int AudioStreamOut::standby()
 {
     ALOGV("AudioStreamOut: standby()");
 
-    AutoMutex lock(mLock);
+    uint32_t delayMs = mHwDev->mStandbyDelayMs;
+
+    if (!delayMs) {
+        enterStandby();
+        return 0;
+    }
+
+    bool armed = false;
+    {
+        TimedAutoMutex lock(mLock, mLockStats);
+        if (!mStandby && !mIdlePending) {
+            mIdlePending = true;
+            mIdleDeadline = systemTime() + milliseconds(delayMs);
+            mStandbyRequests++;
+            armed = true;
+        }
+    }
+
+    /* Not under mLock, the event thread takes it with its own lock held */
+    if (armed)
+        mHwDev->mEventThread->wake();
+
+    return 0;
+}
+
+/* Immediate standby, e.g. for routing changes or when the stream is closed */
+void AudioStreamOut::enterStandby()
+{
+    ALOGV("AudioStreamOut: enterStandby()");
+
+    TimedAutoMutex lock(mLock, mLockStats);
+
+    mIdlePending = false;
 
     if (!mStandby) {
         idle();
         mStandby = true;
     }
-
-    return 0;
 }
 
 void AudioStreamOut::setVoiceCall(bool on)
 {
     ALOGV("AudioStreamOut: setVoiceCall() %s", on ? "enter" : "leave");
 
-    AutoMutex lock(mLock);
+    TimedAutoMutex lock(mLock, mLockStats);
 
     /*
      * Voice call reuses one of the PCM writers that is otherwise used
@@ -221,6 +387,40 @@ void AudioStreamOut::setVoiceCall(bool on)
 int AudioStreamOut::dump(int fd) const
 {
     ALOGV("AudioStreamOut: dump()");
+
+    String8 result;
+
+    mLock.lock();
+    result.appendFormat("  Output stream %p: devices 0x%08x %s %s\n", this, mDevices,
+                        mStandby ? "standby" : "active",
+                        mDirect ? "direct mode" : mRing ? "ring mode" : "blocking mode");
+    result.appendFormat("    %u Hz %u channels format 0x%x, %llu frames written\n",
+                        mParams.sampleRate, mParams.channels, mFormat, mFramesWritten);
+    if (!mBroadcasts.empty())
+        result.appendFormat("    broadcast to %u more port(s)\n", mBroadcasts.size());
+    if (mClientChannels != mParams.channels)
+        result.appendFormat("    downmix from %u channels\n", mClientChannels);
+    mLock.unlock();
+
+    if (mRing) {
+        result.appendFormat("    ring %u frames, %u queued, %u underruns\n",
+                            mRing->getSize(), mRing->availableToRead(),
+                            mRing->getUnderruns());
+    }
+
+    mLockStats.dump(result);
+    mWriteStats.dump(result);
+    mWriteRate.dump(result);
+    mSwitchStats.dump(result);
+
+    mLock.lock();
+    result.appendFormat("    standby: delay %u ms, %u requests, %u idles, %u resumes avoided%s\n",
+                        mHwDev->mStandbyDelayMs, mStandbyRequests, mIdles,
+                        mAvoidedResumes, mIdlePending ? ", idle pending" : "");
+    mLock.unlock();
+
+    ::write(fd, result.string(), result.size());
+
     return 0;
 }
 
@@ -241,10 +441,14 @@ int AudioStreamOut::setParameters(const char *kv_pairs)
     int device;
 
     if ((ret = parms.getInt(key, device)) == NO_ERROR) {
+        bool supported = !(device & ~(mHwDev->getSupportedDevices()));
         if ((mDevices & AUDIO_DEVICE_OUT_ALL) != (unsigned int)device) {
-            standby();
+            /* Moved while running if possible, through standby otherwise */
+            if (supported && !mHwDev->rerouteOutputStream(this, device))
+                return ret;
+            enterStandby();
         }
-        if (device & ~(mHwDev->getSupportedDevices())) {
+        if (!supported) {
             ALOGW("AudioStreamOut: setParameters() device(s) not supported, "
                   "will use default devices");
         }
@@ -275,7 +479,13 @@ int AudioStreamOut::removeAudioEffect(effect_handle_t effect) const
 
 uint32_t AudioStreamOut::getLatency() const
 {
-    uint32_t latency = (1000 * getBufferSize()) / mWriter->getParams().sampleRate;
+    uint32_t rate;
+    {
+        TimedAutoMutex lock(mLock, mLockStats);
+        rate = mWriter->getParams().sampleRate;
+    }
+
+    uint32_t latency = (1000 * getBufferSize()) / rate;
 
     ALOGVV("AudioStreamOut: getLatency() %u ms", latency);
 
@@ -285,207 +495,889 @@ uint32_t AudioStreamOut::getLatency() const
 int AudioStreamOut::setVolume(float left, float right)
 {
     ALOGV("AudioStreamOut: setVolume() left=%.4f right=%.4f", left, right);
-    return -ENOSYS;
-}
 
-ssize_t AudioStreamOut::write(const void* buffer, size_t bytes)
-{
-    uint32_t frames = mParams.bytesToFrames(bytes);
-    int ret = 0;
-    uint32_t usecs = (frames * 1000000) / mParams.sampleRate;
+    /* Applied by the next write() as a ramp from the current gain */
+    mVolume.setTarget(left, right);
 
-    ALOGVV("AudioStreamOut: write %u frames (%u bytes) buffer %p",
-           frames, bytes, buffer);
+    return 0;
+}
 
-    AutoMutex lock(mLock);
+/* Stream volume, bypassed at unity gain. Only used by the writing thread */
+const void *AudioStreamOut::applyVolume(const void *buffer, uint32_t frames)
+{
+    if (mVolume.isUnity())
+        return buffer;
 
-    if (mStandby) {
-        ret = resume();
-        if (ret) {
-            ALOGE("AudioStreamOut: failed to resume stream %d", ret);
-            usleep(usecs); /* limits the rate of error messages */
-            return ret;
-        }
-        mStandby = false;
-    }
+    uint32_t samples = frames * mParams.channels;
+    if (mVolumeBuffer.size() < samples)
+        mVolumeBuffer.resize(samples);
 
-    ret = mStream->write(buffer, frames);
-    if (ret < 0) {
-        ALOGE("AudioStreamOut: failed to write data %d", ret);
-        usleep(usecs);
-    } else {
-        ALOGW_IF(ret != (int)frames,
-                 "AudioStreamOut: wrote only %d out of %d requested frames",
-                 ret, frames);
-        bytes = mParams.framesToBytes(ret);
-    }
+    mVolume.process((const int16_t *)buffer, &mVolumeBuffer[0],
+                    frames, mParams.channels);
 
-    return bytes;
+    return &mVolumeBuffer[0];
 }
 
-int AudioStreamOut::getRenderPosition(uint32_t *dsp_frames) const
+/*
+ * Downmix of 5.1 and 7.1 streams to a stereo zone, 'matrix' is the 2 x
+ * 'channels' matrix, left row then right row. The stream itself stays
+ * stereo, only the client's frame size and channel mask change. Must be
+ * called before the first write.
+ */
+int AudioStreamOut::setDownmix(uint32_t channels, const vector<float> &matrix)
 {
-    ALOGV("AudioStreamOut: getRenderPosition()");
-
-    return -EINVAL;
-}
+    ALOGV("AudioStreamOut: setDownmix() %u channels", channels);
 
-int AudioStreamOut::getNextWriteTimestamp(int64_t *timestamp) const
-{
-    ALOGVV("AudioStreamOut: getNextWriteTimestamp()");
+    if ((mParams.channels != 2) || (channels > AudioHwDevice::kDownmixMaxChannels) ||
+        (matrix.size() != 2 * channels)) {
+        ALOGE("AudioStreamOut: invalid downmix from %u channels", channels);
+        return -EINVAL;
+    }
 
-    return -EINVAL;
-}
+    /* Rows padded to 8 coefficients, as the 16-bit and float kernels expect */
+    mDownmix.assign(2 * AudioHwDevice::kDownmixMaxChannels, 0.0f);
+    mDownmixQ14.assign(2 * AudioHwDevice::kDownmixMaxChannels, 0);
+    for (uint32_t row = 0; row < 2; row++) {
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            uint32_t i = row * AudioHwDevice::kDownmixMaxChannels + ch;
+            mDownmix[i] = matrix[row * channels + ch];
+            mDownmixQ14[i] = (int16_t)lrintf(mDownmix[i] * (1 << 14));
+        }
+    }
 
-/* ---------------------------------------------------------------------------------------- */
+    mClientChannels = channels;
+    mFrameSize = audio_bytes_per_sample(mFormat) * channels;
 
-AudioStreamIn::AudioStreamIn(AudioHwDevice *hwDev,
-                             PcmReader *reader,
-                             const PcmParams &params,
-                             const SlotMap &map,
-                             audio_devices_t devices)
-    : mHwDev(hwDev), mReader(reader), mParams(params), mDevices(devices),
-      mSource(AUDIO_SOURCE_DEFAULT), mStandby(true)
-{
-    if (mReader)
-        mStream = new AdaptedInStream(params, map);
+    return 0;
 }
 
-int AudioStreamIn::initCheck() const
-{
-    int ret = 0;
-
-    if (!mHwDev) {
-        ALOGE("AudioStreamIn: initCheck() invalid AudioHwDevice");
-        ret = -ENODEV;
+/*
+ * Float and 8.24 data is processed in 32 bits and rounded to the 16 bits
+ * of the PCM writer as the last step, the only place where it can clip.
+ * 16-bit data only goes through the volume. Multichannel streams are
+ * downmixed in the same pass as the conversion to 32 bits, so the rest of
+ * the chain only sees stereo. Only used by the writing thread.
+ */
+const void *AudioStreamOut::convert(const void *buffer, uint32_t frames)
+{
+    bool downmix = (mClientChannels != mParams.channels);
+    uint32_t samples = frames * mParams.channels;
+
+    if (mFormat == AUDIO_FORMAT_PCM_16_BIT) {
+        if (downmix) {
+            if (mDownmixBuffer.size() < samples)
+                mDownmixBuffer.resize(samples);
+            downmixQ15((const int16_t *)buffer, &mDownmixBuffer[0], frames,
+                       mClientChannels, &mDownmixQ14[0]);
+            buffer = &mDownmixBuffer[0];
+        }
+        return applyVolume(buffer, frames);
     }
-    else if (!mReader || !mReader->initCheck()) {
-        ALOGE("AudioStreamIn: initCheck() invalid PCM reader");
-        ret = -ENODEV;
+
+    if (mWideBuffer.size() < samples)
+        mWideBuffer.resize(samples);
+    if (mVolumeBuffer.size() < samples)
+        mVolumeBuffer.resize(samples);
+
+    const int32_t *wide;
+    if ((mFormat == AUDIO_FORMAT_PCM_FLOAT) && downmix) {
+        downmixFloatToQ23((const float *)buffer, &mWideBuffer[0], frames,
+                          mClientChannels, &mDownmix[0]);
+        wide = &mWideBuffer[0];
+    } else if (mFormat == AUDIO_FORMAT_PCM_FLOAT) {
+        floatToQ23((const float *)buffer, &mWideBuffer[0], samples);
+        wide = &mWideBuffer[0];
+    } else if (downmix) {
+        downmixQ23((const int32_t *)buffer, &mWideBuffer[0], frames,
+                   mClientChannels, &mDownmix[0]);
+        wide = &mWideBuffer[0];
+    } else {
+        wide = (const int32_t *)buffer;
     }
-    else if (mStream == NULL || !mStream->initCheck()) {
-        ALOGE("AudioStreamIn: initCheck() invalid In Stream");
-        ret = -ENODEV;
+
+    if (!mVolume.isUnity()) {
+        mVolume.process(wide, &mWideBuffer[0], frames, mParams.channels);
+        wide = &mWideBuffer[0];
     }
 
-    ALOGV("AudioStreamIn: init check %d", ret);
+    narrowQ23(wide, &mVolumeBuffer[0], samples);
 
-    return ret;
+    return &mVolumeBuffer[0];
 }
 
-uint32_t AudioStreamIn::getSampleRate() const
+/*
+ * Re-target the stream to another PCM writer and/or slot map while it
+ * keeps running, e.g. from a rear seat zone to the cabin. The new stream
+ * is registered before the old one is released and the same frames are
+ * written to both with an equal-power crossfade, until the old one is
+ * faded out. The client's stream is never closed nor put in standby, and
+ * an idle stream from the pool (same configuration) avoids allocating the
+ * new resampler. Ring mode streams have a single ring to read from, they
+ * switch over at the writer's next period instead.
+ *
+ * called with the AudioHwDevice lock
+ */
+int AudioStreamOut::reroute(AudioOutPort *port, PcmWriter *writer, const SlotMap &map,
+                            uint32_t slotMask, audio_devices_t devices,
+                            const sp<OutStream> &pooled, uint32_t poolSlots)
 {
-    ALOGV("AudioStreamIn: getSampleRate()");
+    ALOGV("AudioStreamOut: reroute to %s devices 0x%08x", port->getName(), devices);
 
-    uint32_t rate = mParams.sampleRate;
+    nsecs_t start = systemTime();
 
-    return rate;
-}
+    TimedAutoMutex lock(mLock, mLockStats);
 
-int AudioStreamIn::setSampleRate(uint32_t rate)
-{
-    ALOGV("AudioStreamIn: setSampleRate() %u Hz", rate);
+    int ret = getRerouteError();
+    if (ret)
+        return ret;
 
-    return 0;
-}
+    sp<OutStream> stream;
+    if (mRing)
+        stream = new OutStream(mParams, map, mRing);
+    else if (pooled != NULL)
+        stream = pooled;
+    else
+        stream = new AdaptedOutStream(mParams, map);
+    if ((stream == NULL) || !stream->initCheck()) {
+        ALOGE("AudioStreamOut: failed to create rerouted stream");
+        return -ENOMEM;
+    }
 
-size_t AudioStreamIn::getBufferSize() const
-{
-    size_t size;
+    if (!mStandby) {
+        if (mRing) {
+            mStream->stop();
+            mWriter->unregisterStream(mStream);
+        }
 
-    /* Take resampling ratio into account */
-    size = (mParams.frameCount * mParams.sampleRate) / mReader->getParams().sampleRate;
-    size = size * mParams.frameSize();
+        ret = writer->registerStream(stream);
+        if (!ret) {
+            ret = stream->start();
+            if (ret)
+                writer->unregisterStream(stream);
+        }
+        if (ret) {
+            ALOGE("AudioStreamOut: failed to start rerouted stream %d", ret);
+            if (mRing && !mWriter->registerStream(mStream))
+                mStream->start();
+            return ret;
+        }
 
-    ALOGVV("AudioStreamIn: getBufferSize() %u bytes", size);
+        if (!mRing) {
+            mFadeStream = mStream;
+            mFadeWriter = mWriter;
+            mCrossfade.start();
+        }
 
-    return size;
-}
+        /* Position is counted on the new port from now on */
+        resetPosition(port);
 
-audio_channel_mask_t AudioStreamIn::getChannels() const
-{
-    ALOGV("AudioStreamIn: getChannels()");
+        if (mSlotPort)
+            mSlotPort->removeSlots(mSlotMask);
+        port->addSlots(slotMask);
+        mSlotPort = port;
+    }
 
-    return audio_channel_in_mask_from_count(mParams.channels);
-}
+    mStream = stream;
+    mWriter = writer;
+    mPort = port;
+    mSlotMask = slotMask;
+    mDevices = devices;
+    mPoolSlots = mRing ? 0 : poolSlots;
 
-audio_format_t AudioStreamIn::getFormat() const
-{
-    ALOGV("AudioStreamIn: getFormat()");
+    mSwitchStats.record(systemTime() - start);
 
-    return AUDIO_FORMAT_PCM_16_BIT;
+    return 0;
 }
 
-int AudioStreamIn::setFormat(audio_format_t format)
+/* must be called with mLock */
+int AudioStreamOut::getRerouteError() const
 {
-    ALOGV("AudioStreamIn: setFormat()");
+    /* Direct ports can't remap slots, the voice call holds the writer */
+    if (mDirect || mUsedForVoiceCall || !mBroadcasts.empty())
+        return -ENOSYS;
+
+    /* Previous switch is still fading */
+    if (mFadeStream != NULL)
+        return -EBUSY;
 
     return 0;
 }
 
-/* must be called with mLock */
-int AudioStreamIn::resume()
-{
-    int ret = mReader->registerStream(mStream);
-    if (ret) {
-        ALOGE("AudioStreamIn: failed to register Dest %d", ret);
-        return ret;
+/*
+ * Extra route of a broadcast stream on another port, fed with the same
+ * data as the stream. Must be added before the stream is first written.
+ */
+int AudioStreamOut::addBroadcast(PcmWriter *writer, const SlotMap &map)
+{
+    Broadcast broadcast;
+    broadcast.writer = writer;
+    broadcast.stream = new AdaptedOutStream(mParams, map);
+    if ((broadcast.stream == NULL) || !broadcast.stream->initCheck()) {
+        ALOGE("AudioStreamOut: failed to create broadcast stream");
+        return -ENOMEM;
     }
 
-    ret = mStream->start();
-    if (ret) {
-        ALOGE("AudioStreamIn: failed to start stream %d", ret);
-        mReader->unregisterStream(mStream);
-    }
+    TimedAutoMutex lock(mLock, mLockStats);
+    mBroadcasts.push_back(broadcast);
 
-    return ret;
+    return 0;
 }
 
 /* must be called with mLock */
-void AudioStreamIn::idle()
+void AudioStreamOut::writeBroadcast(const void *buffer, uint32_t frames)
 {
-    mStream->stop();
-    mReader->unregisterStream(mStream);
+    for (BroadcastVect::iterator i = mBroadcasts.begin(); i != mBroadcasts.end(); ++i) {
+        if (!i->writer->isStreamRegistered(i->stream))
+            continue;
+        int ret = i->stream->write(buffer, frames);
+        ALOGW_IF(ret < 0, "AudioStreamOut: failed to write broadcast data %d", ret);
+    }
 }
 
-int AudioStreamIn::standby()
+/* must be called with mLock */
+void AudioStreamOut::releaseFade()
 {
-    ALOGV("AudioStreamIn: standby()");
+    mFadeStream->stop();
+    mFadeWriter->unregisterStream(mFadeStream);
+    mFadeStream.clear();
+    mFadeWriter = NULL;
+}
 
-    AutoMutex lock(mLock);
+/*
+ * Write to the old and the new route of a route switch, fading the old
+ * one out and the new one in. Both get the same frames, so the fade is
+ * sample-accurate with respect to the stream. The old stream is released
+ * once silent.
+ *
+ * must be called with mLock
+ */
+int AudioStreamOut::crossfade(const void *buffer, uint32_t frames)
+{
+    uint32_t samples = frames * mParams.channels;
 
-    if (!mStandby) {
-        idle();
-        mStandby = true;
-    }
+    if (mFadeBuffer.size() < 2 * samples)
+        mFadeBuffer.resize(2 * samples);
 
-    return 0;
-}
+    int16_t *fadeOut = &mFadeBuffer[0];
+    int16_t *fadeIn = &mFadeBuffer[samples];
+    mCrossfade.process((const int16_t *)buffer, fadeOut, fadeIn, frames, mParams.channels);
 
-int AudioStreamIn::dump(int fd) const
-{
-    ALOGV("AudioStreamIn: dump()");
+    int ret = mFadeStream->write(fadeOut, frames);
+    ALOGW_IF(ret < 0, "AudioStreamOut: failed to write to the old route %d", ret);
 
-    return 0;
-}
+    ret = mStream->write(fadeIn, frames);
 
-audio_devices_t AudioStreamIn::getDevice() const
-{
-    ALOGV("AudioStreamIn: getDevice()");
+    if (mCrossfade.isDone())
+        releaseFade();
 
-    return mDevices;
+    return ret;
 }
 
-int AudioStreamIn::setParameters(const char *kv_pairs)
+/*
+ * Copy into the ring without holding the stream lock. If the ring is full,
+ * sleep for the time it takes the PcmWriter to free the missing space,
+ * but stop waiting if the stream went into standby meanwhile as there
+ * would be no one left to drain the ring.
+ */
+int AudioStreamOut::writeRing(const void *buffer, uint32_t frames)
 {
-    ALOGV("AudioStreamIn: setParameters() '%s'", kv_pairs ? kv_pairs : "");
+    const uint8_t *data = (const uint8_t *)buffer;
+    uint32_t remaining = frames;
 
-    int ret;
+    while (remaining) {
+        uint32_t written = mRing->write(data, remaining);
+        data += mParams.framesToBytes(written);
+        remaining -= written;
 
-    AudioParameter parms = AudioParameter(String8(kv_pairs));
-    String8 source_key = String8(AudioParameter::keyInputSource);
-    String8 device_key = String8(AudioParameter::keyRouting);
-    int source, device;
+        if (!remaining)
+            break;
+
+        {
+            TimedAutoMutex lock(mLock, mLockStats);
+            if (mStandby) {
+                ALOGV("AudioStreamOut: standby while writing, drop %u frames", remaining);
+                break;
+            }
+        }
+
+        uint32_t wait = (remaining < mParams.frameCount) ? remaining : mParams.frameCount;
+        usleep((wait * 1000000ULL) / mParams.sampleRate);
+    }
+
+    return frames;
+}
+
+ssize_t AudioStreamOut::write(const void* buffer, size_t bytes)
+{
+    uint32_t frames = bytes / mFrameSize;
+    int ret = 0;
+    uint32_t usecs = ((uint64_t)frames * 1000000) / mParams.sampleRate;
+    nsecs_t start = systemTime();
+
+    ALOGVV("AudioStreamOut: write %u frames (%u bytes) buffer %p",
+           frames, bytes, buffer);
+
+    mLock.lock();
+    nsecs_t locked = systemTime();
+
+    /* Data arrived within the standby delay, the stream stays active */
+    if (mIdlePending) {
+        mIdlePending = false;
+        mAvoidedResumes++;
+    }
+
+    if (mStandby) {
+        ret = resume();
+        if (ret) {
+            mLockStats.record(systemTime() - locked);
+            mLock.unlock();
+            ALOGE("AudioStreamOut: failed to resume stream %d", ret);
+            usleep(usecs); /* limits the rate of error messages */
+            return ret;
+        }
+        mStandby = false;
+    }
+
+    if (!mUsedForVoiceCall)
+        anchorPosition();
+
+    if (mRing) {
+        /* Only the ring copy is done outside of the lock */
+        mLockStats.record(systemTime() - locked);
+        mLock.unlock();
+
+        /*
+         * Non-blocking streams take only what fits in the ring, the client
+         * is notified from the event thread once there is room again
+         */
+        if (mNonBlocking) {
+            uint32_t avail = mRing->availableToWrite();
+            if (avail < frames) {
+                frames = avail;
+                android_atomic_release_store(1, &mWriteReadyPending);
+                mHwDev->mEventThread->wake();
+            }
+        }
+
+        ret = writeRing(convert(buffer, frames), frames);
+
+        mLock.lock();
+        locked = systemTime();
+    } else if (mFadeStream != NULL) {
+        ret = crossfade(convert(buffer, frames), frames);
+    } else if (mDirect) {
+        /* No adaptation, straight to the device or the port's ring, see openOutputStream() */
+        ret = mPort->write(convert(buffer, frames), frames);
+    } else {
+        const void *data = convert(buffer, frames);
+        ret = mStream->write(data, frames);
+        if (ret > 0)
+            writeBroadcast(data, ret);
+    }
+
+    if (ret >= 0)
+        mFramesWritten += ret;
+
+    mLockStats.record(systemTime() - locked);
+    mLock.unlock();
+
+    if (ret < 0) {
+        ALOGE("AudioStreamOut: failed to write data %d", ret);
+        usleep(usecs);
+    } else {
+        ALOGW_IF(ret != (int)frames,
+                 "AudioStreamOut: wrote only %d out of %d requested frames",
+                 ret, frames);
+        bytes = ret * mFrameSize;
+    }
+
+    mWriteStats.record(systemTime() - start);
+    mWriteRate.event();
+
+    if (mFirstWrite) {
+        mFirstWrite = false;
+        LatencyStats &stats = mPooled ? mHwDev->mFirstWritePooledStats :
+                                        mHwDev->mFirstWriteStats;
+        stats.record(systemTime() - mOpenTime);
+    }
+
+    return bytes;
+}
+
+/* must be called with mLock */
+void AudioStreamOut::resetPosition(AudioOutPort *port)
+{
+    mFramesBase = mFramesWritten;
+    mPortFramesBase = port->getFramesWritten();
+    mPrevFramesBase = mFramesBase;
+    mPrevPortFramesBase = mPortFramesBase;
+}
+
+/*
+ * The port is written whether this stream has data or not: the PCM writer
+ * primes it after the registration, fills in silence when the stream runs
+ * dry and keeps going for the other streams of the writer. Once the writer
+ * has consumed all the frames written so far, the next ones go into its
+ * next port write, so the position is anchored on that port frame rather
+ * than on the port frames that carried no data of this stream.
+ *
+ * must be called with mLock
+ */
+void AudioStreamOut::anchorPosition()
+{
+    uint64_t portFrames = mPort->getFramesWritten();
+    uint64_t consumed = getStreamFrames(portFrames, mPortFramesBase);
+
+    if (consumed < mFramesWritten - mFramesBase)
+        return;
+
+    mPrevFramesBase = mFramesBase;
+    mPrevPortFramesBase = mPortFramesBase;
+    mFramesBase = mFramesWritten;
+    mPortFramesBase = portFrames;
+}
+
+/* Port frames since 'portBase', in frames of the stream */
+uint64_t AudioStreamOut::getStreamFrames(uint64_t portFrames, uint64_t portBase) const
+{
+    if (portFrames <= portBase)
+        return 0;
+
+    return ((portFrames - portBase) * mParams.sampleRate) / mWriter->getParams().sampleRate;
+}
+
+/* must be called with mLock */
+void AudioStreamOut::getPresentedFrames(uint64_t &frames, struct timespec &ts) const
+{
+    /*
+     * The null writer used during voice calls consumes the data in real
+     * time and nothing is queued after standby, so all frames written so
+     * far are considered presented
+     */
+    if (mStandby || mUsedForVoiceCall) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        frames = mFramesWritten;
+        return;
+    }
+
+    /*
+     * Frames presented by the port since the port frame that carries the
+     * first frame of the current burst, scaled by the ratio of the stream's
+     * resampler. That accounts for the data queued in the stream, the PCM
+     * writer and the ALSA kernel buffer. Until the port gets there, the
+     * tail of the previous burst is still being presented.
+     */
+    uint64_t portFrames;
+    mPort->getPresentedFrames(portFrames, ts);
+
+    if (portFrames < mPortFramesBase) {
+        uint64_t played = getStreamFrames(portFrames, mPrevPortFramesBase);
+        uint64_t pending = mFramesBase - mPrevFramesBase;
+        frames = mPrevFramesBase + ((played < pending) ? played : pending);
+        return;
+    }
+
+    uint64_t played = getStreamFrames(portFrames, mPortFramesBase);
+    uint64_t pending = mFramesWritten - mFramesBase;
+    frames = mFramesBase + ((played < pending) ? played : pending);
+}
+
+int AudioStreamOut::getRenderPosition(uint32_t *dsp_frames) const
+{
+    uint64_t frames;
+    struct timespec ts;
+
+    TimedAutoMutex lock(mLock, mLockStats);
+
+    getPresentedFrames(frames, ts);
+    *dsp_frames = (uint32_t)frames;
+
+    ALOGVV("AudioStreamOut: getRenderPosition() %u frames", *dsp_frames);
+
+    return 0;
+}
+
+int AudioStreamOut::getNextWriteTimestamp(int64_t *timestamp) const
+{
+    uint64_t frames;
+    struct timespec ts;
+
+    TimedAutoMutex lock(mLock, mLockStats);
+
+    if (mStandby) {
+        ALOGVV("AudioStreamOut: getNextWriteTimestamp() stream is in standby");
+        return -EINVAL;
+    }
+
+    /* Next write is presented once all pending frames are played out */
+    getPresentedFrames(frames, ts);
+    uint64_t pending = mFramesWritten - frames;
+
+    *timestamp = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 +
+                 (pending * 1000000) / mParams.sampleRate;
+
+    ALOGVV("AudioStreamOut: getNextWriteTimestamp() %lld usecs", *timestamp);
+
+    return 0;
+}
+
+int AudioStreamOut::getPresentationPosition(uint64_t *frames,
+                                            struct timespec *timestamp) const
+{
+    TimedAutoMutex lock(mLock, mLockStats);
+
+    getPresentedFrames(*frames, *timestamp);
+
+    ALOGVV("AudioStreamOut: getPresentationPosition() %llu frames", *frames);
+
+    return 0;
+}
+
+int AudioStreamOut::setCallback(stream_callback_t callback, void *cookie)
+{
+    ALOGV("AudioStreamOut: setCallback() callback %p cookie %p", callback, cookie);
+
+    if (!mNonBlocking) {
+        ALOGE("AudioStreamOut: setCallback() stream is not non-blocking");
+        return -ENOSYS;
+    }
+
+    TimedAutoMutex lock(mLock, mLockStats);
+
+    mCallback = callback;
+    mCookie = cookie;
+
+    return 0;
+}
+
+int AudioStreamOut::drain(audio_drain_type_t type)
+{
+    ALOGV("AudioStreamOut: drain() %s",
+          (type == AUDIO_DRAIN_EARLY_NOTIFY) ? "early notify" : "all");
+
+    if (!mCallback) {
+        ALOGE("AudioStreamOut: drain() no callback registered");
+        return -ENOSYS;
+    }
+
+    /* Early notify is not worth it with PCM, notify once all is played */
+    android_atomic_release_store(1, &mDrainPending);
+    mHwDev->mEventThread->wake();
+
+    return 0;
+}
+
+/*
+ * Deliver the pending events whose condition is met. Called from the
+ * event thread, returns true if there are events still pending.
+ */
+bool AudioStreamOut::processEvents()
+{
+    bool pending = false;
+
+    mLock.lock();
+    if (mIdlePending) {
+        if (systemTime() >= mIdleDeadline) {
+            ALOGV("AudioStreamOut: standby delay expired, going idle");
+            mIdlePending = false;
+            if (!mStandby) {
+                idle();
+                mStandby = true;
+            }
+        } else {
+            pending = true;
+        }
+    }
+    mLock.unlock();
+
+    if (!mCallback)
+        return pending;
+
+    if (android_atomic_acquire_load(&mWriteReadyPending)) {
+        /* Wait for room for a sizeable write, not just a few frames */
+        if (mRing->availableToWrite() >= mRing->getSize() / 2) {
+            android_atomic_release_store(0, &mWriteReadyPending);
+            ALOGVV("AudioStreamOut: write ready");
+            mCallback(STREAM_CBK_EVENT_WRITE_READY, NULL, mCookie);
+        } else {
+            pending = true;
+        }
+    }
+
+    if (android_atomic_acquire_load(&mDrainPending)) {
+        bool drained;
+
+        mLock.lock();
+        if (mStandby) {
+            drained = true;
+        } else {
+            uint64_t frames;
+            struct timespec ts;
+            getPresentedFrames(frames, ts);
+            drained = (frames >= mFramesWritten);
+        }
+        mLock.unlock();
+
+        if (drained) {
+            android_atomic_release_store(0, &mDrainPending);
+            ALOGV("AudioStreamOut: drain ready");
+            mCallback(STREAM_CBK_EVENT_DRAIN_READY, NULL, mCookie);
+        } else {
+            pending = true;
+        }
+    }
+
+    return pending;
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+AudioEventThread::AudioEventThread()
+    : Thread(false), mWoken(false), mDelivering(false)
+{
+}
+
+void AudioEventThread::addStream(AudioStreamOut *out)
+{
+    AutoMutex lock(mLock);
+    mStreams.push_back(out);
+}
+
+void AudioEventThread::removeStream(AudioStreamOut *out)
+{
+    AutoMutex lock(mLock);
+
+    for (vector<AudioStreamOut*>::iterator i = mStreams.begin(); i != mStreams.end(); ++i) {
+        if (*i == out) {
+            mStreams.erase(i);
+            break;
+        }
+    }
+
+    /* Stream may be in the delivery in progress, no callback after this point */
+    while (mDelivering)
+        mDoneCond.wait(mLock);
+}
+
+void AudioEventThread::wake()
+{
+    AutoMutex lock(mLock);
+    mWoken = true;
+    mCond.signal();
+}
+
+void AudioEventThread::stop()
+{
+    requestExit();
+    wake();
+    requestExitAndWait();
+}
+
+/*
+ * The callbacks run without the lock held: a client closing its stream
+ * from another thread while the callback waits on that thread would
+ * deadlock otherwise. The streams are referenced for the duration of the
+ * delivery, and removeStream() waits for it to complete.
+ */
+bool AudioEventThread::threadLoop()
+{
+    mLock.lock();
+
+    if (exitPending()) {
+        mLock.unlock();
+        return false;
+    }
+
+    vector<sp<AudioStreamOut> > streams(mStreams.begin(), mStreams.end());
+    mWoken = false;
+    mDelivering = true;
+    mLock.unlock();
+
+    bool pending = false;
+    for (vector<sp<AudioStreamOut> >::iterator i = streams.begin(); i != streams.end(); ++i) {
+        if ((*i)->processEvents())
+            pending = true;
+    }
+    streams.clear();
+
+    mLock.lock();
+    mDelivering = false;
+    mDoneCond.broadcast();
+
+    /*
+     * Poll while there are events pending, otherwise wait to be armed.
+     * Streams armed during the delivery are polled again right away.
+     */
+    if (!mWoken) {
+        if (pending)
+            mCond.waitRelative(mLock, milliseconds(kPollMs));
+        else
+            mCond.wait(mLock);
+    }
+    mLock.unlock();
+
+    return true;
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+AudioStreamIn::AudioStreamIn(AudioHwDevice *hwDev,
+                             PcmReader *reader,
+                             const PcmParams &params,
+                             const SlotMap &map,
+                             audio_devices_t devices,
+                             const sp<InStream> &pooled)
+    : mHwDev(hwDev), mReader(reader), mParams(params), mDevices(devices),
+      mSource(AUDIO_SOURCE_DEFAULT), mStandby(true), mPoolSlots(0),
+      mPooled(pooled != NULL), mOpenTime(systemTime()), mFirstRead(true)
+{
+    if (!mReader)
+        return;
+
+    if (pooled != NULL)
+        mStream = pooled;
+    else
+        mStream = new AdaptedInStream(params, map);
+}
+
+int AudioStreamIn::initCheck() const
+{
+    int ret = 0;
+
+    if (!mHwDev) {
+        ALOGE("AudioStreamIn: initCheck() invalid AudioHwDevice");
+        ret = -ENODEV;
+    }
+    else if (!mReader || !mReader->initCheck()) {
+        ALOGE("AudioStreamIn: initCheck() invalid PCM reader");
+        ret = -ENODEV;
+    }
+    else if (mStream == NULL || !mStream->initCheck()) {
+        ALOGE("AudioStreamIn: initCheck() invalid In Stream");
+        ret = -ENODEV;
+    }
+
+    ALOGV("AudioStreamIn: init check %d", ret);
+
+    return ret;
+}
+
+uint32_t AudioStreamIn::getSampleRate() const
+{
+    ALOGV("AudioStreamIn: getSampleRate()");
+
+    uint32_t rate = mParams.sampleRate;
+
+    return rate;
+}
+
+int AudioStreamIn::setSampleRate(uint32_t rate)
+{
+    ALOGV("AudioStreamIn: setSampleRate() %u Hz", rate);
+
+    return 0;
+}
+
+size_t AudioStreamIn::getBufferSize() const
+{
+    size_t size;
+
+    /* Reader is replaced when its port is reconfigured */
+    AutoMutex lock(mLock);
+
+    /* Take resampling ratio into account */
+    size = (mParams.frameCount * mParams.sampleRate) / mReader->getParams().sampleRate;
+    size = size * mParams.frameSize();
+
+    ALOGVV("AudioStreamIn: getBufferSize() %u bytes", size);
+
+    return size;
+}
+
+audio_channel_mask_t AudioStreamIn::getChannels() const
+{
+    ALOGV("AudioStreamIn: getChannels()");
+
+    return audio_channel_in_mask_from_count(mParams.channels);
+}
+
+audio_format_t AudioStreamIn::getFormat() const
+{
+    ALOGV("AudioStreamIn: getFormat()");
+
+    return AUDIO_FORMAT_PCM_16_BIT;
+}
+
+int AudioStreamIn::setFormat(audio_format_t format)
+{
+    ALOGV("AudioStreamIn: setFormat()");
+
+    return 0;
+}
+
+/* must be called with mLock */
+int AudioStreamIn::resume()
+{
+    int ret = mReader->registerStream(mStream);
+    if (ret) {
+        ALOGE("AudioStreamIn: failed to register Dest %d", ret);
+        return ret;
+    }
+
+    ret = mStream->start();
+    if (ret) {
+        ALOGE("AudioStreamIn: failed to start stream %d", ret);
+        mReader->unregisterStream(mStream);
+    }
+
+    return ret;
+}
+
+/* must be called with mLock */
+void AudioStreamIn::idle()
+{
+    mStream->stop();
+    mReader->unregisterStream(mStream);
+}
+
+int AudioStreamIn::standby()
+{
+    ALOGV("AudioStreamIn: standby()");
+
+    AutoMutex lock(mLock);
+
+    if (!mStandby) {
+        idle();
+        mStandby = true;
+    }
+
+    return 0;
+}
+
+int AudioStreamIn::dump(int fd) const
+{
+    ALOGV("AudioStreamIn: dump()");
+
+    return 0;
+}
+
+audio_devices_t AudioStreamIn::getDevice() const
+{
+    ALOGV("AudioStreamIn: getDevice()");
+
+    return mDevices;
+}
+
+int AudioStreamIn::setParameters(const char *kv_pairs)
+{
+    ALOGV("AudioStreamIn: setParameters() '%s'", kv_pairs ? kv_pairs : "");
+
+    int ret;
+
+    AudioParameter parms = AudioParameter(String8(kv_pairs));
+    String8 source_key = String8(AudioParameter::keyInputSource);
+    String8 device_key = String8(AudioParameter::keyRouting);
+    int source, device;
 
     if ((ret = parms.getInt(source_key, source)) == NO_ERROR) {
         /* no audio source uses 0 */
@@ -501,10 +1393,14 @@ int AudioStreamIn::setParameters(const char *kv_pairs)
     }
 
     if ((ret = parms.getInt(device_key, device)) == NO_ERROR) {
+        bool supported = !(device & ~(mHwDev->getSupportedDevices()));
         if ((mDevices & AUDIO_DEVICE_IN_ALL) != (unsigned int)device) {
+            /* Moved while running if possible, through standby otherwise */
+            if (supported && !mHwDev->rerouteInputStream(this, device))
+                return 0;
             standby();
         }
-        if (device & ~(mHwDev->getSupportedDevices())) {
+        if (!supported) {
             ALOGW("AudioStreamIn: setParameters() device(s) not supported, "
                   "will use default devices");
         }
@@ -546,11 +1442,61 @@ int AudioStreamIn::setGain(float gain)
     return 0;
 }
 
+/*
+ * Re-target the stream to other slots while the PCM reader keeps running.
+ * Capture streams just switch over at the reader's next period. An idle
+ * stream from the pool (same configuration) avoids allocating the new
+ * resampler, like for playback.
+ *
+ * called with the AudioHwDevice lock
+ */
+int AudioStreamIn::reroute(const SlotMap &map, audio_devices_t devices,
+                           const sp<InStream> &pooled, uint32_t poolSlots)
+{
+    ALOGV("AudioStreamIn: reroute to devices 0x%08x", devices);
+
+    AutoMutex lock(mLock);
+
+    sp<InStream> stream;
+    if (pooled != NULL)
+        stream = pooled;
+    else
+        stream = new AdaptedInStream(mParams, map);
+    if ((stream == NULL) || !stream->initCheck()) {
+        ALOGE("AudioStreamIn: failed to create rerouted stream");
+        return -ENOMEM;
+    }
+
+    if (!mStandby) {
+        mStream->stop();
+        mReader->unregisterStream(mStream);
+
+        int ret = mReader->registerStream(stream);
+        if (!ret) {
+            ret = stream->start();
+            if (ret)
+                mReader->unregisterStream(stream);
+        }
+        if (ret) {
+            ALOGE("AudioStreamIn: failed to start rerouted stream %d", ret);
+            if (!mReader->registerStream(mStream))
+                mStream->start();
+            return ret;
+        }
+    }
+
+    mStream = stream;
+    mDevices = devices;
+    mPoolSlots = poolSlots;
+
+    return 0;
+}
+
 ssize_t AudioStreamIn::read(void* buffer, size_t bytes)
 {
     uint32_t frames = mParams.bytesToFrames(bytes);
     int ret = 0;
-    uint32_t usecs = (frames * 1000000) / mParams.sampleRate;
+    uint32_t usecs = ((uint64_t)frames * 1000000) / mParams.sampleRate;
 
     ALOGVV("AudioStreamIn: read %u frames (%u bytes) buffer %p",
            frames, bytes, buffer);
@@ -581,6 +1527,13 @@ ssize_t AudioStreamIn::read(void* buffer, size_t bytes)
             memset(buffer, 0, bytes);
     }
 
+    if (mFirstRead) {
+        mFirstRead = false;
+        LatencyStats &stats = mPooled ? mHwDev->mFirstReadPooledStats :
+                                        mHwDev->mFirstReadStats;
+        stats.record(systemTime() - mOpenTime);
+    }
+
     return bytes;
 }
 
@@ -596,9 +1549,15 @@ uint32_t AudioStreamIn::getInputFramesLost()
 const char *AudioHwDevice::kCabinVolumeHP = "HP DAC Playback Volume";
 const char *AudioHwDevice::kCabinVolumeLine = "Line DAC Playback Volume";
 const char *AudioHwDevice::kBTMode = "Bluetooth Mode";
+const char *AudioHwDevice::kChimeDir = "/system/etc/chimes";
 
 AudioHwDevice::AudioHwDevice(uint32_t card)
-    : mCardId(card), mMixer(mCardId), mMicMute(false), mMode(AUDIO_MODE_NORMAL)
+    : mCardId(card), mMixer(mCardId), mMicMute(false), mMode(AUDIO_MODE_NORMAL),
+      mOutStreamPool(kStreamPoolSize), mInStreamPool(kStreamPoolSize),
+      mFirstWriteStats("open to first write"),
+      mFirstWritePooledStats("open to first write, pooled"),
+      mFirstReadStats("open to first read"),
+      mFirstReadPooledStats("open to first read, pooled")
 {
     /*
      * "multizone_audio.use_jamr" property is used to indicate if JAMR3
@@ -619,113 +1578,541 @@ AudioHwDevice::AudioHwDevice(uint32_t card)
         mMediaPortId = kCPUPortId;
     }
 
-    ALOGI("AudioHwDevice: create hw device for card hw:%u Jacinto6 EVM %s",
-          card, usesJAMR3() ? "+ JAMR3" : "");
+    getDefaultDownmix(6, mDownmix51);
+    getDefaultDownmix(8, mDownmix71);
+
+    /*
+     * "persist.audio.ring_write" property decouples the output streams'
+     * write() from the blocking PCM writes through a lock-free ring
+     */
+    mRingMode = (property_get("persist.audio.ring_write", value, NULL) > 0) &&
+                (!strcmp(value, "1") || !strcasecmp(value, "true"));
+
+    /*
+     * "persist.audio.standby_delay" property is the time in ms an output
+     * stream stays active after the framework puts it in standby, 0 for
+     * immediate standby
+     */
+    mStandbyDelayMs = kStandbyDelayMs;
+    if (property_get("persist.audio.standby_delay", value, NULL) > 0)
+        mStandbyDelayMs = strtoul(value, NULL, 0);
+
+    /*
+     * "persist.audio.stream_pool" property is the number of idle adapted
+     * streams kept per configuration, 0 disables the pools, e.g. to compare
+     * the open-to-first-write latency with multizone_openbench
+     */
+    if (property_get("persist.audio.stream_pool", value, NULL) > 0) {
+        uint32_t poolSize = strtoul(value, NULL, 0);
+        mOutStreamPool.setMaxPerKey(poolSize);
+        mInStreamPool.setMaxPerKey(poolSize);
+    }
+
+    /*
+     * "persist.audio.mmap" property is the mask of the output ports whose
+     * mix is done in place in the ALSA buffer, e.g. 0x3 for CPU and JAMR3.
+     * "persist.audio.host_pcm" replaces the playback devices with memory
+     * stand-ins, to benchmark the write and MMAP paths without hardware.
+     */
+    uint32_t mmapPorts = 0;
+    if (property_get("persist.audio.mmap", value, NULL) > 0)
+        mmapPorts = strtoul(value, NULL, 0);
+    bool hostPcm = (property_get("persist.audio.host_pcm", value, NULL) > 0) &&
+                   (!strcmp(value, "1") || !strcasecmp(value, "true"));
+
+    /*
+     * "persist.audio.duck_level" property is the attenuation in dB of the
+     * media in a zone while a prompt plays in it, 0 to disable the ducking
+     */
+    int duckLevel = kDuckLevelDb;
+    if (property_get("persist.audio.duck_level", value, NULL) > 0)
+        duckLevel = -abs(atoi(value));
+
+    /*
+     * "persist.audio.headroom" property is the headroom policy of the slots
+     * fed by several streams at once: "none" (saturation only), "power"
+     * (1/sqrt(n)) or "safe" (1/n)
+     */
+    AudioPortMixer::Headroom headroom = AudioPortMixer::HEADROOM_NONE;
+    if (property_get("persist.audio.headroom", value, NULL) > 0) {
+        if (!strcasecmp(value, "power"))
+            headroom = AudioPortMixer::HEADROOM_POWER;
+        else if (!strcasecmp(value, "safe"))
+            headroom = AudioPortMixer::HEADROOM_SAFE;
+    }
+
+    /*
+     * "persist.audio.limiter" property is the threshold in dBFS of the
+     * output limiters of the CPU and JAMR3 ports, or "off"
+     */
+    bool limiter = true;
+    float limiterDb = kLimiterThresholdDb;
+    if (property_get("persist.audio.limiter", value, NULL) > 0) {
+        if (!strcasecmp(value, "off"))
+            limiter = false;
+        else
+            limiterDb = atof(value);
+    }
+
+    /*
+     * "persist.audio.drift_comp" property enables ("1", default) or disables
+     * ("0") the compensation of the codecs' clock drift in the port mixers.
+     * It's bypassed while a direct stream plays alone on its port. Capture
+     * isn't corrected: the PCM readers deliver at their codec's rate, and
+     * the voice call's uplink pipe is balanced by the BT port following
+     * the mic port's clock instead, see enableVoiceCall().
+     */
+    bool driftComp = true;
+    if (property_get("persist.audio.drift_comp", value, NULL) > 0)
+        driftComp = !strcmp(value, "1") || !strcasecmp(value, "true");
+
+    ALOGI("AudioHwDevice: create hw device for card hw:%u Jacinto6 EVM %s",
+          card, usesJAMR3() ? "+ JAMR3" : "");
+
+    AudioPcmDevice *pcms[kNumPorts];
+    for (uint32_t i = 0; i < kNumPorts; i++) {
+        bool mmap = mmapPorts & (1 << i);
+        if (hostPcm)
+            pcms[i] = new HostPcmDevice(mCardId, i, mmap);
+        else
+            pcms[i] = new AlsaPcmDevice(mCardId, i, mmap);
+    }
+
+    /*
+     * Output ports share the ALSA device through a mixer that runs with the
+     * fast period size: 2 channels (CPU) or 8 channels (JAMR3), 16-bits/sample,
+     * 44.1kHz, 256 frames. Bluetooth runs at its own rate and period size.
+     */
+    PcmParams mixerParams(kCPUNumChannels, kSampleSize, kSampleRate, kFastFrameCount);
+    mMixers.push_back(new AudioPortMixer(pcms[kCPUPortId], mixerParams, &mMasterVolume));
+    mixerParams.channels = kJAMR3NumChannels;
+    mMixers.push_back(new AudioPortMixer(pcms[kJAMR3PortId], mixerParams, &mMasterVolume));
+    PcmParams paramsBT(kBTNumChannels, kSampleSize, kBTSampleRate, kBTFrameCount);
+    mMixers.push_back(new AudioPortMixer(pcms[kBTPortId], paramsBT, &mMasterVolume));
+    for (uint32_t i = 0; i < kBTPortId; i++) {
+        mMixers[i]->setDuckGain(powf(10.0f, duckLevel / 20.0f));
+        mMixers[i]->setHeadroom(0xffffffff, headroom);
+        mMixers[i]->setLimiter(limiter, limiterDb);
+    }
+    for (uint32_t i = 0; i < mMixers.size(); i++)
+        mMixers[i]->setDriftCompensation(driftComp);
+
+    /* Mixer for dra7evm and input/output ports for JAMR3 PCM device */
+    for (uint32_t i = 0; i < kNumPorts; i++) {
+        ALSAInPort *inPort = new ALSAInPort(mCardId, i);
+        mInPorts.push_back(inPort);
+
+        AudioOutPort *outPort = new AudioOutPort(mMixers[i], "regular");
+        mOutPorts.push_back(outPort);
+    }
+
+    /*
+     * Fast and deep buffer ports for the CPU and JAMR3 devices, not for Bluetooth.
+     * Short sounds (prompts, chimes) go to the fast port, they duck the others.
+     */
+    for (uint32_t i = 0; i < kBTPortId; i++) {
+        AudioOutPort *outPort = new AudioOutPort(mMixers[i], "fast", kPromptPriority);
+        mFastOutPorts.push_back(outPort);
+
+        outPort = new AudioOutPort(mMixers[i], "deep buffer");
+        mDeepOutPorts.push_back(outPort);
+
+        outPort = new AudioOutPort(mMixers[i], "direct");
+        mDirectOutPorts.push_back(outPort);
+        mMixers[i]->setDirectInput(outPort);
+
+        outPort = new AudioOutPort(mMixers[i], "overlay");
+        mOverlayOutPorts.push_back(outPort);
+    }
+
+    /*
+     * PCM readers and writers of the CPU and JAMR3 ports are created for the
+     * default rate, they are re-created when the port rate changes
+     */
+    mReaders.resize(kNumPorts, NULL);
+    mWriters.resize(kNumPorts, NULL);
+    mFastWriters.resize(kBTPortId, NULL);
+    mDeepWriters.resize(kBTPortId, NULL);
+    mOverlayWriters.resize(kBTPortId, NULL);
+    for (uint32_t i = 0; i < kBTPortId; i++)
+        setupPort(i, kSampleRate);
+
+    fillStreamPools();
+
+    /* Voice call */
+    mWriters[kBTPortId] = new PcmWriter(mOutPorts[kBTPortId], paramsBT);
+    mReaders[kBTPortId] = new PcmReader(mInPorts[kBTPortId], paramsBT);
+
+    /* BT is configured as stereo but only the left channel carries data */
+    SlotMap slots;
+    slots[0] = 0;
+    slots[1] = 0;
+
+    /* Microphone slots are different in JAMR3 and CPU board */
+    SlotMap micSlots;
+    if (usesJAMR3()) {
+        micSlots[0] = 2;
+        micSlots[1] = 2;
+    } else {
+        micSlots[0] = 0;
+        micSlots[1] = 0;
+    }
+
+    /* Voice call uplink */
+    mULPipe = new tiaudioutils::MonoPipe(paramsBT,
+                              (kVoiceCallPipeMs * paramsBT.sampleRate) / 1000);
+    mULPipeWriter = new PipeWriter(mULPipe);
+    mULPipeReader = new PipeReader(mULPipe);
+    mVoiceULInStream = new InStream(paramsBT, micSlots, mULPipeWriter);
+    mVoiceULOutStream = new OutStream(paramsBT, slots, mULPipeReader);
+
+    /* Voice call downlink */
+    mDLPipe = new tiaudioutils::MonoPipe(paramsBT,
+                              (kVoiceCallPipeMs * kSampleRate) / 1000);
+    mDLPipeWriter = new PipeWriter(mDLPipe);
+    mDLPipeReader = new PipeReader(mDLPipe);
+    mVoiceDLInStream = new InStream(paramsBT, slots, mDLPipeWriter);
+    mVoiceDLOutStream = new OutStream(paramsBT, slots, mDLPipeReader);
+
+    mEventThread = new AudioEventThread();
+    mEventThread->run("MultizoneAudioEvents", ANDROID_PRIORITY_AUDIO);
+
+    loadChimes();
+
+    mMixer.initRoutes();
+}
+
+AudioHwDevice::~AudioHwDevice()
+{
+    ALOGI("AudioHwDevice: destroy hw device for card hw:%u", mCardId);
+
+    if (mEventThread != NULL) {
+        mEventThread->stop();
+        mEventThread.clear();
+    }
+
+    if (mDLPipeWriter)
+        delete mDLPipeWriter;
+
+    if (mDLPipeReader)
+        delete mDLPipeReader;
+
+    if (mDLPipe)
+        delete mDLPipe;
+
+    if (mULPipeWriter)
+        delete mULPipeWriter;
+
+    if (mULPipeReader)
+        delete mULPipeReader;
+
+    if (mULPipe)
+        delete mULPipe;
+
+    for (WriterVect::const_iterator i = mWriters.begin(); i != mWriters.end(); ++i) {
+        delete (*i);
+    }
+    for (WriterVect::const_iterator i = mFastWriters.begin(); i != mFastWriters.end(); ++i) {
+        delete (*i);
+    }
+    for (WriterVect::const_iterator i = mDeepWriters.begin(); i != mDeepWriters.end(); ++i) {
+        delete (*i);
+    }
+    for (WriterVect::const_iterator i = mOverlayWriters.begin(); i != mOverlayWriters.end(); ++i) {
+        delete (*i);
+    }
+    for (ReaderVect::const_iterator i = mReaders.begin(); i != mReaders.end(); ++i) {
+        delete (*i);
+    }
+    for (OutPortVect::iterator i = mOutPorts.begin(); i != mOutPorts.end(); ++i) {
+        delete (*i);
+    }
+    for (OutPortVect::iterator i = mFastOutPorts.begin(); i != mFastOutPorts.end(); ++i) {
+        delete (*i);
+    }
+    for (OutPortVect::iterator i = mDeepOutPorts.begin(); i != mDeepOutPorts.end(); ++i) {
+        delete (*i);
+    }
+    for (OutPortVect::iterator i = mDirectOutPorts.begin(); i != mDirectOutPorts.end(); ++i) {
+        delete (*i);
+    }
+    for (OutPortVect::iterator i = mOverlayOutPorts.begin(); i != mOverlayOutPorts.end(); ++i) {
+        delete (*i);
+    }
+    for (MixerVect::iterator i = mMixers.begin(); i != mMixers.end(); ++i) {
+        delete (*i);
+    }
+    for (InPortVect::iterator i = mInPorts.begin(); i != mInPorts.end(); ++i) {
+        delete (*i);
+    }
+}
+
+/*
+ * Create the PCM reader and writers of the CPU or JAMR3 port for the given
+ * rate, replacing the existing ones. The port must not be in use.
+ */
+void AudioHwDevice::setupPort(uint32_t port, uint32_t rate)
+{
+    uint32_t channels = (port == kJAMR3PortId) ? kJAMR3NumChannels : kCPUNumChannels;
+
+    delete mReaders[port];
+    delete mWriters[port];
+    delete mFastWriters[port];
+    delete mDeepWriters[port];
+    delete mOverlayWriters[port];
+
+    /* 2 channels (CPU) or 8 channels (JAMR3), 16-bits/sample, buffer of
+     * 20ms, i.e. 882 frames at 44.1kHz (capture) */
+    PcmParams params(channels, kSampleSize, rate, (kCaptureFrameCount * rate) / kSampleRate);
+    mReaders[port] = new PcmReader(mInPorts[port], params);
+
+    /* Buffer of 1024 frames (playback), also for streams overlapping others */
+    params.frameCount = kPlaybackFrameCount;
+    mWriters[port] = new PcmWriter(mOutPorts[port], params);
+    mOverlayWriters[port] = new PcmWriter(mOverlayOutPorts[port], params);
+
+    /* Buffer of 256 frames (fast playback) */
+    params.frameCount = kFastFrameCount;
+    mFastWriters[port] = new PcmWriter(mFastOutPorts[port], params);
+
+    /* Buffer of 8192 frames (deep buffer playback) */
+    params.frameCount = kDeepBufferFrameCount;
+    mDeepWriters[port] = new PcmWriter(mDeepOutPorts[port], params);
+}
+
+/*
+ * Pre-build the adapted streams of the most common configurations: stereo
+ * playback on the speaker and capture from the built-in mic, at 44.1kHz
+ * and 48kHz, plus mono 16kHz capture for voice recognition. Pooled streams
+ * are recycled when closed, so other configurations get pooled on use.
+ */
+void AudioHwDevice::fillStreamPools()
+{
+    const uint32_t rates[] = { kSampleRate, k48kSampleRate };
+
+    for (uint32_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        PcmParams params(2, kSampleSize, rates[i], kPlaybackFrameCount);
+        SlotMap outMap(0x03, 0x03);
+        sp<OutStream> out = new AdaptedOutStream(params, outMap);
+        mOutStreamPool.release(OutStreamPool::Key(params, getOutPoolSlots(0x03, 0x03)), out);
+    }
+
+    fillInStreamPool();
+}
+
+/*
+ * Input streams take the frame count of the media port's reader, which
+ * follows the port rate: the pool is refilled when the port is
+ * reconfigured, the streams of the old frame count would never be reused
+ */
+void AudioHwDevice::fillInStreamPool()
+{
+    const uint32_t rates[] = { kSampleRate, k48kSampleRate, 16000 };
+    const uint32_t readerFrames = mReaders[mMediaPortId]->getParams().frameCount;
+    uint32_t srcSlot0, srcSlot1;
+
+    getInputSlots(AUDIO_DEVICE_IN_BUILTIN_MIC, srcSlot0, srcSlot1);
 
-    /* Mixer for dra7evm and input/output ports for JAMR3 PCM device */
-    for (uint32_t i = 0; i < kNumPorts; i++) {
-        ALSAInPort *inPort = new ALSAInPort(mCardId, i);
-        mInPorts.push_back(inPort);
+    mInStreamPool.clear();
 
-        ALSAOutPort *outPort = new ALSAOutPort(mCardId, i);
-        mOutPorts.push_back(outPort);
+    for (uint32_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        uint32_t channels = (rates[i] == 16000) ? 1 : 2;
+        PcmParams params(channels, kSampleSize, rates[i], readerFrames);
+        SlotMap inMap;
+        inMap[0] = srcSlot0;
+        if (params.channels == 2)
+            inMap[1] = srcSlot1;
+        sp<InStream> in = new AdaptedInStream(params, inMap);
+        mInStreamPool.release(InStreamPool::Key(params, getInPoolSlots(srcSlot0, srcSlot1)), in);
     }
+}
 
-    /* PCM parameters for the port associated with on-board audio:
-     * 2 channels, 16-bits/sample, 44.1kHz, buffer of 882 frames (capture) */
-    PcmParams params0(kCPUNumChannels, kSampleSize, kSampleRate, kCaptureFrameCount);
-    PcmReader *reader = new PcmReader(mInPorts[kCPUPortId], params0);
-    mReaders.push_back(reader);
-    /* 2 channels, 16-bits/sample, 44.1kHz, buffer of 1024 frames (playback) */
-    params0.frameCount = kPlaybackFrameCount;
-    PcmWriter *writer = new PcmWriter(mOutPorts[kCPUPortId], params0);
-    mWriters.push_back(writer);
-
-    /* PCM parameters for the port associated with JAMR3 audio:
-     * 8 channels, 16-bits/sample, 44.1kHz, buffer of 882 frames (capture) */
-    PcmParams params1(kJAMR3NumChannels, kSampleSize, kSampleRate, kCaptureFrameCount);
-    reader = new PcmReader(mInPorts[kJAMR3PortId], params1);
-    mReaders.push_back(reader);
-    /* 8 channels, 16-bits/sample, 44.1kHz, buffer of 1024 frames (playback) */
-    params1.frameCount = kPlaybackFrameCount;
-    writer = new PcmWriter(mOutPorts[kJAMR3PortId], params1);
-    mWriters.push_back(writer);
+/*
+ * Port rate of the same family as the client rate, so that the client's
+ * stream is not resampled or is resampled by an integer ratio. Zero if
+ * none of the supported port rates fits.
+ */
+uint32_t AudioHwDevice::getPortRate(uint32_t rate)
+{
+    if (!rate)
+        return 0;
 
-    /* Voice call */
-    PcmParams paramsBT(kBTNumChannels, kSampleSize, kBTSampleRate, kBTFrameCount);
-    writer = new PcmWriter(mOutPorts[kBTPortId], paramsBT);
-    mWriters.push_back(writer);
-    reader = new PcmReader(mInPorts[kBTPortId], paramsBT);
-    mReaders.push_back(reader);
+    if (!(k48kSampleRate % rate))
+        return k48kSampleRate;
 
-    /* BT is configured as stereo but only the left channel carries data */
-    SlotMap slots;
-    slots[0] = 0;
-    slots[1] = 0;
+    if (!(kSampleRate % rate))
+        return kSampleRate;
 
-    /* Microphone slots are different in JAMR3 and CPU board */
-    SlotMap micSlots;
-    if (usesJAMR3()) {
-        micSlots[0] = 2;
-        micSlots[1] = 2;
-    } else {
-        micSlots[0] = 0;
-        micSlots[1] = 0;
+    return 0;
+}
+
+/*
+ * Only active streams hold the port, streams in standby are moved to the
+ * new reader and writers when it's reconfigured. Direct streams match the
+ * port's rate, they hold it even in standby.
+ *
+ * must be called with mLock and the port's streams locked, see lockStreams()
+ */
+bool AudioHwDevice::isPortInUse(uint32_t port) const
+{
+    /* Media port is in use by the voice call paths */
+    if ((mMode == AUDIO_MODE_IN_CALL) && (port == mMediaPortId))
+        return true;
+
+    for (vector<AudioStreamOut*>::const_iterator i = mLockedOutStreams.begin();
+         i != mLockedOutStreams.end(); ++i) {
+        if (!(*i)->mStandby || (*i)->mDirect)
+            return true;
     }
 
-    /* Voice call uplink */
-    mULPipe = new tiaudioutils::MonoPipe(paramsBT,
-                              (kVoiceCallPipeMs * paramsBT.sampleRate) / 1000);
-    mULPipeWriter = new PipeWriter(mULPipe);
-    mULPipeReader = new PipeReader(mULPipe);
-    mVoiceULInStream = new InStream(paramsBT, micSlots, mULPipeWriter);
-    mVoiceULOutStream = new OutStream(paramsBT, slots, mULPipeReader);
+    for (vector<AudioStreamIn*>::const_iterator i = mLockedInStreams.begin();
+         i != mLockedInStreams.end(); ++i) {
+        if (!(*i)->mStandby)
+            return true;
+    }
 
-    /* Voice call downlink */
-    mDLPipe = new tiaudioutils::MonoPipe(paramsBT,
-                              (kVoiceCallPipeMs * params0.sampleRate) / 1000);
-    mDLPipeWriter = new PipeWriter(mDLPipe);
-    mDLPipeReader = new PipeReader(mDLPipe);
-    mVoiceDLInStream = new InStream(paramsBT, slots, mDLPipeWriter);
-    mVoiceDLOutStream = new OutStream(paramsBT, slots, mDLPipeReader);
+    return false;
+}
 
-    mMixer.initRoutes();
+/* must be called with mLock */
+bool AudioHwDevice::isPortWriter(uint32_t port, const PcmWriter *writer) const
+{
+    return (writer == mWriters[port]) || (writer == mFastWriters[port]) ||
+           (writer == mDeepWriters[port]) || (writer == mOverlayWriters[port]);
 }
 
-AudioHwDevice::~AudioHwDevice()
+/*
+ * Output stream that plays on the port, or that broadcasts to one of the
+ * port's writers. The port and writers of a stream only change with mLock.
+ *
+ * must be called with mLock
+ */
+bool AudioHwDevice::isPortStream(uint32_t port, const AudioStreamOut *out) const
 {
-    ALOGI("AudioHwDevice: destroy hw device for card hw:%u", mCardId);
+    if ((uint32_t)out->mPort->getPortId() == port)
+        return true;
 
-    if (mDLPipeWriter)
-        delete mDLPipeWriter;
+    const AudioStreamOut::BroadcastVect &broadcasts = out->mBroadcasts;
+    for (uint32_t i = 0; i < broadcasts.size(); i++) {
+        if (isPortWriter(port, broadcasts[i].writer))
+            return true;
+    }
 
-    if (mDLPipeReader)
-        delete mDLPipeReader;
+    return false;
+}
 
-    if (mDLPipe)
-        delete mDLPipe;
+/*
+ * Streams in standby are not registered to their reader or writer, but
+ * they must not resume while the port is being reconfigured. Only the
+ * streams of the port are locked, the others keep running.
+ *
+ * must be called with mLock
+ */
+void AudioHwDevice::lockStreams(uint32_t port)
+{
+    for (StreamOutSet::iterator i = mOutStreams.begin(); i != mOutStreams.end(); ++i) {
+        if (isPortStream(port, i->get())) {
+            (*i)->mLock.lock();
+            mLockedOutStreams.push_back(i->get());
+        }
+    }
+    for (StreamInSet::iterator i = mInStreams.begin(); i != mInStreams.end(); ++i) {
+        if ((*i)->mReader == mReaders[port]) {
+            (*i)->mLock.lock();
+            mLockedInStreams.push_back(i->get());
+        }
+    }
+}
 
-    if (mULPipeWriter)
-        delete mULPipeWriter;
+/* must be called with mLock */
+void AudioHwDevice::unlockStreams()
+{
+    for (vector<AudioStreamIn*>::iterator i = mLockedInStreams.begin();
+         i != mLockedInStreams.end(); ++i)
+        (*i)->mLock.unlock();
+    for (vector<AudioStreamOut*>::iterator i = mLockedOutStreams.begin();
+         i != mLockedOutStreams.end(); ++i)
+        (*i)->mLock.unlock();
 
-    if (mULPipeReader)
-        delete mULPipeReader;
+    mLockedInStreams.clear();
+    mLockedOutStreams.clear();
+}
 
-    if (mULPipe)
-        delete mULPipe;
+/*
+ * Change the rate of the CPU or JAMR3 port, only possible if no stream is
+ * active on it. Playback and capture are reconfigured together as they
+ * share the serial port's clocks. Streams in standby are re-targeted to
+ * the new reader and writers, they resume at the new port rate.
+ *
+ * must be called with mLock
+ */
+int AudioHwDevice::reconfigurePort(uint32_t port, uint32_t rate)
+{
+    if (port >= kBTPortId)
+        return -EINVAL;
 
-    for (WriterVect::const_iterator i = mWriters.begin(); i != mWriters.end(); ++i) {
-        delete (*i);
+    uint32_t oldRate = mMixers[port]->getParams().sampleRate;
+    if (oldRate == rate)
+        return 0;
+
+    lockStreams(port);
+
+    if (isPortInUse(port)) {
+        unlockStreams();
+        ALOGV("AudioHwDevice: port hw:%u,%u is in use, stays at %u Hz",
+              mCardId, port, oldRate);
+        return -EBUSY;
     }
-    for (ReaderVect::const_iterator i = mReaders.begin(); i != mReaders.end(); ++i) {
-        delete (*i);
+
+    int ret = mMixers[port]->setSampleRate(rate);
+    if (ret) {
+        unlockStreams();
+        ALOGE("AudioHwDevice: failed to set port hw:%u,%u rate %d", mCardId, port, ret);
+        return ret;
     }
-    for (OutPortVect::iterator i = mOutPorts.begin(); i != mOutPorts.end(); ++i) {
-        delete (*i);
+
+    /* Old reader and writers are released once no stream points to them */
+    WriterVect *writers[] = { &mWriters, &mFastWriters, &mDeepWriters, &mOverlayWriters };
+    const uint32_t numWriters = sizeof(writers) / sizeof(writers[0]);
+    PcmWriter *oldWriters[numWriters];
+    for (uint32_t i = 0; i < numWriters; i++) {
+        oldWriters[i] = (*writers[i])[port];
+        (*writers[i])[port] = NULL;
     }
-    for (InPortVect::iterator i = mInPorts.begin(); i != mInPorts.end(); ++i) {
-        delete (*i);
+    PcmReader *oldReader = mReaders[port];
+    mReaders[port] = NULL;
+
+    setupPort(port, rate);
+
+    for (vector<AudioStreamOut*>::iterator i = mLockedOutStreams.begin();
+         i != mLockedOutStreams.end(); ++i) {
+        AudioStreamOut::BroadcastVect &broadcasts = (*i)->mBroadcasts;
+        for (uint32_t j = 0; j < numWriters; j++) {
+            if ((*i)->mWriter == oldWriters[j])
+                (*i)->mWriter = (*writers[j])[port];
+            for (uint32_t k = 0; k < broadcasts.size(); k++) {
+                if (broadcasts[k].writer == oldWriters[j])
+                    broadcasts[k].writer = (*writers[j])[port];
+            }
+        }
     }
+    for (vector<AudioStreamIn*>::iterator i = mLockedInStreams.begin();
+         i != mLockedInStreams.end(); ++i)
+        (*i)->mReader = mReaders[port];
+
+    unlockStreams();
+
+    for (uint32_t i = 0; i < numWriters; i++)
+        delete oldWriters[i];
+    delete oldReader;
+
+    if (port == mMediaPortId)
+        fillInStreamPool();
+
+    ALOGI("AudioHwDevice: port hw:%u,%u reconfigured from %u Hz to %u Hz",
+          mCardId, port, oldRate, rate);
+
+    return 0;
 }
 
 uint32_t AudioHwDevice::getSupportedDevices() const
@@ -764,6 +2151,24 @@ int AudioHwDevice::initCheck() const
             return -ENODEV;
         }
     }
+    for (WriterVect::const_iterator i = mFastWriters.begin(); i != mFastWriters.end(); ++i) {
+        if (!((*i)->initCheck())) {
+            ALOGE("AudioHwDevice: fast PCM writer init failed");
+            return -ENODEV;
+        }
+    }
+    for (WriterVect::const_iterator i = mDeepWriters.begin(); i != mDeepWriters.end(); ++i) {
+        if (!((*i)->initCheck())) {
+            ALOGE("AudioHwDevice: deep buffer PCM writer init failed");
+            return -ENODEV;
+        }
+    }
+    for (WriterVect::const_iterator i = mOverlayWriters.begin(); i != mOverlayWriters.end(); ++i) {
+        if (!((*i)->initCheck())) {
+            ALOGE("AudioHwDevice: overlay PCM writer init failed");
+            return -ENODEV;
+        }
+    }
 
     if ((mULPipe == NULL) || !mULPipe->initCheck() ||
         (mULPipeReader == NULL) || !mULPipeReader->initCheck() ||
@@ -813,7 +2218,20 @@ int AudioHwDevice::setVoiceVolume(float volume)
 int AudioHwDevice::setMasterVolume(float volume)
 {
     ALOGV("AudioHwDevice: setMasterVolume() vol=%.4f", volume);
-    return -ENOSYS;
+
+    /* Applied by the output ports on their next period */
+    mMasterVolume.setVolume(volume);
+
+    return 0;
+}
+
+int AudioHwDevice::getMasterVolume(float *volume) const
+{
+    ALOGV("AudioHwDevice: getMasterVolume()");
+
+    *volume = mMasterVolume.getVolume();
+
+    return 0;
 }
 
 const char *AudioHwDevice::getModeName(audio_mode_t mode) const
@@ -892,23 +2310,39 @@ int AudioHwDevice::enableVoiceCall()
         return ret;
     }
 
-    /* Downlink output stream: Pipe -> Speaker */
+    /* Downlink output stream: Pipe -> Speaker, left channel on both slots */
     ret = outStream->mWriter->registerStream(mVoiceDLOutStream);
     if (ret) {
         ALOGE("AudioHwDevice: failed to register downlink out stream %d", ret);
+        return ret;
     }
+    outStream->mPort->addSlots(0x03);
 
-    return ret;
+    /*
+     * Each pipe is drained at the pace of the clock that fills it: the BT
+     * port follows the mic's port clock, the speaker's port follows the BT
+     * clock, so neither pipe overflows nor underruns over a long call
+     */
+    mMixers[kBTPortId]->setClockReference(mMixers[mMediaPortId]);
+    mMixers[outStream->mPort->getPortId()]->setClockReference(mMixers[kBTPortId]);
+
+    return 0;
 }
 
 void AudioHwDevice::disableVoiceCall()
 {
     ALOGV("AudioHwDevice: disable voice call paths");
 
+    /* Ports follow CLOCK_MONOTONIC again, as the other zones */
+    for (MixerVect::iterator i = mMixers.begin(); i != mMixers.end(); ++i)
+        (*i)->setClockReference(NULL);
+
     sp<AudioStreamOut> outStream = mPrimaryStreamOut.promote();
     if (outStream != NULL) {
-        if (outStream->mWriter->isStreamRegistered(mVoiceDLOutStream))
+        if (outStream->mWriter->isStreamRegistered(mVoiceDLOutStream)) {
             outStream->mWriter->unregisterStream(mVoiceDLOutStream);
+            outStream->mPort->removeSlots(0x03);
+        }
         outStream->setVoiceCall(false);
     } else {
         ALOGE("AudioHwDevice: primary output stream is not valid");
@@ -1023,20 +2457,334 @@ void AudioHwDevice::leaveVoiceCall()
     setVoiceVolume(1.0f);
 }
 
-int AudioHwDevice::setMicMute(bool state)
+int AudioHwDevice::setMicMute(bool state)
+{
+    ALOGV("AudioHwDevice: setMicMute() %s", state ? "mute" : "unmute");
+
+    mMicMute = state;
+
+    return 0;
+}
+
+int AudioHwDevice::getMicMute(bool *state) const
+{
+    ALOGV("AudioHwDevice: getMicMute()");
+
+    *state = mMicMute;
+
+    return 0;
+}
+
+/*
+ * Zone EQ, e.g. "eq_headphone=lowshelf:120:4:0.7|peak:3000:-3:1.4": up to
+ * ZoneEq::kMaxSections sections of type:frequency:gain (dB):Q, or "off"
+ */
+int AudioHwDevice::parseZoneEq(const char *value, vector<BiquadSpec> &specs)
+{
+    static const struct {
+        const char *name;
+        BiquadSpec::Type type;
+    } types[] = {
+        { "peak", BiquadSpec::PEAK },
+        { "lowshelf", BiquadSpec::LOW_SHELF },
+        { "highshelf", BiquadSpec::HIGH_SHELF },
+        { "lowpass", BiquadSpec::LOW_PASS },
+        { "highpass", BiquadSpec::HIGH_PASS },
+    };
+
+    specs.clear();
+
+    if (!strcmp(value, "off") || !strlen(value))
+        return 0;
+
+    char buf[256];
+    strncpy(buf, value, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    char *saveptr;
+    for (char *tok = strtok_r(buf, "|", &saveptr); tok; tok = strtok_r(NULL, "|", &saveptr)) {
+        char name[16];
+        BiquadSpec spec;
+
+        if (sscanf(tok, "%15[a-z]:%f:%f:%f", name, &spec.freq, &spec.gainDb, &spec.q) != 4)
+            return -EINVAL;
+
+        uint32_t i;
+        for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if (!strcmp(name, types[i].name))
+                break;
+        }
+        if (i == sizeof(types) / sizeof(types[0]))
+            return -EINVAL;
+
+        spec.type = types[i].type;
+        specs.push_back(spec);
+    }
+
+    return (specs.size() <= ZoneEq::kMaxSections) ? 0 : -EINVAL;
+}
+
+/*
+ * Default downmix, in Android's channel order (FL FR FC LFE BL BR SL SR):
+ * the center and the surrounds at -3 dB, no LFE
+ */
+void AudioHwDevice::getDefaultDownmix(uint32_t channels, vector<float> &matrix)
+{
+    static const float kMinus3dB = 0.7071f;
+
+    matrix.assign(2 * channels, 0.0f);
+    for (uint32_t ch = 0; ch < channels; ch++) {
+        float gain = (ch < 2) ? 1.0f : (ch == 3) ? 0.0f : kMinus3dB;
+        if ((ch == 2) || !(ch & 1))
+            matrix[ch] = gain;
+        if ((ch == 2) || (ch & 1))
+            matrix[channels + ch] = gain;
+    }
+}
+
+/*
+ * Downmix matrix, e.g. "downmix_5.1=1,0,0.707,0,0.707,0|0,1,0.707,0,0,0.707":
+ * the left row then the right row, one coefficient per channel, or
+ * "default". Coefficients are within +/-2 and the sum of a row's
+ * magnitudes is below 4, so the 16-bit kernel can't overflow.
+ */
+int AudioHwDevice::parseDownmix(const char *value, uint32_t channels, vector<float> &matrix)
+{
+    if (!strcmp(value, "default")) {
+        getDefaultDownmix(channels, matrix);
+        return 0;
+    }
+
+    char buf[256];
+    strncpy(buf, value, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    matrix.clear();
+
+    char *saveptr;
+    uint32_t rows = 0;
+    for (char *row = strtok_r(buf, "|", &saveptr); row; row = strtok_r(NULL, "|", &saveptr)) {
+        float sum = 0.0f;
+        char *end = row;
+
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            char *start = end + (ch ? 1 : 0);
+            float coef = strtof(start, &end);
+            if ((end == start) || (*end != (ch == channels - 1 ? '\0' : ',')))
+                return -EINVAL;
+            if (fabsf(coef) >= 2.0f)
+                return -EINVAL;
+            sum += fabsf(coef);
+            matrix.push_back(coef);
+        }
+        if (sum >= 4.0f)
+            return -EINVAL;
+        rows++;
+    }
+
+    return (rows == 2) ? 0 : -EINVAL;
+}
+
+/*
+ * Synchronized start of the CPU and JAMR3 ports: their mixers hold all
+ * their inputs until the deadline, keeping the devices primed with
+ * silence, then start them at the frame each device presents at that
+ * time. Streams started before the deadline fill up meanwhile, so the
+ * content plays in sync across the zones of both ports. The deadline
+ * must be further away than the output latency to be met.
+ */
+int AudioHwDevice::startOutputsAt(int64_t deadlineNs)
+{
+    ALOGV("AudioHwDevice: startOutputsAt() %lld ns", deadlineNs);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t delayNs = deadlineNs - (now.tv_sec * AudioPortMixer::kNsPerSec + now.tv_nsec);
+
+    /* Ports are paused until the deadline, keep it close */
+    if ((delayNs <= 0) || (delayNs > kMaxStartDelayMs * 1000000LL)) {
+        ALOGE("AudioHwDevice: start deadline %lld ns is %lld ms away",
+              deadlineNs, delayNs / 1000000);
+        return -EINVAL;
+    }
+
+    AutoMutex lock(mLock);
+
+    mMixers[kCPUPortId]->startAt(deadlineNs);
+    mMixers[kJAMR3PortId]->startAt(deadlineNs);
+
+    return 0;
+}
+
+/*
+ * Chimes are WAV clips preloaded from kChimeDir, named after their file,
+ * and tones defined through setParameters(). The port mixers play them
+ * straight into the zones, no stream is opened for them. They are
+ * prepared for the current rates of the ports here, and for the rate of
+ * a reconfigured port when they are played.
+ */
+void AudioHwDevice::loadChimes()
+{
+    DIR *dir = opendir(kChimeDir);
+    if (!dir) {
+        ALOGV("AudioHwDevice: no chimes in %s", kChimeDir);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *ext = strrchr(entry->d_name, '.');
+        if (!ext || strcasecmp(ext, ".wav"))
+            continue;
+
+        string name(entry->d_name, ext - entry->d_name);
+        string path = string(kChimeDir) + "/" + entry->d_name;
+        sp<AudioChime> chime = AudioChime::loadWav(name.c_str(), path.c_str());
+        if (chime == NULL)
+            continue;
+
+        chime->prepare(mMixers[kCPUPortId]->getParams().sampleRate);
+        chime->prepare(mMixers[kJAMR3PortId]->getParams().sampleRate);
+        mChimes[name] = chime;
+    }
+
+    closedir(dir);
+
+    ALOGI("AudioHwDevice: %u chimes loaded from %s", mChimes.size(), kChimeDir);
+}
+
+/* "name:freq:lengthMs[:decayMs]", a tone replaces a chime of the same name */
+int AudioHwDevice::createChimeTone(const char *value)
+{
+    ALOGV("AudioHwDevice: createChimeTone() '%s'", value);
+
+    char name[32];
+    float freq;
+    uint32_t lengthMs;
+    uint32_t decayMs = 0;
+
+    if (sscanf(value, "%31[^:]:%f:%u:%u", name, &freq, &lengthMs, &decayMs) < 3) {
+        ALOGE("AudioHwDevice: invalid chime tone '%s'", value);
+        return -EINVAL;
+    }
+
+    sp<AudioChime> chime = AudioChime::createTone(name, freq, lengthMs, decayMs);
+    if (chime == NULL) {
+        ALOGE("AudioHwDevice: invalid chime tone '%s'", value);
+        return -EINVAL;
+    }
+
+    AutoMutex lock(mLock);
+
+    chime->prepare(mMixers[kCPUPortId]->getParams().sampleRate);
+    chime->prepare(mMixers[kJAMR3PortId]->getParams().sampleRate);
+
+    /* The one replaced is stopped, it couldn't be stopped by name anymore */
+    ChimeMap::iterator i = mChimes.find(name);
+    if (i != mChimes.end()) {
+        for (MixerVect::iterator j = mMixers.begin(); j != mMixers.end(); ++j)
+            (*j)->stopChime(i->second, 0xffffffff, true);
+    }
+
+    mChimes[name] = chime;
+
+    return 0;
+}
+
+/* Port and slots of a zone: "speaker", "headphone" or "headphone2" */
+int AudioHwDevice::getChimeRoute(const char *zone, uint32_t &port, uint32_t &destMask) const
+{
+    static const struct {
+        const char *name;
+        audio_devices_t device;
+    } zones[] = {
+        { "speaker", AUDIO_DEVICE_OUT_SPEAKER },
+        { "headphone", AUDIO_DEVICE_OUT_WIRED_HEADPHONE },
+        { "headphone2", AUDIO_DEVICE_OUT_WIRED_HEADPHONE2 },
+    };
+
+    for (uint32_t i = 0; i < sizeof(zones) / sizeof(zones[0]); i++) {
+        if (strcmp(zone, zones[i].name))
+            continue;
+
+        uint32_t channels = 2;
+        uint32_t srcMask;
+        return getOutputRoute(zones[i].device, channels, port, srcMask, destMask);
+    }
+
+    ALOGE("AudioHwDevice: invalid chime zone '%s'", zone);
+
+    return -EINVAL;
+}
+
+/*
+ * "name:zone[:loops[:periodMs[:gainDb[:delayMs]]]]", played once right
+ * away by default. 0 loops plays it until it's stopped.
+ */
+int AudioHwDevice::playChime(const char *value)
+{
+    ALOGV("AudioHwDevice: playChime() '%s'", value);
+
+    char name[32];
+    char zone[16];
+    uint32_t loops = 1;
+    uint32_t periodMs = 0;
+    float gainDb = 0.0f;
+    uint32_t delayMs = 0;
+
+    if (sscanf(value, "%31[^:]:%15[a-z0-9]:%u:%u:%f:%u", name, zone, &loops, &periodMs,
+               &gainDb, &delayMs) < 2) {
+        ALOGE("AudioHwDevice: invalid chime '%s'", value);
+        return -EINVAL;
+    }
+
+    uint32_t port, destMask;
+    if (getChimeRoute(zone, port, destMask))
+        return -EINVAL;
+
+    AutoMutex lock(mLock);
+
+    ChimeMap::iterator i = mChimes.find(name);
+    if (i == mChimes.end()) {
+        ALOGE("AudioHwDevice: unknown chime '%s'", name);
+        return -EINVAL;
+    }
+
+    AudioPortMixer *mixer = mMixers[port];
+    int ret = i->second->prepare(mixer->getParams().sampleRate);
+    if (ret)
+        return ret;
+
+    return mixer->playChime(i->second, destMask, loops, periodMs, gainDb, delayMs);
+}
+
+/* "name:zone[:now]", at the end of the current loop unless "now" */
+int AudioHwDevice::stopChime(const char *value)
 {
-    ALOGV("AudioHwDevice: setMicMute() %s", state ? "mute" : "unmute");
+    ALOGV("AudioHwDevice: stopChime() '%s'", value);
 
-    mMicMute = state;
+    char name[32];
+    char zone[16];
+    char when[4] = "";
 
-    return 0;
-}
+    if (sscanf(value, "%31[^:]:%15[a-z0-9]:%3s", name, zone, when) < 2) {
+        ALOGE("AudioHwDevice: invalid chime '%s'", value);
+        return -EINVAL;
+    }
 
-int AudioHwDevice::getMicMute(bool *state) const
-{
-    ALOGV("AudioHwDevice: getMicMute()");
+    uint32_t port, destMask;
+    if (getChimeRoute(zone, port, destMask))
+        return -EINVAL;
 
-    *state = mMicMute;
+    AutoMutex lock(mLock);
+
+    ChimeMap::iterator i = mChimes.find(name);
+    if (i == mChimes.end()) {
+        ALOGE("AudioHwDevice: unknown chime '%s'", name);
+        return -EINVAL;
+    }
+
+    mMixers[port]->stopChime(i->second, destMask, !strcmp(when, "now"));
 
     return 0;
 }
@@ -1045,7 +2793,91 @@ int AudioHwDevice::setParameters(const char *kv_pairs)
 {
     ALOGV("AudioHwDevice: setParameters() '%s'", kv_pairs ? kv_pairs : "");
 
-    return 0;
+    static const struct {
+        const char *key;
+        audio_devices_t device;
+    } zones[] = {
+        { "eq_speaker", AUDIO_DEVICE_OUT_SPEAKER },
+        { "eq_headphone", AUDIO_DEVICE_OUT_WIRED_HEADPHONE },
+        { "eq_headphone2", AUDIO_DEVICE_OUT_WIRED_HEADPHONE2 },
+    };
+
+    AudioParameter parms = AudioParameter(String8(kv_pairs));
+    String8 value;
+    int ret = 0;
+
+    /* Downmix matrices apply to the streams opened afterwards */
+    static const struct {
+        const char *key;
+        uint32_t channels;
+    } layouts[] = {
+        { "downmix_5.1", 6 },
+        { "downmix_7.1", 8 },
+    };
+
+    /* "start_at" is a CLOCK_MONOTONIC time in ns, see startOutputsAt() */
+    if (parms.get(String8("start_at"), value) == NO_ERROR) {
+        if (startOutputsAt(strtoll(value.string(), NULL, 0)))
+            ret = -EINVAL;
+    }
+
+    /* Tones are defined before they are played in the same call */
+    if (parms.get(String8("chime_tone"), value) == NO_ERROR) {
+        if (createChimeTone(value.string()))
+            ret = -EINVAL;
+    }
+
+    if (parms.get(String8("chime_play"), value) == NO_ERROR) {
+        if (playChime(value.string()))
+            ret = -EINVAL;
+    }
+
+    if (parms.get(String8("chime_stop"), value) == NO_ERROR) {
+        if (stopChime(value.string()))
+            ret = -EINVAL;
+    }
+
+    for (uint32_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        if (parms.get(String8(layouts[i].key), value) != NO_ERROR)
+            continue;
+
+        vector<float> matrix;
+        if (parseDownmix(value.string(), layouts[i].channels, matrix)) {
+            ALOGE("AudioHwDevice: invalid %s '%s'", layouts[i].key, value.string());
+            ret = -EINVAL;
+            continue;
+        }
+
+        AutoMutex lock(mLock);
+        if (layouts[i].channels == 6)
+            mDownmix51 = matrix;
+        else
+            mDownmix71 = matrix;
+    }
+
+    for (uint32_t i = 0; i < sizeof(zones) / sizeof(zones[0]); i++) {
+        if (parms.get(String8(zones[i].key), value) != NO_ERROR)
+            continue;
+
+        vector<BiquadSpec> specs;
+        if (parseZoneEq(value.string(), specs)) {
+            ALOGE("AudioHwDevice: invalid %s '%s'", zones[i].key, value.string());
+            ret = -EINVAL;
+            continue;
+        }
+
+        uint32_t channels = 2;
+        uint32_t port, srcMask, destMask;
+        if (getOutputRoute(zones[i].device, channels, port, srcMask, destMask)) {
+            ret = -EINVAL;
+            continue;
+        }
+
+        if (mMixers[port]->setZoneEq(destMask, specs))
+            ret = -EINVAL;
+    }
+
+    return ret;
 }
 
 char *AudioHwDevice::getParameters(const char *keys) const
@@ -1079,25 +2911,69 @@ int AudioHwDevice::dump(int fd) const
 {
     ALOGV("AudioHwDevice: dump()");
 
+    String8 result;
+
+    AutoMutex lock(mLock);
+
+    result.appendFormat("Multizone audio HAL: card hw:%u, media port %u, %s writes\n",
+                        mCardId, mMediaPortId, mRingMode ? "ring" : "blocking");
+    result.appendFormat("  Stream pools: out %u idle, %u hits, %u misses; "
+                        "in %u idle, %u hits, %u misses\n",
+                        mOutStreamPool.getSize(), mOutStreamPool.getHits(),
+                        mOutStreamPool.getMisses(), mInStreamPool.getSize(),
+                        mInStreamPool.getHits(), mInStreamPool.getMisses());
+    mFirstWriteStats.dump(result);
+    mFirstWritePooledStats.dump(result);
+    mFirstReadStats.dump(result);
+    mFirstReadPooledStats.dump(result);
+
+    int64_t cpuError, jamr3Error;
+    if (!mMixers[kCPUPortId]->getStartError(cpuError) &&
+        !mMixers[kJAMR3PortId]->getStartError(jamr3Error)) {
+        result.appendFormat("  Synchronized start: CPU %lld us, JAMR3 %lld us off the "
+                            "deadline, skew %lld us\n", cpuError / 1000, jamr3Error / 1000,
+                            (jamr3Error - cpuError) / 1000);
+    }
+    result.appendFormat("  Chimes: %u loaded:", mChimes.size());
+    for (ChimeMap::const_iterator i = mChimes.begin(); i != mChimes.end(); ++i)
+        result.appendFormat(" %s", i->first.c_str());
+    result.appendFormat("\n");
+    ::write(fd, result.string(), result.size());
+
+    for (MixerVect::const_iterator i = mMixers.begin(); i != mMixers.end(); ++i) {
+        (*i)->dump(fd);
+    }
+
+    for (StreamOutSet::const_iterator i = mOutStreams.begin(); i != mOutStreams.end(); ++i) {
+        (*i)->dump(fd);
+    }
+
     return 0;
 }
 
 int AudioHwDevice::setMasterMute(bool mute)
 {
     ALOGV("AudioHwDevice: setMasterMute() %s", mute ? "mute" : "unmute");
-    return -ENOSYS;
+
+    /* All ports see the new state at once, it's a single word */
+    mMasterVolume.setMute(mute);
+
+    return 0;
 }
 
-AudioStreamIn* AudioHwDevice::openInputStream(audio_io_handle_t handle,
-                                              audio_devices_t devices,
-                                              struct audio_config *config)
+int AudioHwDevice::getMasterMute(bool *mute) const
 {
-    uint32_t port = mMediaPortId;
-    uint32_t srcSlot0, srcSlot1;
-    uint32_t channels = popcount(config->channel_mask);
+    ALOGV("AudioHwDevice: getMasterMute()");
 
-    ALOGV("AudioHwDevice: openInputStream()");
+    *mute = mMasterVolume.getMute();
 
+    return 0;
+}
+
+/* Source slots of the input devices, same for the left and right channels if mono */
+int AudioHwDevice::getInputSlots(audio_devices_t devices, uint32_t &srcSlot0,
+                                 uint32_t &srcSlot1) const
+{
     switch (devices) {
     case AUDIO_DEVICE_IN_BUILTIN_MIC:
     case AUDIO_DEVICE_IN_VOICE_CALL:
@@ -1121,12 +2997,69 @@ AudioStreamIn* AudioHwDevice::openInputStream(audio_io_handle_t handle,
     case AUDIO_DEVICE_IN_ANLG_DOCK_HEADSET:
         if (!usesJAMR3()) {
             ALOGE("AudioHwDevice: device 0x%08x requires JAMR3", devices);
-            return NULL;
+            return -EINVAL;
         }
         srcSlot0 = 0;
         srcSlot1 = 1;
         break;
     default:
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/* Move an input stream to other devices, the stream is not put in standby */
+int AudioHwDevice::rerouteInputStream(AudioStreamIn *in, audio_devices_t devices)
+{
+    ALOGV("AudioHwDevice: rerouteInputStream() devices 0x%08x", devices);
+
+    AutoMutex lock(mLock);
+
+    uint32_t srcSlot0, srcSlot1;
+    if (getInputSlots(devices, srcSlot0, srcSlot1))
+        return -EINVAL;
+
+    SlotMap slotMap;
+    slotMap[0] = srcSlot0;
+    if (in->mParams.channels == 2)
+        slotMap[1] = srcSlot1;
+
+    if (!slotMap.isValid()) {
+        ALOGE("AudioHwDevice: failed to create slot map");
+        return -EINVAL;
+    }
+
+    /* The old stream is stopped right away, it goes back to the pool */
+    sp<InStream> old = in->mStream;
+    uint32_t oldSlots = in->mPoolSlots;
+    uint32_t poolSlots = getInPoolSlots(srcSlot0, srcSlot1);
+    sp<InStream> pooled = mInStreamPool.acquire(InStreamPool::Key(in->mParams, poolSlots));
+
+    int ret = in->reroute(slotMap, devices, pooled, poolSlots);
+    if (ret) {
+        if (pooled != NULL)
+            mInStreamPool.release(InStreamPool::Key(in->mParams, poolSlots), pooled);
+        return ret;
+    }
+
+    if (oldSlots)
+        mInStreamPool.release(InStreamPool::Key(in->mParams, oldSlots), old);
+
+    return 0;
+}
+
+AudioStreamIn* AudioHwDevice::openInputStream(audio_io_handle_t handle,
+                                              audio_devices_t devices,
+                                              struct audio_config *config)
+{
+    uint32_t port = mMediaPortId;
+    uint32_t srcSlot0, srcSlot1;
+    uint32_t channels = popcount(config->channel_mask);
+
+    ALOGV("AudioHwDevice: openInputStream()");
+
+    if (getInputSlots(devices, srcSlot0, srcSlot1)) {
         ALOGE("AudioHwDevice: device 0x%08x is not supported", devices);
         return NULL;
     }
@@ -1148,18 +3081,28 @@ AudioStreamIn* AudioHwDevice::openInputStream(audio_io_handle_t handle,
 
     AutoMutex lock(mLock);
 
+    /* Follow the client's rate if no other stream holds the port */
+    uint32_t portRate = getPortRate(config->sample_rate);
+    if (portRate)
+        reconfigurePort(port, portRate);
+
     /* Set the parameters for the internal input stream. Don't change the
      * parameters for capture. The resampler is used if needed. */
     PcmParams params(*config, mReaders[port]->getParams().frameCount);
 
+    uint32_t poolSlots = getInPoolSlots(srcSlot0, srcSlot1);
+    sp<InStream> pooled = mInStreamPool.acquire(InStreamPool::Key(params, poolSlots));
+
     sp<AudioStreamIn> in = new AudioStreamIn(this, mReaders[port], params,
-                                             slotMap, devices);
+                                             slotMap, devices, pooled);
     if ((in == NULL) || in->initCheck()) {
         ALOGE("AudioHwDevice: failed to open input stream on port hw:%u,%u",
               mCardId, port);
         return NULL;
     }
 
+    in->mPoolSlots = poolSlots;
+
     mInStreams.insert(in);
 
     return in.get();
@@ -1176,22 +3119,29 @@ void AudioHwDevice::closeInputStream(AudioStreamIn *in)
         return;
     }
 
+    in->standby();
+
+    if (in->mPoolSlots) {
+        mInStreamPool.release(InStreamPool::Key(in->mParams, in->mPoolSlots),
+                              in->mStream);
+    }
+
     mInStreams.erase(in);
 
     in = NULL;
 }
 
-AudioStreamOut* AudioHwDevice::openOutputStream(audio_io_handle_t handle,
-                                                audio_devices_t devices,
-                                                audio_output_flags_t flags,
-                                                struct audio_config *config)
+/*
+ * Port and slots of the output devices. Streams are stereo zones, except
+ * 5.1 and 7.1 streams on the JAMR3 speaker output which are spread over
+ * the TDM slots in a single pass, in Android's channel order: FL FR (slots
+ * 0-1, front zone), FC LFE (slots 2-3), BL BR (slots 4-5) and SL SR (slots
+ * 6-7). 'channels' is updated with the granted channel count.
+ */
+int AudioHwDevice::getOutputRoute(audio_devices_t devices, uint32_t &channels,
+                                  uint32_t &port, uint32_t &srcMask,
+                                  uint32_t &destMask) const
 {
-    uint32_t port = 0;
-    PcmParams params;
-
-    ALOGV("AudioHwDevice: openOutputStream()");
-
-    uint32_t destMask;
     switch (devices) {
     case AUDIO_DEVICE_OUT_SPEAKER:
         port = mMediaPortId;
@@ -1207,45 +3157,411 @@ AudioStreamOut* AudioHwDevice::openOutputStream(audio_io_handle_t handle,
         destMask = 0x30;
         break;
     default:
-        ALOGE("AudioHwDevice: device 0x%08x is not supported", devices);
-        return NULL;
+        return -EINVAL;
+    }
+
+    if ((port == kJAMR3PortId) && (devices == AUDIO_DEVICE_OUT_SPEAKER) &&
+        ((channels == 6) || (channels == 8))) {
+        srcMask = (1 << channels) - 1;
+        destMask = srcMask;
+    } else {
+        channels = 2;
+        srcMask = 0x03;
+    }
+
+    return 0;
+}
+
+/*
+ * Fast and deep buffer outputs use their own PCM writer with a smaller
+ * or larger buffer, it's mixed with the regular writer of the same port
+ * in the port's mixer
+ */
+void AudioHwDevice::getOutputWriter(uint32_t port, audio_output_flags_t flags,
+                                    PcmWriter *&writer, AudioOutPort *&outPort) const
+{
+    writer = mWriters[port];
+    outPort = mOutPorts[port];
+
+    if ((flags & AUDIO_OUTPUT_FLAG_FAST) && (port < mFastWriters.size())) {
+        writer = mFastWriters[port];
+        outPort = mFastOutPorts[port];
+    } else if ((flags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER) && (port < mDeepWriters.size())) {
+        writer = mDeepWriters[port];
+        outPort = mDeepOutPorts[port];
+    }
+}
+
+/*
+ * Move an output stream to other devices, possibly on another port, with
+ * the same profile (regular, fast or deep buffer) it was opened with. The
+ * stream is not put in standby.
+ */
+int AudioHwDevice::rerouteOutputStream(AudioStreamOut *out, audio_devices_t devices)
+{
+    ALOGV("AudioHwDevice: rerouteOutputStream() devices 0x%08x", devices);
+
+    AutoMutex lock(mLock);
+
+    uint32_t channels = out->mParams.channels;
+    uint32_t port, srcMask, destMask;
+    if (getOutputRoute(devices, channels, port, srcMask, destMask) ||
+        (channels != out->mParams.channels)) {
+        ALOGV("AudioHwDevice: stream can't be moved to devices 0x%08x", devices);
+        return -EINVAL;
+    }
+
+    /* Headphone zones are the rear slots of a surround stream, see openOutputStream() */
+    if ((channels == 2) && (getUsedSlots(port, true) & destMask & ~0x03)) {
+        ALOGV("AudioHwDevice: devices 0x%08x are held by a surround stream", devices);
+        return -EBUSY;
+    }
+
+    SlotMap slotMap(srcMask, destMask);
+    if (!slotMap.isValid()) {
+        ALOGE("AudioHwDevice: failed to create slot map");
+        return -EINVAL;
+    }
+
+    /* Overlay streams move back to the regular writer */
+    uint32_t flags = AUDIO_OUTPUT_FLAG_NONE;
+    for (uint32_t i = 0; i < mFastOutPorts.size(); i++) {
+        if (out->mPort == mFastOutPorts[i])
+            flags = AUDIO_OUTPUT_FLAG_FAST;
+        else if (out->mPort == mDeepOutPorts[i])
+            flags = AUDIO_OUTPUT_FLAG_DEEP_BUFFER;
+    }
+
+    PcmWriter *writer;
+    AudioOutPort *outPort;
+    getOutputWriter(port, (audio_output_flags_t)flags, writer, outPort);
+
+    /* Streams that can't be moved would drop the pooled stream */
+    {
+        TimedAutoMutex outLock(out->mLock, out->mLockStats);
+        int ret = out->getRerouteError();
+        if (ret)
+            return ret;
+    }
+
+    /* Ring mode streams read from their ring, they can't use a pooled stream */
+    uint32_t poolSlots = 0;
+    sp<OutStream> pooled;
+    if (!out->mRing) {
+        poolSlots = getOutPoolSlots(srcMask, destMask);
+        pooled = mOutStreamPool.acquire(OutStreamPool::Key(out->mParams, poolSlots));
+    }
+
+    /* Unused if the stream failed to move, back to the pool then */
+    int ret = out->reroute(outPort, writer, slotMap, destMask, devices, pooled, poolSlots);
+    if (ret && (pooled != NULL))
+        mOutStreamPool.release(OutStreamPool::Key(out->mParams, poolSlots), pooled);
+
+    return ret;
+}
+
+/* must be called with mLock */
+bool AudioHwDevice::isSlotInUse(const AudioOutPort *port, uint32_t slotMask) const
+{
+    for (StreamOutSet::const_iterator i = mOutStreams.begin(); i != mOutStreams.end(); ++i) {
+        if (((*i)->mPort == port) && ((*i)->mSlotMask & slotMask))
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Slots of the port held by the open output streams, only by the 5.1 and
+ * 7.1 streams if 'surround'
+ *
+ * must be called with mLock
+ */
+uint32_t AudioHwDevice::getUsedSlots(uint32_t port, bool surround) const
+{
+    uint32_t slots = 0;
+
+    for (StreamOutSet::const_iterator i = mOutStreams.begin(); i != mOutStreams.end(); ++i) {
+        if ((uint32_t)(*i)->mPort->getPortId() != port)
+            continue;
+        if (surround && ((*i)->mParams.channels <= 2))
+            continue;
+        slots |= (*i)->mSlotMask;
+    }
+
+    return slots;
+}
+
+/*
+ * Ports and slots of a stream broadcast to several stereo zones. The port
+ * of the first device (the speaker if present) is the stream's own port,
+ * zones on the other port are reported as an extra route.
+ */
+int AudioHwDevice::getBroadcastRoute(audio_devices_t devices, uint32_t &port,
+                                     uint32_t &destMask, uint32_t &extraPort,
+                                     uint32_t &extraMask) const
+{
+    uint32_t masks[kNumPorts];
+    memset(masks, 0, sizeof(masks));
+    port = kNumPorts;
+
+    for (uint32_t bit = 0; bit < 32; bit++) {
+        audio_devices_t device = devices & (1 << bit);
+        if (!device)
+            continue;
+
+        uint32_t channels = 2;
+        uint32_t devPort, srcMask, devMask;
+        if (getOutputRoute(device, channels, devPort, srcMask, devMask))
+            return -EINVAL;
+
+        if (port == kNumPorts)
+            port = devPort;
+        masks[devPort] |= devMask;
+    }
+
+    if (port == kNumPorts)
+        return -EINVAL;
+
+    destMask = masks[port];
+    extraPort = kNumPorts;
+    extraMask = 0;
+
+    for (uint32_t i = 0; i < kNumPorts; i++) {
+        if ((i == port) || !masks[i])
+            continue;
+        if (extraPort != kNumPorts)
+            return -EINVAL;
+        extraPort = i;
+        extraMask = masks[i];
+    }
+
+    return 0;
+}
+
+/* Left and right channels of the stream to the left and right slots of all zones */
+SlotMap AudioHwDevice::getBroadcastMap(uint32_t destMask)
+{
+    SlotMap map;
+
+    for (uint32_t slot = 0; slot < 32; slot++) {
+        if (destMask & (1 << slot))
+            map[slot] = slot & 1;
+    }
+
+    return map;
+}
+
+AudioStreamOut* AudioHwDevice::openOutputStream(audio_io_handle_t handle,
+                                                audio_devices_t devices,
+                                                audio_output_flags_t flags,
+                                                struct audio_config *config)
+{
+    uint32_t port = 0;
+    PcmParams params;
+
+    ALOGV("AudioHwDevice: openOutputStream()");
+
+    uint32_t channels = 2;
+    if ((config->channel_mask == AUDIO_CHANNEL_OUT_5POINT1) ||
+        (config->channel_mask == AUDIO_CHANNEL_OUT_7POINT1))
+        channels = popcount(config->channel_mask);
+    uint32_t clientChannels = channels;
+
+    /*
+     * Several zones at once are fed by a single stream: one resampler and
+     * one slot map per port, so the zones of a port stay sample-aligned
+     */
+    bool broadcast = popcount(devices) > 1;
+    uint32_t srcMask, destMask;
+    uint32_t extraPort = kNumPorts;
+    uint32_t extraMask = 0;
+    SlotMap slotMap;
+    if (broadcast) {
+        if (getBroadcastRoute(devices, port, destMask, extraPort, extraMask)) {
+            ALOGE("AudioHwDevice: devices 0x%08x can't be combined", devices);
+            return NULL;
+        }
+        channels = 2;
+        srcMask = 0x03;
+        slotMap = getBroadcastMap(destMask);
+    } else {
+        if (getOutputRoute(devices, channels, port, srcMask, destMask)) {
+            ALOGE("AudioHwDevice: device 0x%08x is not supported", devices);
+            return NULL;
+        }
+        slotMap = SlotMap(srcMask, destMask);
     }
 
-    SlotMap slotMap(0x03, destMask);
     if (!slotMap.isValid()) {
         ALOGE("AudioHwDevice: failed to create slot map");
         return NULL;
     }
 
+    /* Zones on a second port are written by the stream itself, in blocking mode */
+    bool nonBlocking = flags & AUDIO_OUTPUT_FLAG_NON_BLOCKING;
+    bool ringMode = mRingMode && (extraPort == kNumPorts);
+    if (nonBlocking && (extraPort != kNumPorts)) {
+        ALOGE("AudioHwDevice: non-blocking output can't span ports");
+        return NULL;
+    }
+
     AutoMutex lock(mLock);
 
+    /*
+     * FC/LFE and the rear channels of a 5.1/7.1 speaker stream go to slots
+     * 2-7, which are the slots of the headphone zones. They can't be shared:
+     * a surround stream is downmixed to the front zone while a headphone
+     * zone is open, and the headphone zones can't be opened while a
+     * surround stream is.
+     */
+    if (channels > 2) {
+        if (getUsedSlots(port, false) & destMask & ~0x03) {
+            ALOGV("AudioHwDevice: headphone zones are open, %u channels downmixed",
+                  channels);
+            channels = 2;
+            srcMask = 0x03;
+            destMask = 0x03;
+            slotMap = SlotMap(srcMask, destMask);
+        }
+    } else if ((getUsedSlots(port, true) & destMask & ~0x03) ||
+               ((extraPort != kNumPorts) &&
+                (getUsedSlots(extraPort, true) & extraMask & ~0x03))) {
+        ALOGE("AudioHwDevice: devices 0x%08x are held by a surround stream", devices);
+        return NULL;
+    }
+
+    /* Follow the client's rate if no other stream holds the port */
+    uint32_t portRate = getPortRate(config->sample_rate);
+    if (portRate) {
+        reconfigurePort(port, portRate);
+        if (extraPort != kNumPorts)
+            reconfigurePort(extraPort, portRate);
+    }
+
+    PcmWriter *writer;
+    AudioOutPort *outPort;
+    getOutputWriter(port, flags, writer, outPort);
+
+    /*
+     * Direct streams that match the port's rate, format and slots exactly
+     * skip the adaptation stage: no AdaptedOutStream, resampler nor PCM
+     * writer thread. While the stream plays alone on the port and nothing
+     * would alter its data (chime, zone EQ, master volume), the mixer hands
+     * the device over to the direct port, which writes straight to the PCM
+     * or copies into its MMAP buffer. Otherwise the data goes through the
+     * port's ring and the mix, see AudioPortMixer::writeDirect().
+     *
+     * The stream must span all the slots of the port: stereo on the CPU
+     * port, 7.1 on the JAMR3 speaker. Stereo zones of JAMR3 (hp1, hp2)
+     * never qualify. Only one per port, others fall back to the regular
+     * writer and are adapted as usual.
+     */
+    const PcmParams &hwParams = mMixers[port]->getParams();
+    bool direct = (flags & AUDIO_OUTPUT_FLAG_DIRECT) && !nonBlocking && !broadcast &&
+                  (port < mDirectOutPorts.size()) &&
+                  (config->format == AUDIO_FORMAT_PCM_16_BIT) &&
+                  (config->sample_rate == hwParams.sampleRate) &&
+                  (clientChannels == channels) && (channels == hwParams.channels) &&
+                  (srcMask == destMask);
+    if (direct) {
+        for (StreamOutSet::iterator i = mOutStreams.begin(); i != mOutStreams.end(); ++i) {
+            if ((*i)->mPort == mDirectOutPorts[port]) {
+                ALOGV("AudioHwDevice: direct port hw:%u,%u is busy", mCardId, port);
+                direct = false;
+                break;
+            }
+        }
+    }
+    if (direct) {
+        writer = mWriters[port];
+        outPort = mDirectOutPorts[port];
+    }
+
+    /*
+     * A PCM writer merges its streams slot by slot, it doesn't mix them. A
+     * stream whose slots overlap another one's on the regular writer goes
+     * to the overlay writer, both are then mixed by the port's mixer.
+     */
+    if (!direct && (writer == mWriters[port]) && (port < mOverlayWriters.size()) &&
+        isSlotInUse(outPort, destMask) && !isSlotInUse(mOverlayOutPorts[port], destMask)) {
+        ALOGV("AudioHwDevice: slots 0x%x overlap on hw:%u,%u, using overlay writer",
+              destMask, mCardId, port);
+        writer = mOverlayWriters[port];
+        outPort = mOverlayOutPorts[port];
+    }
+
     /* Set the parameters for the internal output stream */
-    params.frameCount = mWriters[port]->getParams().frameCount;
+    params.frameCount = writer->getParams().frameCount;
     params.sampleRate = config->sample_rate; /* Use stream's resampler if needed */
-    params.sampleBits = 16;                  /* 16-bits/sample */
-    params.channels = 2;                     /* Listening zones are stereo */
+    params.sampleBits = 16;                  /* 16-bits/sample internally */
+    params.channels = channels;              /* Stereo zones or surround */
+
+    /*
+     * Surround streams on a stereo zone are downmixed by the stream, the
+     * client keeps its channel mask
+     */
+    bool downmix = clientChannels > channels;
 
     /* Update audio config with granted parameters */
-    if (popcount(config->channel_mask) != (int)params.channels) {
+    if (popcount(config->channel_mask) != (int)clientChannels) {
         ALOGV("AudioHwDevice: updating audio config channel mask [0x%x]->[0x%x]",
               config->channel_mask,
-              audio_channel_out_mask_from_count(params.channels));
+              audio_channel_out_mask_from_count(clientChannels));
+        config->channel_mask = audio_channel_out_mask_from_count(clientChannels);
     }
-    config->channel_mask = audio_channel_out_mask_from_count(params.channels);
-    if (config->format != AUDIO_FORMAT_PCM_16_BIT) {
+
+    /* Float and 8.24 are converted by the stream, in a single rounding step */
+    switch (config->format) {
+    case AUDIO_FORMAT_PCM_16_BIT:
+    case AUDIO_FORMAT_PCM_8_24_BIT:
+    case AUDIO_FORMAT_PCM_FLOAT:
+        break;
+    default:
         ALOGV("AudioHwDevice: updating audio config format [0x%x]->[0x%x]",
               config->format, AUDIO_FORMAT_PCM_16_BIT);
+        config->format = AUDIO_FORMAT_PCM_16_BIT;
+        break;
+    }
+
+    /* Streams without ring nor direct port use an adapted stream, maybe pooled */
+    uint32_t poolSlots = 0;
+    sp<OutStream> pooled;
+    if (!ringMode && !nonBlocking && !direct && !broadcast) {
+        poolSlots = getOutPoolSlots(srcMask, destMask);
+        pooled = mOutStreamPool.acquire(OutStreamPool::Key(params, poolSlots));
     }
-    config->format = AUDIO_FORMAT_PCM_16_BIT;
 
-    sp<AudioStreamOut> out = new AudioStreamOut(this, mWriters[port], params,
-                                                slotMap, devices);
+    sp<AudioStreamOut> out = new AudioStreamOut(this, outPort, writer, params,
+                                                slotMap, devices, config->format,
+                                                ringMode, nonBlocking, direct, pooled);
+    if ((out != NULL) && (extraPort != kNumPorts)) {
+        PcmWriter *extraWriter;
+        AudioOutPort *extraOutPort;
+        getOutputWriter(extraPort, flags, extraWriter, extraOutPort);
+        if (out->addBroadcast(extraWriter, getBroadcastMap(extraMask))) {
+            ALOGE("AudioHwDevice: failed to add port hw:%u,%u to broadcast",
+                  mCardId, extraPort);
+            return NULL;
+        }
+    }
+    if ((out != NULL) && downmix &&
+        out->setDownmix(clientChannels, (clientChannels == 6) ? mDownmix51 : mDownmix71)) {
+        ALOGE("AudioHwDevice: failed to set the %u channel downmix", clientChannels);
+        return NULL;
+    }
     if ((out == NULL) || out->initCheck()) {
         ALOGE("AudioHwDevice: failed to open output stream on port hw:%u,%u",
               mCardId, port);
         return NULL;
     }
 
+    out->mPoolSlots = poolSlots;
+    out->mSlotMask = destMask;
+
+    /* Event thread also runs the delayed standby of all streams */
+    mEventThread->addStream(out.get());
+
     if (flags & AUDIO_OUTPUT_FLAG_PRIMARY)
         mPrimaryStreamOut = out;
 
@@ -1268,6 +3584,16 @@ void AudioHwDevice::closeOutputStream(AudioStreamOut *out)
     if (mPrimaryStreamOut == out)
         mPrimaryStreamOut = NULL;
 
+    mEventThread->removeStream(out);
+
+    /* Stream must not stay registered to its writer past a pending standby */
+    out->enterStandby();
+
+    if (out->mPoolSlots) {
+        mOutStreamPool.release(OutStreamPool::Key(out->mParams, out->mPoolSlots),
+                               out->mStream);
+    }
+
     mOutStreams.erase(out);
 
     out = NULL;
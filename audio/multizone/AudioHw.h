@@ -17,10 +17,13 @@
 #ifndef _AUDIO_HW_H_
 #define _AUDIO_HW_H_
 
+#include <map>
 #include <vector>
 
 #include <system/audio.h>
+#include <hardware/audio.h>
 #include <hardware/audio_effect.h>
+#include <utils/Thread.h>
 
 #include <tiaudioutils/Pcm.h>
 #include <tiaudioutils/NullPcm.h>
@@ -30,9 +33,18 @@
 #include <tiaudioutils/Stream.h>
 #include <tiaudioutils/Base.h>
 
+#include <AudioChime.h>
+#include <AudioPortMixer.h>
+#include <AudioOutPort.h>
+#include <AudioDsp.h>
+#include <AudioRing.h>
+#include <AudioStats.h>
+#include <AudioStreamPool.h>
+
 namespace android {
 
 using namespace tiaudioutils;
+using std::map;
 using std::vector;
 
 class AudioHwDevice;
@@ -59,11 +71,17 @@ class AudioStream {
 class AudioStreamOut : public RefBase, public AudioStream {
  public:
     AudioStreamOut(AudioHwDevice *hwDev,
+                   AudioOutPort *port,
                    PcmWriter *writer,
                    const PcmParams &params,
                    const SlotMap &map,
-                   audio_devices_t devices);
-    virtual ~AudioStreamOut() {};
+                   audio_devices_t devices,
+                   audio_format_t format = AUDIO_FORMAT_PCM_16_BIT,
+                   bool ringMode = false,
+                   bool nonBlocking = false,
+                   bool direct = false,
+                   const sp<OutStream> &pooled = sp<OutStream>());
+    virtual ~AudioStreamOut();
     int initCheck() const;
 
     /* From AudioStream */
@@ -87,24 +105,123 @@ class AudioStreamOut : public RefBase, public AudioStream {
     ssize_t write(const void* buffer, size_t bytes);
     int getRenderPosition(uint32_t *dsp_frames) const;
     int getNextWriteTimestamp(int64_t *timestamp) const;
+    int getPresentationPosition(uint64_t *frames, struct timespec *timestamp) const;
+    int setCallback(stream_callback_t callback, void *cookie);
+    int drain(audio_drain_type_t type);
 
     void setVoiceCall(bool on);
+    void enterStandby();
+    bool processEvents();
+    int reroute(AudioOutPort *port, PcmWriter *writer, const SlotMap &map,
+                uint32_t slotMask, audio_devices_t devices,
+                const sp<OutStream> &pooled = sp<OutStream>(), uint32_t poolSlots = 0);
+    int addBroadcast(PcmWriter *writer, const SlotMap &map);
+    int setDownmix(uint32_t channels, const vector<float> &matrix);
 
     friend AudioHwDevice;
 
  protected:
     int resume();
     void idle();
+    int getRerouteError() const;
+    void resetPosition(AudioOutPort *port);
+    void anchorPosition();
+    uint64_t getStreamFrames(uint64_t portFrames, uint64_t portBase) const;
+    void getPresentedFrames(uint64_t &frames, struct timespec &ts) const;
+    const void *applyVolume(const void *buffer, uint32_t frames);
+    const void *convert(const void *buffer, uint32_t frames);
+    int writeRing(const void *buffer, uint32_t frames);
+    int crossfade(const void *buffer, uint32_t frames);
+    void releaseFade();
+    void writeBroadcast(const void *buffer, uint32_t frames);
+
+    struct Broadcast {
+        PcmWriter *writer;
+        sp<OutStream> stream;
+    };
+    typedef vector<Broadcast> BroadcastVect;
 
     AudioHwDevice *mHwDev;
     NullOutPort mNullPort;
     PcmWriter mNullWriter;
+    AudioOutPort *mPort;
     PcmWriter *mWriter;
     PcmParams mParams;
     audio_devices_t mDevices;
+    audio_format_t mFormat;
+    uint32_t mFrameSize;
+    uint32_t mClientChannels;
+    vector<float> mDownmix;
+    vector<int16_t> mDownmixQ14;
+    vector<int16_t> mDownmixBuffer;
     sp<OutStream> mStream;
     bool mStandby;
     bool mUsedForVoiceCall;
+    uint64_t mFramesWritten;
+    uint64_t mFramesBase;
+    uint64_t mPortFramesBase;
+    uint64_t mPrevFramesBase;
+    uint64_t mPrevPortFramesBase;
+    GainRamp mVolume;
+    vector<int16_t> mVolumeBuffer;
+    vector<int32_t> mWideBuffer;
+    AudioRing *mRing;
+    bool mNonBlocking;
+    bool mDirect;
+    stream_callback_t mCallback;
+    void *mCookie;
+    volatile int32_t mWriteReadyPending;
+    volatile int32_t mDrainPending;
+    mutable LatencyStats mLockStats;
+    LatencyStats mWriteStats;
+    RateStats mWriteRate;
+    sp<OutStream> mFadeStream;
+    PcmWriter *mFadeWriter;
+    Crossfade mCrossfade;
+    vector<int16_t> mFadeBuffer;
+    LatencyStats mSwitchStats;
+    bool mIdlePending;
+    nsecs_t mIdleDeadline;
+    uint32_t mStandbyRequests;
+    uint32_t mIdles;
+    uint32_t mAvoidedResumes;
+    uint32_t mPoolSlots;
+    bool mPooled;
+    nsecs_t mOpenTime;
+    bool mFirstWrite;
+    BroadcastVect mBroadcasts;
+    uint32_t mSlotMask;
+    AudioOutPort *mSlotPort;
+    mutable Mutex mLock;
+};
+
+/**
+ * HAL thread that delivers the write-ready and drain-ready events of the
+ * non-blocking output streams, and runs the delayed standby of all output
+ * streams. It sleeps until a stream arms an event and then polls the
+ * streams with pending events. The events are delivered without the
+ * thread's lock held, a stream being removed waits for the delivery in
+ * progress instead.
+ */
+class AudioEventThread : public Thread {
+ public:
+    AudioEventThread();
+
+    void addStream(AudioStreamOut *out);
+    void removeStream(AudioStreamOut *out);
+    void wake();
+    void stop();
+
+    static const uint32_t kPollMs = 5;
+
+ protected:
+    virtual bool threadLoop();
+
+    vector<AudioStreamOut*> mStreams;
+    bool mWoken;
+    bool mDelivering;
+    Condition mCond;
+    Condition mDoneCond;
     Mutex mLock;
 };
 
@@ -114,7 +231,8 @@ class AudioStreamIn : public RefBase, public AudioStream {
                   PcmReader *reader,
                   const PcmParams &params,
                   const SlotMap &map,
-                  audio_devices_t devices);
+                  audio_devices_t devices,
+                  const sp<InStream> &pooled = sp<InStream>());
     virtual ~AudioStreamIn() {};
     int initCheck() const;
 
@@ -137,6 +255,10 @@ class AudioStreamIn : public RefBase, public AudioStream {
     int setGain(float gain);
     ssize_t read(void* buffer, size_t bytes);
     uint32_t getInputFramesLost();
+    int reroute(const SlotMap &map, audio_devices_t devices,
+                const sp<InStream> &pooled = sp<InStream>(), uint32_t poolSlots = 0);
+
+    friend AudioHwDevice;
 
  protected:
     int resume();
@@ -149,7 +271,11 @@ class AudioStreamIn : public RefBase, public AudioStream {
     audio_source_t mSource;
     sp<InStream> mStream;
     bool mStandby;
-    Mutex mLock;
+    uint32_t mPoolSlots;
+    bool mPooled;
+    nsecs_t mOpenTime;
+    bool mFirstRead;
+    mutable Mutex mLock;
 };
 
 class AudioHwDevice {
@@ -161,6 +287,7 @@ class AudioHwDevice {
     int initCheck() const;
     int setVoiceVolume(float volume);
     int setMasterVolume(float volume);
+    int getMasterVolume(float *volume) const;
     int setMode(audio_mode_t mode);
     int setMicMute(bool state);
     int getMicMute(bool *state) const;
@@ -169,6 +296,7 @@ class AudioHwDevice {
     size_t getInputBufferSize(const struct audio_config *config) const;
     int dump(int fd) const;
     int setMasterMute(bool mute);
+    int getMasterMute(bool *mute) const;
     AudioStreamIn* openInputStream(audio_io_handle_t handle,
                                    audio_devices_t devices,
                                    struct audio_config *config);
@@ -189,13 +317,27 @@ class AudioHwDevice {
     static const uint32_t kCPUNumChannels = 2;
     static const uint32_t kJAMR3NumChannels = 8;
     static const uint32_t kBTNumChannels = 2;
+    static const uint32_t kDownmixMaxChannels = 8;
 
     static const uint32_t kSampleRate = 44100;
+    static const uint32_t k48kSampleRate = 48000;
     static const uint32_t kBTSampleRate = 8000;
     static const uint32_t kSampleSize = 16;
     static const uint32_t kCaptureFrameCount = 882;
     static const uint32_t kPlaybackFrameCount = 1024;
     static const uint32_t kBTFrameCount = 160;
+    static const uint32_t kFastFrameCount = 256;
+    static const uint32_t kDeepBufferFrameCount = 8192;
+
+    static const uint32_t kVolumeRampMs = 10;
+    static const int kDuckLevelDb = -12;
+    static const uint32_t kPromptPriority = 1;
+    static const float kLimiterThresholdDb = -1.0f;
+    static const uint32_t kRouteFadeMs = 5;
+    static const uint32_t kRingPeriods = 2;
+    static const uint32_t kStandbyDelayMs = 500;
+    static const uint32_t kStreamPoolSize = 2;
+    static const uint32_t kMaxStartDelayMs = 2000;
 
     static const uint32_t kADCSettleMs = 80;
     static const uint32_t kVoiceCallPipeMs = 100;
@@ -205,16 +347,59 @@ class AudioHwDevice {
     static const char *kCabinVolumeHP;
     static const char *kCabinVolumeLine;
     static const char *kBTMode;
+    static const char *kChimeDir;
 
  protected:
     typedef set< sp<AudioStreamIn> > StreamInSet;
     typedef set< sp<AudioStreamOut> > StreamOutSet;
     typedef vector<ALSAInPort*> InPortVect;
-    typedef vector<ALSAOutPort*> OutPortVect;
+    typedef vector<AudioOutPort*> OutPortVect;
+    typedef vector<AudioPortMixer*> MixerVect;
     typedef vector<PcmReader*> ReaderVect;
     typedef vector<PcmWriter*> WriterVect;
+    typedef AudioStreamPool<OutStream> OutStreamPool;
+    typedef AudioStreamPool<InStream> InStreamPool;
+    typedef map<string, sp<AudioChime> > ChimeMap;
 
     bool usesJAMR3() const { return mMediaPortId == kJAMR3PortId; }
+    void setupPort(uint32_t port, uint32_t rate);
+    static uint32_t getPortRate(uint32_t rate);
+    void fillStreamPools();
+    void fillInStreamPool();
+    static uint32_t getOutPoolSlots(uint32_t srcMask, uint32_t destMask) {
+        return srcMask | (destMask << 8);
+    }
+    static uint32_t getInPoolSlots(uint32_t srcSlot0, uint32_t srcSlot1) {
+        return 0x10000 | srcSlot0 | (srcSlot1 << 8);
+    }
+    int getOutputRoute(audio_devices_t devices, uint32_t &channels, uint32_t &port,
+                       uint32_t &srcMask, uint32_t &destMask) const;
+    void getOutputWriter(uint32_t port, audio_output_flags_t flags,
+                         PcmWriter *&writer, AudioOutPort *&outPort) const;
+    int getInputSlots(audio_devices_t devices, uint32_t &srcSlot0,
+                      uint32_t &srcSlot1) const;
+    int getBroadcastRoute(audio_devices_t devices, uint32_t &port, uint32_t &destMask,
+                          uint32_t &extraPort, uint32_t &extraMask) const;
+    static SlotMap getBroadcastMap(uint32_t destMask);
+    static int parseZoneEq(const char *value, vector<BiquadSpec> &specs);
+    static int parseDownmix(const char *value, uint32_t channels, vector<float> &matrix);
+    static void getDefaultDownmix(uint32_t channels, vector<float> &matrix);
+    bool isSlotInUse(const AudioOutPort *port, uint32_t slotMask) const;
+    uint32_t getUsedSlots(uint32_t port, bool surround) const;
+    int startOutputsAt(int64_t deadlineNs);
+    void loadChimes();
+    int createChimeTone(const char *value);
+    int playChime(const char *value);
+    int stopChime(const char *value);
+    int getChimeRoute(const char *zone, uint32_t &port, uint32_t &destMask) const;
+    int rerouteOutputStream(AudioStreamOut *out, audio_devices_t devices);
+    int rerouteInputStream(AudioStreamIn *in, audio_devices_t devices);
+    bool isPortInUse(uint32_t port) const;
+    bool isPortWriter(uint32_t port, const PcmWriter *writer) const;
+    bool isPortStream(uint32_t port, const AudioStreamOut *out) const;
+    void lockStreams(uint32_t port);
+    void unlockStreams();
+    int reconfigurePort(uint32_t port, uint32_t rate);
     const char *getModeName(audio_mode_t mode) const;
     int enterVoiceCall();
     void leaveVoiceCall();
@@ -223,15 +408,38 @@ class AudioHwDevice {
 
     uint32_t mCardId;
     ALSAMixer mMixer;
+    MasterVolume mMasterVolume;
     InPortVect mInPorts;
+    MixerVect mMixers;
     OutPortVect mOutPorts;
+    OutPortVect mFastOutPorts;
+    OutPortVect mDeepOutPorts;
+    OutPortVect mDirectOutPorts;
+    OutPortVect mOverlayOutPorts;
     ReaderVect mReaders;
     WriterVect mWriters;
+    WriterVect mFastWriters;
+    WriterVect mDeepWriters;
+    WriterVect mOverlayWriters;
     StreamInSet mInStreams;
     StreamOutSet mOutStreams;
+    vector<AudioStreamIn*> mLockedInStreams;
+    vector<AudioStreamOut*> mLockedOutStreams;
     bool mMicMute;
     audio_mode_t mMode;
     uint32_t mMediaPortId;
+    bool mRingMode;
+    uint32_t mStandbyDelayMs;
+    vector<float> mDownmix51;
+    vector<float> mDownmix71;
+    ChimeMap mChimes;
+    OutStreamPool mOutStreamPool;
+    InStreamPool mInStreamPool;
+    LatencyStats mFirstWriteStats;
+    LatencyStats mFirstWritePooledStats;
+    LatencyStats mFirstReadStats;
+    LatencyStats mFirstReadPooledStats;
+    sp<AudioEventThread> mEventThread;
     wp<AudioStreamOut> mPrimaryStreamOut;
     tiaudioutils::MonoPipe *mULPipe;
     tiaudioutils::MonoPipe *mDLPipe;
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmark of the port mixer's mix stage: two inputs accumulated
+ * into the same slots, then scaled by a per-slot headroom gain and
+ * saturated to 16 bits. The AudioDsp kernels (NEON on ARM) are compared
+ * with a plain scalar mix, for the 2-channel CPU and 8-channel JAMR3
+ * frames.
+ *
+ * Usage: multizone_mixbench [periods]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include <AudioDsp.h>
+
+using namespace android;
+using std::vector;
+
+static const uint32_t kFrames = 256;
+static const uint32_t kInputs = 2;
+
+static int64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void mixScalar(const vector<vector<int16_t> > &inputs, int32_t *acc, int16_t *out,
+                      uint32_t channels, const int32_t *gains)
+{
+    uint32_t samples = kFrames * channels;
+
+    memset(acc, 0, samples * sizeof(int32_t));
+    for (uint32_t i = 0; i < inputs.size(); i++) {
+        const int16_t *in = &inputs[i][0];
+        for (uint32_t s = 0; s < samples; s++)
+            acc[s] += in[s];
+    }
+
+    for (uint32_t s = 0; s < samples; s++) {
+        int64_t sample = ((int64_t)acc[s] * gains[s % channels] + (1LL << 30)) >> 31;
+        if (sample > 32767)
+            sample = 32767;
+        else if (sample < -32768)
+            sample = -32768;
+        out[s] = sample;
+    }
+}
+
+static void mixKernels(const vector<vector<int16_t> > &inputs, int32_t *acc, int16_t *out,
+                       uint32_t channels, const int32_t *gains)
+{
+    memset(acc, 0, kFrames * channels * sizeof(int32_t));
+    for (uint32_t i = 0; i < inputs.size(); i++)
+        accumulateQ15(acc, &inputs[i][0], kFrames * channels);
+
+    scaleSaturateSlotsQ15(acc, out, kFrames, channels, gains);
+}
+
+static void run(uint32_t channels, uint32_t periods)
+{
+    vector<vector<int16_t> > inputs(kInputs);
+    vector<int32_t> acc(kFrames * channels);
+    vector<int16_t> scalarOut(kFrames * channels);
+    vector<int16_t> kernelOut(kFrames * channels);
+    vector<int32_t> gains(channels);
+
+    /* Loud inputs so that the sums clip, odd slots get -3 dB of headroom */
+    srand(channels);
+    for (uint32_t i = 0; i < kInputs; i++) {
+        inputs[i].resize(kFrames * channels);
+        for (uint32_t s = 0; s < inputs[i].size(); s++)
+            inputs[i][s] = (int16_t)((rand() & 0xffff) - 0x8000);
+    }
+    for (uint32_t ch = 0; ch < channels; ch++)
+        gains[ch] = (ch & 1) ? 0x5a82799a : 0x7fffffff;
+
+    int64_t start = now();
+    for (uint32_t p = 0; p < periods; p++)
+        mixScalar(inputs, &acc[0], &scalarOut[0], channels, &gains[0]);
+    int64_t scalarNs = now() - start;
+
+    start = now();
+    for (uint32_t p = 0; p < periods; p++)
+        mixKernels(inputs, &acc[0], &kernelOut[0], channels, &gains[0]);
+    int64_t kernelNs = now() - start;
+
+    bool match = !memcmp(&scalarOut[0], &kernelOut[0], kFrames * channels * sizeof(int16_t));
+
+    printf("%u channels, %u inputs, %u frames x %u periods\n",
+           channels, kInputs, kFrames, periods);
+    printf("  scalar : %8.2f ns/frame\n", (double)scalarNs / (periods * kFrames));
+    printf("  kernels: %8.2f ns/frame (%.2fx), output %s\n",
+           (double)kernelNs / (periods * kFrames), (double)scalarNs / kernelNs,
+           match ? "matches" : "DIFFERS");
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t periods = (argc > 1) ? strtoul(argv[1], NULL, 0) : 10000;
+
+    run(2, periods);
+    run(8, periods);
+
+    return 0;
+}
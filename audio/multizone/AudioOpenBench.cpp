@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of the open-to-first-write (and first read) latency of the
+ * HAL streams, with and without the stream pools. The primary audio HAL
+ * is loaded in this process, so the media server must be stopped first
+ * ("stop media"). Each stream is opened in the pooled configurations,
+ * 44.1kHz stereo on the speaker and from the built-in mic, then one
+ * buffer is written or read and the stream is closed. The pools are
+ * disabled through "persist.audio.stream_pool", which is restored at the
+ * end.
+ *
+ * Usage: multizone_openbench [iterations]
+ */
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include <cutils/properties.h>
+#include <hardware/audio.h>
+#include <hardware/hardware.h>
+
+using std::vector;
+
+static const uint32_t kSampleRate = 44100;
+static const char *kPoolProperty = "persist.audio.stream_pool";
+
+struct Result {
+    int64_t p50;
+    int64_t mean;
+    int64_t max;
+};
+
+static int64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void getResult(vector<int64_t> &samples, Result &result)
+{
+    int64_t sum = 0;
+
+    for (uint32_t i = 0; i < samples.size(); i++)
+        sum += samples[i];
+
+    std::sort(samples.begin(), samples.end());
+    result.p50 = samples[samples.size() / 2];
+    result.mean = sum / samples.size();
+    result.max = samples.back();
+}
+
+/* The buffer is allocated once, only the HAL's work is timed */
+static int openToFirstWrite(audio_hw_device_t *dev, vector<uint8_t> &buffer, int64_t &ns)
+{
+    struct audio_config config;
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = kSampleRate;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+
+    struct audio_stream_out *out;
+    int64_t start = now();
+
+    int ret = dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                      AUDIO_OUTPUT_FLAG_NONE, &config, &out);
+    if (ret)
+        return ret;
+
+    size_t bytes = out->common.get_buffer_size(&out->common);
+    if (bytes > buffer.size())
+        bytes = buffer.size();
+
+    ssize_t written = out->write(out, &buffer[0], bytes);
+    ns = now() - start;
+
+    dev->close_output_stream(dev, out);
+
+    return (written < 0) ? written : 0;
+}
+
+static int openToFirstRead(audio_hw_device_t *dev, vector<uint8_t> &buffer, int64_t &ns)
+{
+    struct audio_config config;
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = kSampleRate;
+    config.channel_mask = AUDIO_CHANNEL_IN_STEREO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+
+    struct audio_stream_in *in;
+    int64_t start = now();
+
+    int ret = dev->open_input_stream(dev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &in);
+    if (ret)
+        return ret;
+
+    size_t bytes = in->common.get_buffer_size(&in->common);
+    if (bytes > buffer.size())
+        bytes = buffer.size();
+
+    ssize_t read = in->read(in, &buffer[0], bytes);
+    ns = now() - start;
+
+    dev->close_input_stream(dev, in);
+
+    return (read < 0) ? read : 0;
+}
+
+/* The HAL reads the pool size when the device is opened */
+static int run(const hw_module_t *module, const char *poolSize, uint32_t iterations,
+               Result &write, Result &read)
+{
+    property_set(kPoolProperty, poolSize);
+
+    audio_hw_device_t *dev;
+    int ret = audio_hw_device_open(module, &dev);
+    if (ret) {
+        fprintf(stderr, "failed to open the audio device %d\n", ret);
+        return ret;
+    }
+
+    vector<uint8_t> buffer(64 * 1024);
+    vector<int64_t> writes(iterations);
+    vector<int64_t> reads(iterations);
+
+    for (uint32_t i = 0; !ret && (i < iterations); i++) {
+        ret = openToFirstWrite(dev, buffer, writes[i]);
+        if (!ret)
+            ret = openToFirstRead(dev, buffer, reads[i]);
+    }
+
+    audio_hw_device_close(dev);
+
+    if (ret) {
+        fprintf(stderr, "failed to open, write or read a stream %d\n", ret);
+        return ret;
+    }
+
+    getResult(writes, write);
+    getResult(reads, read);
+
+    return 0;
+}
+
+static void print(const char *name, const Result &off, const Result &on)
+{
+    printf("%-18s p50 %6lld us -> %6lld us, mean %6lld us -> %6lld us, "
+           "max %6lld us -> %6lld us\n", name, off.p50 / 1000, on.p50 / 1000,
+           off.mean / 1000, on.mean / 1000, off.max / 1000, on.max / 1000);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : 100;
+    const hw_module_t *module;
+    char saved[PROPERTY_VALUE_MAX];
+
+    int ret = hw_get_module_by_class(AUDIO_HARDWARE_MODULE_ID,
+                                     AUDIO_HARDWARE_MODULE_ID_PRIMARY, &module);
+    if (ret) {
+        fprintf(stderr, "failed to load the primary audio HAL %d\n", ret);
+        return 1;
+    }
+
+    property_get(kPoolProperty, saved, "");
+
+    Result writeOff, readOff, writeOn, readOn;
+    ret = run(module, "0", iterations, writeOff, readOff);
+    if (!ret)
+        ret = run(module, "2", iterations, writeOn, readOn); /* HAL default */
+
+    property_set(kPoolProperty, saved);
+
+    if (ret)
+        return 1;
+
+    printf("%u iterations, %u Hz stereo, without -> with the stream pools\n",
+           iterations, kSampleRate);
+    print("open to 1st write", writeOff, writeOn);
+    print("open to 1st read", readOff, readOn);
+
+    return 0;
+}
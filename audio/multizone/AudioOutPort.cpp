@@ -0,0 +1,407 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioOutPort"
+// #define LOG_NDEBUG 0
+// #define VERY_VERBOSE_LOGGING
+#ifdef VERY_VERBOSE_LOGGING
+#define ALOGVV ALOGV
+#else
+#define ALOGVV(...) do { } while(0)
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include <AudioOutPort.h>
+
+namespace android {
+
+AudioOutPort::AudioOutPort(AudioPortMixer *mixer, const char *profile, uint32_t priority)
+    : mMixer(mixer), mRing(NULL), mPriority(priority), mFramesWritten(0), mFramesMixed(0),
+      mHwFramesEnd(0), mLastPresented(0), mUnderruns(0), mStopCount(0)
+{
+    char name[48];
+    snprintf(name, sizeof(name), "AudioOutPort hw:%u,%u %s",
+             mixer->getCardId(), mixer->getPortId(), profile);
+    mName = string(name);
+
+    memset(mSlotUsers, 0, sizeof(mSlotUsers));
+}
+
+AudioOutPort::~AudioOutPort()
+{
+    if (isOpen())
+        close();
+}
+
+int AudioOutPort::open(const PcmParams &params)
+{
+    const PcmParams &hwParams = mMixer->getParams();
+
+    ALOGV("%s: open %u channels, %u bits/sample, %u Hz, %u frames",
+          getName(), params.channels, params.sampleBits, params.sampleRate,
+          params.frameCount);
+
+    /* Only the period size can differ from the device's */
+    if ((params.channels != hwParams.channels) ||
+        (params.sampleBits != hwParams.sampleBits) ||
+        (params.sampleRate != hwParams.sampleRate)) {
+        ALOGE("%s: params don't match the device's (%u ch, %u bits, %u Hz)",
+              getName(), hwParams.channels, hwParams.sampleBits, hwParams.sampleRate);
+        return -EINVAL;
+    }
+
+    mLock.lock();
+
+    if (mRing) {
+        mLock.unlock();
+        ALOGE("%s: port is already open", getName());
+        return -EBUSY;
+    }
+
+    /* Room for the writer's period and the device's period */
+    uint32_t frames = (params.frameCount > hwParams.frameCount) ?
+                      params.frameCount : hwParams.frameCount;
+    mRing = new AudioRing(params, kRingPeriods * frames);
+    if (!mRing->initCheck()) {
+        ALOGE("%s: failed to create ring", getName());
+        delete mRing;
+        mRing = NULL;
+        mLock.unlock();
+        return -ENOMEM;
+    }
+
+    mParams = params;
+    mZoneGains.setChannels(params.channels);
+
+    mLock.unlock();
+
+    /* Mixer's render thread starts pulling from the ring from now on */
+    int ret = mMixer->attach(this);
+    if (ret) {
+        ALOGE("%s: failed to attach to mixer %d", getName(), ret);
+        AutoMutex lock(mLock);
+        delete mRing;
+        mRing = NULL;
+    }
+
+    return ret;
+}
+
+void AudioOutPort::close()
+{
+    ALOGV("%s: close", getName());
+
+    mMixer->detach(this);
+
+    AutoMutex lock(mLock);
+
+    if (mRing) {
+        delete mRing;
+        mRing = NULL;
+    }
+}
+
+bool AudioOutPort::isOpen() const
+{
+    AutoMutex lock(mLock);
+    return (mRing != NULL);
+}
+
+int AudioOutPort::write(const void *buffer, size_t frames)
+{
+    const uint8_t *data = (const uint8_t *)buffer;
+    size_t remaining = frames;
+
+    ALOGVV("%s: write %u frames", getName(), frames);
+
+    mLock.lock();
+    if (!mRing) {
+        mLock.unlock();
+        ALOGE("%s: port is not open", getName());
+        return -ENODEV;
+    }
+    uint32_t stopCount = mStopCount;
+    mLock.unlock();
+
+    /*
+     * The mixer sleeps for up to the whole kernel buffer when only deep
+     * buffer inputs are attached, allow a few device periods on top of it
+     * before declaring the port stalled
+     */
+    const PcmParams &hwParams = mMixer->getParams();
+    uint64_t stallFrames = (AudioPortMixer::kPeriodCount + 4) * hwParams.frameCount;
+    nsecs_t timeout = (stallFrames * 1000000000LL) / hwParams.sampleRate;
+
+    int ret = writeDirect(data, remaining, stopCount, timeout);
+    if (ret)
+        return ret;
+
+    AutoMutex lock(mLock);
+
+    /* Closed while writing to the device */
+    if (remaining && !mRing) {
+        ALOGE("%s: port is not open", getName());
+        return -ENODEV;
+    }
+
+    /* A stop() only aborts the write in progress, the next one blocks again */
+    size_t ringFrames = remaining;
+    while (remaining && (stopCount == mStopCount)) {
+        uint32_t written = mRing->write(data, remaining);
+        data += mParams.framesToBytes(written);
+        remaining -= written;
+
+        if (remaining && !written &&
+            (mSpaceCond.waitRelative(mLock, timeout) == TIMED_OUT)) {
+            ALOGE("%s: timeout waiting for free space", getName());
+            return -ETIMEDOUT;
+        }
+    }
+
+    mFramesWritten += ringFrames - remaining;
+
+    return frames;
+}
+
+/*
+ * Write straight to the device for as long as the mixer hands it over to
+ * this port, see AudioPortMixer::writeDirect(). The frames left, if any,
+ * go through the ring.
+ *
+ * must be called without mLock, the mixer's lock is taken first
+ */
+int AudioOutPort::writeDirect(const uint8_t *&data, size_t &remaining, uint32_t stopCount,
+                              nsecs_t timeout)
+{
+    const PcmParams &hwParams = mMixer->getParams();
+    uint32_t periodUs = (hwParams.frameCount * 1000000ULL) / hwParams.sampleRate;
+    nsecs_t waited = 0;
+
+    while (remaining) {
+        uint64_t hwFrames;
+        int ret = mMixer->writeDirect(this, (const int16_t *)data, remaining, hwFrames);
+        if (ret < 0)
+            break;
+
+        AutoMutex lock(mLock);
+
+        if (ret) {
+            mFramesWritten += ret;
+            mFramesMixed += ret;
+            mHwFramesEnd = hwFrames + ret;
+            data += mParams.framesToBytes(ret);
+            remaining -= ret;
+            waited = 0;
+        }
+
+        if (stopCount != mStopCount)
+            break;
+
+        /* Kernel buffer is full, wait for the device to free a period */
+        if (remaining && !ret) {
+            if (waited >= timeout) {
+                ALOGE("%s: timeout waiting for free space in the device", getName());
+                return -ETIMEDOUT;
+            }
+            mLock.unlock();
+            usleep(periodUs);
+            mLock.lock();
+            waited += periodUs * 1000LL;
+        }
+    }
+
+    return 0;
+}
+
+int AudioOutPort::start()
+{
+    /* Data is pulled by the mixer as soon as the port is open */
+    return 0;
+}
+
+int AudioOutPort::stop()
+{
+    ALOGV("%s: stop", getName());
+
+    /* Unblock a pending write and the device itself */
+    mLock.lock();
+    mStopCount++;
+    mSpaceCond.broadcast();
+    mLock.unlock();
+
+    return mMixer->stop();
+}
+
+void AudioOutPort::setZoneTarget(uint32_t zone, int32_t gain, uint32_t rampFrames,
+                                 uint32_t delayFrames)
+{
+    AutoMutex lock(mLock);
+
+    if (zone < mZoneGains.getZones())
+        mZoneGains.setTarget(zone, gain, rampFrames, delayFrames);
+}
+
+/*
+ * Accumulate the next frames through the zone gains. If 'onsets' is given,
+ * the first frame with signal in each zone is reported too, before gain.
+ * The frames play from device frame 'hwFrames' over 'hwSpan' device frames,
+ * which differs from 'frames' while the mixer compensates the drift.
+ */
+uint32_t AudioOutPort::mix(int32_t *acc, uint32_t frames, uint64_t hwFrames, uint32_t hwSpan,
+                           uint32_t *onsets)
+{
+    AutoMutex lock(mLock);
+
+    if (!mRing)
+        return 0;
+
+    uint32_t requested = frames;
+    uint32_t avail = mRing->availableToRead();
+    if (avail < frames) {
+        /* Nothing written yet is not an underrun, the writer is starting */
+        if (mFramesWritten)
+            mUnderruns++;
+        frames = avail;
+    }
+
+    /* A null accumulator discards the data, e.g. master mute */
+    uint32_t done = 0;
+    while (done < frames) {
+        BufferProvider::Buffer buffer;
+        buffer.frameCount = frames - done;
+        mRing->getNextBuffer(&buffer);
+        if (acc) {
+            mZoneGains.accumulate(acc + done * mParams.channels, (const int16_t *)buffer.raw,
+                                  buffer.frameCount);
+        }
+        if (onsets) {
+            findOnsetsQ15((const int16_t *)buffer.raw, buffer.frameCount, mParams.channels,
+                          AudioPortMixer::kDuckThreshold, done, onsets);
+        }
+        done += buffer.frameCount;
+        mRing->releaseBuffer(&buffer);
+    }
+
+    /* Data is placed at the start of the device period, in the device's timeline */
+    mFramesMixed += frames;
+    if (frames == requested)
+        mHwFramesEnd = hwFrames + hwSpan;
+    else
+        mHwFramesEnd = hwFrames + ((uint64_t)frames * hwSpan) / requested;
+
+    mSpaceCond.signal();
+
+    return frames;
+}
+
+void AudioOutPort::addSlots(uint32_t slotMask)
+{
+    AutoMutex lock(mLock);
+
+    for (uint32_t slot = 0; slot < kMaxSlots; slot++) {
+        if (slotMask & (1 << slot))
+            mSlotUsers[slot]++;
+    }
+}
+
+void AudioOutPort::removeSlots(uint32_t slotMask)
+{
+    AutoMutex lock(mLock);
+
+    for (uint32_t slot = 0; slot < kMaxSlots; slot++) {
+        if ((slotMask & (1 << slot)) && mSlotUsers[slot])
+            mSlotUsers[slot]--;
+    }
+}
+
+uint32_t AudioOutPort::getSlotMask() const
+{
+    AutoMutex lock(mLock);
+    uint32_t mask = 0;
+
+    for (uint32_t slot = 0; slot < kMaxSlots; slot++) {
+        if (mSlotUsers[slot])
+            mask |= 1 << slot;
+    }
+
+    return mask;
+}
+
+uint32_t AudioOutPort::getSampleRate() const
+{
+    AutoMutex lock(mLock);
+    return mParams.sampleRate;
+}
+
+uint32_t AudioOutPort::getPeriodFrames() const
+{
+    AutoMutex lock(mLock);
+    return mParams.frameCount;
+}
+
+uint64_t AudioOutPort::getFramesWritten() const
+{
+    AutoMutex lock(mLock);
+    return mFramesWritten;
+}
+
+uint32_t AudioOutPort::getQueuedFrames() const
+{
+    AutoMutex lock(mLock);
+    return mRing ? mRing->availableToRead() : 0;
+}
+
+bool AudioOutPort::isUnityGain() const
+{
+    AutoMutex lock(mLock);
+    return mZoneGains.isUnity();
+}
+
+uint32_t AudioOutPort::getUnderruns() const
+{
+    AutoMutex lock(mLock);
+    return mUnderruns;
+}
+
+int AudioOutPort::getPresentedFrames(uint64_t &frames, struct timespec &ts) const
+{
+    uint64_t hwFrames;
+
+    mMixer->getPresentedFrames(hwFrames, ts);
+
+    AutoMutex lock(mLock);
+
+    /* Frames of this port still queued in the kernel buffer */
+    uint64_t queued = (mHwFramesEnd > hwFrames) ? (mHwFramesEnd - hwFrames) : 0;
+    uint64_t presented = (mFramesMixed > queued) ? (mFramesMixed - queued) : 0;
+    if (presented > mLastPresented)
+        mLastPresented = presented;
+
+    frames = mLastPresented;
+
+    ALOGVV("%s: presented %llu frames at %ld.%09ld", getName(),
+           frames, ts.tv_sec, ts.tv_nsec);
+
+    return 0;
+}
+
+}; // namespace android
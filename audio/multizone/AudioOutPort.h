@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUDIO_OUT_PORT_H_
+#define _AUDIO_OUT_PORT_H_
+
+#include <time.h>
+#include <string>
+
+#include <utils/threads.h>
+
+#include <tiaudioutils/Pcm.h>
+#include <tiaudioutils/Base.h>
+
+#include <AudioDsp.h>
+#include <AudioRing.h>
+#include <AudioPortMixer.h>
+
+namespace android {
+
+using namespace tiaudioutils;
+using std::string;
+
+/**
+ * Playback port used by the multizone PCM writers. Several ports can
+ * share the same ALSA device, each with its own period size: the data
+ * written to the port goes into a ring that is drained by the device's
+ * AudioPortMixer. The port keeps track of the frames written and mixed
+ * so that the presentation position of the streams can be reported
+ * against CLOCK_MONOTONIC hardware timestamps.
+ *
+ * Ports sharing a device have a priority: a port with signal in a zone
+ * ducks the lower priority ports in the same zone, see AudioPortMixer.
+ */
+class AudioOutPort : public PcmOutPort {
+ public:
+    AudioOutPort(AudioPortMixer *mixer, const char *profile, uint32_t priority = 0);
+    virtual ~AudioOutPort();
+
+    /* From PcmOutPort */
+    virtual const char *getName() const { return mName.c_str(); }
+    virtual int getCardId() const { return mMixer->getCardId(); }
+    virtual int getPortId() const { return mMixer->getPortId(); }
+    virtual int open(const PcmParams &params);
+    virtual void close();
+    virtual bool isOpen() const;
+    virtual int write(const void *buffer, size_t frames);
+    virtual int start();
+    virtual int stop();
+
+    /* AudioOutPort specific */
+    uint32_t getSampleRate() const;
+    uint32_t getPeriodFrames() const;
+    uint64_t getFramesWritten() const;
+    uint32_t getUnderruns() const;
+    int getPresentedFrames(uint64_t &frames, struct timespec &ts) const;
+    uint32_t getPriority() const { return mPriority; }
+    uint32_t getQueuedFrames() const;
+    bool isUnityGain() const;
+
+    /* Slots fed by the active streams of the port's writer */
+    void addSlots(uint32_t slotMask);
+    void removeSlots(uint32_t slotMask);
+    uint32_t getSlotMask() const;
+
+    /* Called by the AudioPortMixer's render thread */
+    void setZoneTarget(uint32_t zone, int32_t gain, uint32_t rampFrames, uint32_t delayFrames);
+    uint32_t mix(int32_t *acc, uint32_t frames, uint64_t hwFrames, uint32_t hwSpan,
+                 uint32_t *onsets = NULL);
+
+    static const uint32_t kRingPeriods = 2;
+    static const uint32_t kMaxSlots = 32;
+
+ protected:
+    int writeDirect(const uint8_t *&data, size_t &remaining, uint32_t stopCount,
+                    nsecs_t timeout);
+
+    AudioPortMixer *mMixer;
+    string mName;
+    PcmParams mParams;
+    AudioRing *mRing;
+    uint32_t mPriority;
+    ZoneGains mZoneGains;
+    uint32_t mSlotUsers[kMaxSlots];
+    uint64_t mFramesWritten;
+    uint64_t mFramesMixed;
+    uint64_t mHwFramesEnd;
+    mutable uint64_t mLastPresented;
+    uint32_t mUnderruns;
+    uint32_t mStopCount;
+    Condition mSpaceCond;
+    mutable Mutex mLock;
+};
+
+}; // namespace android
+
+#endif /* _AUDIO_OUT_PORT_H_ */
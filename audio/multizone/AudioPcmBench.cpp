@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Throughput benchmark of the MMAP and write paths of the port mixer. The
+ * mixer's period (mix, saturation and write or commit) runs back to back
+ * on a HostPcmDevice, without the render thread's pacing, so no codec is
+ * needed. The host stand-in has no syscall, the write path only pays its
+ * extra copy here.
+ *
+ * Usage: multizone_pcmbench [periods]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <AudioPcmDevice.h>
+#include <AudioPortMixer.h>
+
+using namespace android;
+
+/* Same as the CPU and JAMR3 ports of AudioHwDevice */
+struct PortConfig {
+    const char *name;
+    uint32_t channels;
+    uint32_t sampleRate;
+};
+
+static const PortConfig kPorts[] = {
+    { "cpu", 2, 44100 },
+    { "jamr3", 8, 48000 },
+};
+
+static const uint32_t kSampleBits = 16;
+static const uint32_t kMixerFrames = 256;
+
+/* The render thread's period, run on the caller's thread */
+class BenchMixer : public AudioPortMixer {
+ public:
+    BenchMixer(AudioPcmDevice *pcm, const PcmParams &params)
+        : AudioPortMixer(pcm, params) {}
+
+    /*
+     * The device is stopped whenever it's full, which drops what it holds,
+     * so the loop never waits for the hardware pointer
+     */
+    int run(uint32_t periods)
+    {
+        AutoMutex lock(mLock);
+
+        int ret = mPcm->open(mParams, kPeriodCount);
+        if (ret)
+            return ret;
+        mBufferFrames = mPcm->getBufferFrames();
+
+        for (uint32_t i = 0; i < periods; i++) {
+            struct timespec ts;
+            uint32_t avail;
+
+            if (!getAvail(avail, ts) && (avail < mParams.frameCount))
+                mPcm->stop();
+
+            ret = writePeriod(mParams.frameCount);
+            if (ret)
+                break;
+        }
+
+        mPcm->close();
+
+        return ret;
+    }
+};
+
+static int64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Nanoseconds per period, negative errno on failure */
+static double run(const PortConfig &port, bool mmap, uint32_t periods)
+{
+    PcmParams params(port.channels, kSampleBits, port.sampleRate, kMixerFrames);
+    BenchMixer mixer(new HostPcmDevice(0, 0, mmap), params);
+
+    /* Warm up the caches and the mixer's buffers */
+    int ret = mixer.run(periods / 10);
+    if (ret)
+        return ret;
+
+    int64_t start = now();
+    ret = mixer.run(periods);
+    if (ret)
+        return ret;
+
+    return (double)(now() - start) / periods;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t periods = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000000;
+    uint32_t count = sizeof(kPorts) / sizeof(kPorts[0]);
+
+    printf("%u frames per period, %u periods per run\n", kMixerFrames, periods);
+
+    for (uint32_t i = 0; i < count; i++) {
+        double writeNs = run(kPorts[i], false, periods);
+        double mmapNs = run(kPorts[i], true, periods);
+        if ((writeNs < 0) || (mmapNs < 0)) {
+            fprintf(stderr, "failed to run the %s port\n", kPorts[i].name);
+            return 1;
+        }
+
+        /* Real time is one period every frames / rate */
+        double periodNs = kMixerFrames * 1000000000.0 / kPorts[i].sampleRate;
+        printf("%-6s %u ch %u Hz: write %7.0f ns/period (%6.0fx real time), "
+               "mmap %7.0f ns/period (%6.0fx real time), mmap %.2fx faster\n",
+               kPorts[i].name, kPorts[i].channels, kPorts[i].sampleRate,
+               writeNs, periodNs / writeNs, mmapNs, periodNs / mmapNs, writeNs / mmapNs);
+    }
+
+    return 0;
+}
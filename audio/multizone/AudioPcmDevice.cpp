@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioPcmDevice"
+// #define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include <AudioPcmDevice.h>
+
+namespace android {
+
+AudioPcmDevice::AudioPcmDevice(uint32_t card, uint32_t port, bool mmap)
+    : mCardId(card), mPortId(port), mMmap(mmap)
+{
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+AlsaPcmDevice::AlsaPcmDevice(uint32_t card, uint32_t port, bool mmap)
+    : AudioPcmDevice(card, port, mmap), mPcm(NULL), mChannels(0),
+      mBufferFrames(0), mOffset(0), mRunning(false)
+{
+}
+
+AlsaPcmDevice::~AlsaPcmDevice()
+{
+    if (isOpen())
+        close();
+}
+
+int AlsaPcmDevice::open(const PcmParams &params, uint32_t periods)
+{
+    struct pcm_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.channels = params.channels;
+    config.rate = params.sampleRate;
+    config.format = PCM_FORMAT_S16_LE;
+    config.period_size = params.frameCount;
+    config.period_count = periods;
+    config.stop_threshold = params.frameCount * periods;
+    config.avail_min = params.frameCount;
+
+    /* MMAP devices are started explicitly once the first period is committed */
+    config.start_threshold = mMmap ? config.stop_threshold : params.frameCount;
+
+    /* Monotonic timestamps are needed for the presentation position */
+    unsigned int flags = PCM_OUT | PCM_MONOTONIC;
+    if (mMmap)
+        flags |= PCM_MMAP;
+
+    struct pcm *pcm = pcm_open(mCardId, mPortId, flags, &config);
+    if (!pcm_is_ready(pcm)) {
+        ALOGE("AlsaPcmDevice: failed to open hw:%u,%u: %s",
+              mCardId, mPortId, pcm_get_error(pcm));
+        pcm_close(pcm);
+        return -ENODEV;
+    }
+
+    mPcm = pcm;
+    mChannels = params.channels;
+    mBufferFrames = pcm_get_buffer_size(mPcm);
+    mRunning = false;
+
+    return 0;
+}
+
+void AlsaPcmDevice::close()
+{
+    if (mPcm) {
+        pcm_close(mPcm);
+        mPcm = NULL;
+    }
+    mRunning = false;
+}
+
+int AlsaPcmDevice::getAvail(uint32_t &avail, struct timespec &ts)
+{
+    unsigned int hwAvail;
+
+    /* Fails if the PCM is not running yet (e.g. start threshold not reached) */
+    if (pcm_get_htimestamp(mPcm, &hwAvail, &ts))
+        return -EAGAIN;
+
+    avail = hwAvail;
+
+    return 0;
+}
+
+int AlsaPcmDevice::write(const int16_t *buffer, uint32_t frames)
+{
+    int ret = pcm_write(mPcm, buffer, pcm_frames_to_bytes(mPcm, frames));
+    if (ret) {
+        ALOGE("AlsaPcmDevice: failed to write %u frames: %s", frames, pcm_get_error(mPcm));
+        return -EIO;
+    }
+
+    return 0;
+}
+
+int AlsaPcmDevice::mmapBegin(int16_t *&area, uint32_t &frames)
+{
+    unsigned int hwAvail;
+    struct timespec ts;
+
+    /* Device stops on underrun, it has to be prepared and started again */
+    if (mRunning && pcm_get_htimestamp(mPcm, &hwAvail, &ts)) {
+        ALOGW("AlsaPcmDevice: hw:%u,%u underrun", mCardId, mPortId);
+        mRunning = false;
+    }
+
+    if (!mRunning && pcm_prepare(mPcm)) {
+        ALOGE("AlsaPcmDevice: failed to prepare: %s", pcm_get_error(mPcm));
+        return -EIO;
+    }
+
+    void *areas;
+    unsigned int offset;
+    unsigned int avail = frames;
+
+    /* Contiguous frames available at the application pointer */
+    if (pcm_mmap_begin(mPcm, &areas, &offset, &avail) < 0) {
+        ALOGE("AlsaPcmDevice: failed to begin mmap: %s", pcm_get_error(mPcm));
+        return -EIO;
+    }
+
+    area = (int16_t *)areas + offset * mChannels;
+    frames = avail;
+    mOffset = offset;
+
+    return 0;
+}
+
+int AlsaPcmDevice::mmapCommit(uint32_t frames)
+{
+    if (pcm_mmap_commit(mPcm, mOffset, frames) < 0) {
+        ALOGE("AlsaPcmDevice: failed to commit %u frames: %s", frames, pcm_get_error(mPcm));
+        return -EIO;
+    }
+
+    if (!mRunning) {
+        if (pcm_start(mPcm)) {
+            ALOGE("AlsaPcmDevice: failed to start: %s", pcm_get_error(mPcm));
+            return -EIO;
+        }
+        mRunning = true;
+    }
+
+    return 0;
+}
+
+int AlsaPcmDevice::stop()
+{
+    /* Not locked on purpose, it must be able to unblock a pending write */
+    mRunning = false;
+
+    if (mPcm)
+        pcm_stop(mPcm);
+
+    return 0;
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+HostPcmDevice::HostPcmDevice(uint32_t card, uint32_t port, bool mmap)
+    : AudioPcmDevice(card, port, mmap), mChannels(0), mRate(0), mBufferFrames(0),
+      mApplFrames(0), mStartFrames(0), mRunning(false)
+{
+    memset(&mStartTs, 0, sizeof(mStartTs));
+}
+
+int HostPcmDevice::open(const PcmParams &params, uint32_t periods)
+{
+    mChannels = params.channels;
+    mRate = params.sampleRate;
+    mBufferFrames = params.frameCount * periods;
+    mBuffer.resize(mBufferFrames * mChannels);
+    mApplFrames = 0;
+    mStartFrames = 0;
+    mRunning = false;
+
+    return 0;
+}
+
+void HostPcmDevice::close()
+{
+    mRunning = false;
+    mBuffer.clear();
+}
+
+/* Hardware pointer, it doesn't move while the device is stopped */
+uint64_t HostPcmDevice::getHwFrames(struct timespec &ts) const
+{
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    if (!mRunning)
+        return mStartFrames;
+
+    int64_t ns = (ts.tv_sec - mStartTs.tv_sec) * 1000000000LL +
+                 (ts.tv_nsec - mStartTs.tv_nsec);
+
+    return mStartFrames + (ns * mRate) / 1000000000LL;
+}
+
+int HostPcmDevice::getAvail(uint32_t &avail, struct timespec &ts)
+{
+    if (!mRunning)
+        return -EAGAIN;
+
+    uint64_t hwFrames = getHwFrames(ts);
+
+    /* Stops on underrun, queued data is dropped as with ALSA */
+    if (hwFrames > mApplFrames) {
+        ALOGW("HostPcmDevice: hw:%u,%u underrun", mCardId, mPortId);
+        stop();
+        return -EAGAIN;
+    }
+
+    avail = mBufferFrames - (uint32_t)(mApplFrames - hwFrames);
+
+    return 0;
+}
+
+int HostPcmDevice::write(const int16_t *buffer, uint32_t frames)
+{
+    while (frames) {
+        int16_t *area;
+        uint32_t n = frames;
+
+        int ret = mmapBegin(area, n);
+        if (ret)
+            return ret;
+
+        /* Blocks like ALSA until the hardware pointer frees enough room */
+        if (!n) {
+            usleep((frames * 1000000ULL) / mRate);
+            continue;
+        }
+
+        memcpy(area, buffer, n * mChannels * sizeof(int16_t));
+        buffer += n * mChannels;
+        frames -= n;
+
+        ret = mmapCommit(n);
+        if (ret)
+            return ret;
+    }
+
+    return 0;
+}
+
+int HostPcmDevice::mmapBegin(int16_t *&area, uint32_t &frames)
+{
+    uint32_t avail;
+    struct timespec ts;
+
+    if (getAvail(avail, ts))
+        avail = mBufferFrames - (uint32_t)(mApplFrames - mStartFrames);
+
+    uint32_t offset = mApplFrames % mBufferFrames;
+    uint32_t contig = mBufferFrames - offset;
+
+    if (frames > avail)
+        frames = avail;
+    if (frames > contig)
+        frames = contig;
+
+    area = &mBuffer[offset * mChannels];
+
+    return 0;
+}
+
+int HostPcmDevice::mmapCommit(uint32_t frames)
+{
+    mApplFrames += frames;
+
+    if (!mRunning) {
+        clock_gettime(CLOCK_MONOTONIC, &mStartTs);
+        mRunning = true;
+    }
+
+    return 0;
+}
+
+int HostPcmDevice::stop()
+{
+    /* Queued frames are dropped, the pointer restarts from the last write */
+    mRunning = false;
+    mStartFrames = mApplFrames;
+
+    return 0;
+}
+
+}; // namespace android
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUDIO_PCM_DEVICE_H_
+#define _AUDIO_PCM_DEVICE_H_
+
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include <tinyalsa/asoundlib.h>
+
+#include <tiaudioutils/Base.h>
+
+namespace android {
+
+using namespace tiaudioutils;
+using std::string;
+using std::vector;
+
+/**
+ * Playback device driven by an AudioPortMixer. Data is either copied with
+ * write(), or mixed in place into the hardware buffer between mmapBegin()
+ * and mmapCommit() when the device is in MMAP mode.
+ *
+ * Only the stop() can be called concurrently with the other methods.
+ */
+class AudioPcmDevice {
+ public:
+    AudioPcmDevice(uint32_t card, uint32_t port, bool mmap);
+    virtual ~AudioPcmDevice() {}
+
+    uint32_t getCardId() const { return mCardId; }
+    uint32_t getPortId() const { return mPortId; }
+    bool isMmap() const { return mMmap; }
+    virtual const char *getType() const = 0;
+
+    virtual int open(const PcmParams &params, uint32_t periods) = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() const = 0;
+    virtual uint32_t getBufferFrames() const = 0;
+    virtual int getAvail(uint32_t &avail, struct timespec &ts) = 0;
+    virtual int write(const int16_t *buffer, uint32_t frames) = 0;
+    virtual int mmapBegin(int16_t *&area, uint32_t &frames) = 0;
+    virtual int mmapCommit(uint32_t frames) = 0;
+    virtual int stop() = 0;
+
+ protected:
+    uint32_t mCardId;
+    uint32_t mPortId;
+    bool mMmap;
+};
+
+/**
+ * ALSA device through tinyalsa. In MMAP mode the device is started by
+ * hand once the first period is committed, and re-prepared after an
+ * underrun or a stop.
+ */
+class AlsaPcmDevice : public AudioPcmDevice {
+ public:
+    AlsaPcmDevice(uint32_t card, uint32_t port, bool mmap = false);
+    virtual ~AlsaPcmDevice();
+
+    virtual const char *getType() const { return mMmap ? "ALSA mmap" : "ALSA write"; }
+
+    virtual int open(const PcmParams &params, uint32_t periods);
+    virtual void close();
+    virtual bool isOpen() const { return mPcm != NULL; }
+    virtual uint32_t getBufferFrames() const { return mBufferFrames; }
+    virtual int getAvail(uint32_t &avail, struct timespec &ts);
+    virtual int write(const int16_t *buffer, uint32_t frames);
+    virtual int mmapBegin(int16_t *&area, uint32_t &frames);
+    virtual int mmapCommit(uint32_t frames);
+    virtual int stop();
+
+ protected:
+    struct pcm *mPcm;
+    uint32_t mChannels;
+    uint32_t mBufferFrames;
+    unsigned int mOffset;
+    volatile bool mRunning;
+};
+
+/**
+ * Stand-in for an ALSA device that needs no hardware, e.g. to benchmark
+ * the write and MMAP paths on a host or on a board without codec. The
+ * hardware pointer advances with CLOCK_MONOTONIC at the device's rate,
+ * consuming the data from a memory buffer.
+ */
+class HostPcmDevice : public AudioPcmDevice {
+ public:
+    HostPcmDevice(uint32_t card, uint32_t port, bool mmap = false);
+    virtual ~HostPcmDevice() {}
+
+    virtual const char *getType() const { return mMmap ? "host mmap" : "host write"; }
+
+    virtual int open(const PcmParams &params, uint32_t periods);
+    virtual void close();
+    virtual bool isOpen() const { return !mBuffer.empty(); }
+    virtual uint32_t getBufferFrames() const { return mBufferFrames; }
+    virtual int getAvail(uint32_t &avail, struct timespec &ts);
+    virtual int write(const int16_t *buffer, uint32_t frames);
+    virtual int mmapBegin(int16_t *&area, uint32_t &frames);
+    virtual int mmapCommit(uint32_t frames);
+    virtual int stop();
+
+ protected:
+    uint64_t getHwFrames(struct timespec &ts) const;
+
+    vector<int16_t> mBuffer;
+    uint32_t mChannels;
+    uint32_t mRate;
+    uint32_t mBufferFrames;
+    uint64_t mApplFrames;
+    uint64_t mStartFrames;
+    struct timespec mStartTs;
+    volatile bool mRunning;
+};
+
+}; // namespace android
+
+#endif /* _AUDIO_PCM_DEVICE_H_ */
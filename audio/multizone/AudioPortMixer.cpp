@@ -0,0 +1,1446 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioPortMixer"
+// #define LOG_NDEBUG 0
+// #define VERY_VERBOSE_LOGGING
+#ifdef VERY_VERBOSE_LOGGING
+#define ALOGVV ALOGV
+#else
+#define ALOGVV(...) do { } while(0)
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <system/thread_defs.h>
+
+#include <AudioPortMixer.h>
+#include <AudioOutPort.h>
+
+namespace android {
+
+AudioPortMixer::AudioPortMixer(AudioPcmDevice *pcm, const PcmParams &params,
+                               const MasterVolume *master)
+    : mCardId(pcm->getCardId()), mPortId(pcm->getPortId()), mParams(params),
+      mMaster(master), mPcm(pcm), mBufferFrames(0), mFramesWritten(0), mLastPresented(0),
+      mMasterGain(GainRamp::kUnityQ30), mDuckGain(GainRamp::kUnityQ30 / 4), mDucks(0),
+      mSharedPeriods(0), mStartState(START_NONE), mStartDeadline(0), mStartFrame(0),
+      mStartError(0), mDriftOn(false), mDriftComp(false), mClockRef(NULL), mDriftAnchored(false),
+      mAnchorNs(0), mAnchorFrames(0), mAnchorContent(0.0), mAnchorRefPhaseUs(0),
+      mPhaseBaseUs(0), mWindowNs(0), mWindowPhase(0.0), mClockPpm(0.0), mClockValid(false),
+      mSkewFrames(0.0), mInFramesMixed(0), mReanchors(0), mClockPpb(0), mClockPhaseUs(0),
+      mActiveChimes(0), mChimesPlayed(0), mChimeOpen(false), mChimeEnd(0),
+      mLimiterOn(false), mDirectInput(NULL), mBypass(false), mDirectOwned(false),
+      mHandovers(0), mTakebacks(0), mWakeups("wakeups"), mPeriods("periods"),
+      mDirectWrites("direct writes"),
+      mRenderStats("period mix + write")
+{
+    char name[32];
+    snprintf(name, sizeof(name), "AudioPortMixer hw:%u,%u", mCardId, mPortId);
+    mName = string(name);
+
+    mMixBuffer.resize(mParams.frameCount * mParams.channels);
+    mOutBuffer.resize(mParams.frameCount * mParams.channels);
+
+    ZoneState zone = { 0, 0 };
+    mZones.resize(mParams.channels / 2, zone);
+    mActive.resize(mZones.size());
+    mOnsets.resize(mZones.size());
+    mInputOnsets.resize(mZones.size());
+
+    mHeadroom.resize(mParams.channels, HEADROOM_NONE);
+    mSlotInputs.resize(mParams.channels);
+    mSlotGains.resize(mParams.channels, GainRamp::kUnityQ30);
+    mSlotTargets.resize(mParams.channels, GainRamp::kUnityQ30);
+    mSlotSteps.resize(mParams.channels);
+    mGainsQ31.resize(mParams.channels);
+
+    mEq.setChannels(mParams.channels);
+    mEq.setSampleRate(mParams.sampleRate);
+    mLimiter.setChannels(mParams.channels);
+    mLimiter.setSampleRate(mParams.sampleRate);
+    mResampler.setChannels(mParams.channels, mParams.frameCount);
+
+    mChimes.resize(kMaxChimes);
+}
+
+AudioPortMixer::~AudioPortMixer()
+{
+    if (isOpen())
+        close();
+
+    delete mPcm;
+}
+
+int AudioPortMixer::attach(AudioOutPort *input)
+{
+    ALOGV("%s: attach %s", getName(), input->getName());
+
+    AutoMutex openLock(mOpenLock);
+
+    mLock.lock();
+    for (InputVect::iterator i = mInputs.begin(); i != mInputs.end(); ++i) {
+        if (*i == input) {
+            mLock.unlock();
+            ALOGE("%s: %s is already attached", getName(), input->getName());
+            return -EBUSY;
+        }
+    }
+    /* Open already if chimes play alone, they don't close it anymore */
+    bool closed = !mPcm->isOpen();
+    mChimeOpen = false;
+    mLock.unlock();
+
+    if (closed) {
+        int ret = open();
+        if (ret)
+            return ret;
+    }
+
+    /* Kept sorted by priority, higher priority inputs are mixed first */
+    AutoMutex lock(mLock);
+    InputVect::iterator pos = mInputs.begin();
+    while ((pos != mInputs.end()) && ((*pos)->getPriority() >= input->getPriority()))
+        ++pos;
+    mInputs.insert(pos, input);
+    updateBypass();
+
+    return 0;
+}
+
+void AudioPortMixer::detach(AudioOutPort *input)
+{
+    ALOGV("%s: detach %s", getName(), input->getName());
+
+    AutoMutex openLock(mOpenLock);
+
+    mLock.lock();
+    for (InputVect::iterator i = mInputs.begin(); i != mInputs.end(); ++i) {
+        if (*i == input) {
+            mInputs.erase(i);
+            break;
+        }
+    }
+    updateBypass();
+    bool last = mInputs.empty();
+
+    /* The render thread closes the device once the chimes are over */
+    if (last && mActiveChimes) {
+        mChimeOpen = true;
+        last = false;
+    }
+    mLock.unlock();
+
+    if (last)
+        close();
+}
+
+/* Rate can be changed only while the device is closed */
+int AudioPortMixer::setSampleRate(uint32_t rate)
+{
+    ALOGV("%s: set sample rate %u Hz", getName(), rate);
+
+    AutoMutex openLock(mOpenLock);
+    AutoMutex lock(mLock);
+
+    if (mPcm->isOpen()) {
+        ALOGE("%s: can't change the rate while open", getName());
+        return -EBUSY;
+    }
+
+    mParams.sampleRate = rate;
+    mEq.setSampleRate(rate);
+    mLimiter.setSampleRate(rate);
+
+    return 0;
+}
+
+/* Gain of the ducked inputs, 1.0 disables the ducking */
+void AudioPortMixer::setDuckGain(float gain)
+{
+    ALOGV("%s: set duck gain %.4f", getName(), gain);
+
+    AutoMutex lock(mLock);
+
+    if (gain <= 0.0f)
+        mDuckGain = 0;
+    else if (gain >= 1.0f)
+        mDuckGain = GainRamp::kUnityQ30;
+    else
+        mDuckGain = (int32_t)(gain * GainRamp::kUnityQ30);
+}
+
+void AudioPortMixer::setHeadroom(uint32_t slotMask, Headroom headroom)
+{
+    ALOGV("%s: set headroom %d for slots 0x%x", getName(), headroom, slotMask);
+
+    AutoMutex lock(mLock);
+
+    for (uint32_t slot = 0; slot < mHeadroom.size(); slot++) {
+        if (slotMask & (1 << slot))
+            mHeadroom[slot] = headroom;
+    }
+}
+
+/* EQ of the zones of the slots, no sections to remove it */
+int AudioPortMixer::setZoneEq(uint32_t slotMask, const vector<BiquadSpec> &specs)
+{
+    ALOGV("%s: set %u EQ sections for slots 0x%x", getName(), specs.size(), slotMask);
+
+    AutoMutex lock(mLock);
+
+    for (uint32_t zone = 0; zone < mParams.channels / 2; zone++) {
+        if (!(slotMask & (3 << (2 * zone))))
+            continue;
+        int ret = mEq.setZone(zone, specs);
+        if (ret) {
+            ALOGE("%s: invalid EQ for zone %u", getName(), zone);
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+void AudioPortMixer::setLimiter(bool enabled, float thresholdDb)
+{
+    ALOGV("%s: limiter %s at %.1f dBFS", getName(), enabled ? "on" : "off", thresholdDb);
+
+    AutoMutex lock(mLock);
+
+    mLimiter.setThreshold(thresholdDb);
+    mLimiter.setEnabled(enabled && !mBypass);
+    mLimiterOn = enabled;
+}
+
+/* Input whose content must stay bit-exact when it plays alone */
+void AudioPortMixer::setDirectInput(const AudioOutPort *input)
+{
+    ALOGV("%s: direct input %s", getName(), input ? input->getName() : "none");
+
+    AutoMutex lock(mLock);
+
+    mDirectInput = input;
+    updateBypass();
+}
+
+/*
+ * Hold the inputs until the CLOCK_MONOTONIC deadline. Inputs that are
+ * already running are paused until then too, so it's meant for ports
+ * that are idle or just being started.
+ */
+void AudioPortMixer::startAt(int64_t deadlineNs)
+{
+    ALOGV("%s: start at %lld ns", getName(), deadlineNs);
+
+    AutoMutex lock(mLock);
+
+    mStartDeadline = deadlineNs;
+    mStartState = START_ARMED;
+}
+
+/* Presentation time of the last synchronized start minus its deadline */
+int AudioPortMixer::getStartError(int64_t &errorNs) const
+{
+    AutoMutex lock(mLock);
+
+    if (mStartState != START_DONE)
+        return -EAGAIN;
+
+    errorNs = mStartError;
+
+    return 0;
+}
+
+void AudioPortMixer::setDriftCompensation(bool enabled)
+{
+    ALOGV("%s: drift compensation %s", getName(), enabled ? "on" : "off");
+
+    AutoMutex lock(mLock);
+
+    mDriftOn = enabled;
+    enabled = enabled && !mBypass;
+    if (enabled && !mDriftComp)
+        mResampler.reset();
+    mDriftComp = enabled;
+    resetDrift();
+}
+
+/* Clock the content follows, NULL for CLOCK_MONOTONIC */
+void AudioPortMixer::setClockReference(const AudioPortMixer *reference)
+{
+    ALOGV("%s: clock reference %s", getName(), reference ? reference->getName() : "monotonic");
+
+    AutoMutex lock(mLock);
+
+    if (reference == this)
+        reference = NULL;
+    if (reference != mClockRef) {
+        mClockRef = reference;
+        resetDrift();
+    }
+}
+
+/*
+ * Play a chime in the zones of the slots, 'loops' times or until stopped
+ * if 0. A loop starts every 'periodMs', or right after the previous one
+ * if the clip is longer. The first loop starts 'delayMs' after now as
+ * presented by the device, or with the next period written if 0. The
+ * chime must have been prepared for the port's rate.
+ *
+ * The device is opened if no input keeps it open.
+ */
+int AudioPortMixer::playChime(const sp<AudioChime> &chime, uint32_t slotMask,
+                              uint32_t loops, uint32_t periodMs, float gainDb,
+                              uint32_t delayMs)
+{
+    ALOGV("%s: play chime '%s' in slots 0x%x, %u loops every %u ms, %.1f dB in %u ms",
+          getName(), chime->getName(), slotMask, loops, periodMs, gainDb, delayMs);
+
+    AutoMutex openLock(mOpenLock);
+
+    mLock.lock();
+    uint32_t frames;
+    const int16_t *pcm = chime->getPcm(mParams.sampleRate, frames);
+    if (!pcm) {
+        mLock.unlock();
+        ALOGE("%s: chime '%s' is not prepared for %u Hz", getName(), chime->getName(),
+              mParams.sampleRate);
+        return -EINVAL;
+    }
+    if (mActiveChimes == kMaxChimes) {
+        mLock.unlock();
+        ALOGE("%s: no voice left for chime '%s'", getName(), chime->getName());
+        return -EBUSY;
+    }
+
+    /* Voice reserved, the render thread can't close the device meanwhile */
+    mActiveChimes++;
+    bool closed = !mPcm->isOpen();
+    mLock.unlock();
+
+    if (closed) {
+        int ret = open();
+        if (ret) {
+            AutoMutex lock(mLock);
+            mActiveChimes--;
+            return ret;
+        }
+    }
+
+    AutoMutex lock(mLock);
+
+    ChimeVect::iterator voice = mChimes.begin();
+    while (voice->chime != NULL)
+        ++voice;
+
+    uint32_t period = (periodMs * mParams.sampleRate) / 1000;
+    uint64_t start = mFramesWritten;
+    uint32_t delay = (delayMs * mParams.sampleRate) / 1000;
+    struct timespec ts;
+    uint32_t avail;
+
+    /* Delays are counted from the frame presented now, so they are exact */
+    if (delay && !getAvail(avail, ts)) {
+        uint32_t queued = (avail < mBufferFrames) ? (mBufferFrames - avail) : 0;
+        int64_t frame = (int64_t)mFramesWritten - queued - mLimiter.getDelay() + delay;
+        if (frame > (int64_t)mFramesWritten)
+            start = frame;
+    } else {
+        start += delay;
+    }
+
+    if (gainDb > 0.0f)
+        gainDb = 0.0f;
+
+    voice->chime = chime;
+    voice->pcm = pcm;
+    voice->frames = frames;
+    voice->channels = chime->getChannels();
+    voice->slotMask = slotMask;
+    voice->period = (period > frames) ? period : frames;
+    voice->loops = loops;
+    voice->start = start;
+    voice->gain = (int32_t)(powf(10.0f, gainDb / 20.0f) * 32767.0f);
+    voice->stopping = false;
+    voice->fade = 0;
+
+    /* Nothing else keeps the device open */
+    if (closed)
+        mChimeOpen = true;
+
+    return 0;
+}
+
+/*
+ * Stop a chime in the zones of the slots at the end of its current loop,
+ * or 'now' with a short fade-out
+ */
+void AudioPortMixer::stopChime(const sp<AudioChime> &chime, uint32_t slotMask, bool now)
+{
+    ALOGV("%s: stop chime '%s' in slots 0x%x%s", getName(), chime->getName(), slotMask,
+          now ? " now" : "");
+
+    AutoMutex lock(mLock);
+
+    for (ChimeVect::iterator i = mChimes.begin(); i != mChimes.end(); ++i) {
+        if ((i->chime != chime) || !(i->slotMask & slotMask))
+            continue;
+
+        /* Not sounding yet, or in between two loops */
+        if (i->start >= mFramesWritten) {
+            endVoice(*i);
+            if (!mActiveChimes)
+                mChimeEnd = mFramesWritten + mLimiter.getDelay();
+            continue;
+        }
+
+        i->stopping = true;
+        if (now && !i->fade)
+            i->fade = (kChimeFadeMs * mParams.sampleRate) / 1000;
+    }
+}
+
+bool AudioPortMixer::isOpen() const
+{
+    AutoMutex lock(mLock);
+    return mPcm->isOpen();
+}
+
+/* must be called with mOpenLock */
+int AudioPortMixer::open()
+{
+    ALOGV("%s: open %u channels, %u bits/sample, %u Hz, %u frames, %s",
+          getName(), mParams.channels, mParams.sampleBits, mParams.sampleRate,
+          mParams.frameCount, mPcm->getType());
+
+    mLock.lock();
+    int ret = mPcm->open(mParams, kPeriodCount);
+    if (ret) {
+        mLock.unlock();
+        ALOGE("%s: failed to open PCM %d", getName(), ret);
+        return ret;
+    }
+    mBufferFrames = mPcm->getBufferFrames();
+    mMasterGain = mMaster ? 0 : GainRamp::kUnityQ30;
+    mWakeups.reset();
+    mEq.reset();
+    mLimiter.reset();
+    mResampler.reset();
+    resetDrift();
+    mPeriods.reset();
+    mDirectWrites.reset();
+    mRenderStats.reset();
+    mDirectOwned = false;
+    mLock.unlock();
+
+    mThread = new RenderThread(this);
+    ret = mThread->run(getName(), ANDROID_PRIORITY_URGENT_AUDIO);
+    if (ret) {
+        ALOGE("%s: failed to start render thread %d", getName(), ret);
+        mThread.clear();
+        AutoMutex lock(mLock);
+        mPcm->close();
+        return -ENODEV;
+    }
+
+    return 0;
+}
+
+/* must be called with mOpenLock */
+void AudioPortMixer::close()
+{
+    ALOGV("%s: close", getName());
+
+    if (mThread != NULL) {
+        mThread->requestExit();
+        stop();
+        mThread->requestExitAndWait();
+        mThread.clear();
+    }
+
+    AutoMutex lock(mLock);
+
+    for (ChimeVect::iterator i = mChimes.begin(); i != mChimes.end(); ++i) {
+        if (i->chime != NULL)
+            endVoice(*i);
+    }
+    mChimeOpen = false;
+
+    if (mPcm->isOpen())
+        mPcm->close();
+}
+
+int AudioPortMixer::stop()
+{
+    ALOGV("%s: stop", getName());
+
+    /* Not locked on purpose, it must be able to unblock a pending write */
+    return mPcm->stop();
+}
+
+/* must be called with mLock */
+int AudioPortMixer::getAvail(uint32_t &avail, struct timespec &ts) const
+{
+    return mPcm->getAvail(avail, ts);
+}
+
+/*
+ * Kernel buffer fill level and the level at which the render thread has
+ * to wake up to refill it. The fill level is the smallest period size of
+ * the attached inputs, as their rings can only provide that much data
+ * in a burst.
+ *
+ * must be called with mLock
+ */
+void AudioPortMixer::getFillLevels(uint32_t &fill, uint32_t &wake) const
+{
+    uint32_t period = mParams.frameCount;
+
+    /* Chimes are stopped within a few periods, like a fast input */
+    fill = mActiveChimes ? kMinFillPeriods * period : mBufferFrames;
+    for (InputVect::const_iterator i = mInputs.begin(); i != mInputs.end(); ++i) {
+        uint32_t frames = (*i)->getPeriodFrames();
+        if (frames < fill)
+            fill = frames;
+    }
+
+    /* Whole periods, no less than the minimum to avoid underruns */
+    fill = (fill / period) * period;
+    if (fill < kMinFillPeriods * period)
+        fill = kMinFillPeriods * period;
+    if (fill > mBufferFrames)
+        fill = mBufferFrames;
+
+    /* Large fill levels leave a fixed margin, small ones refill at half */
+    if (fill > 2 * kMinFillPeriods * period)
+        wake = kMinFillPeriods * period;
+    else
+        wake = fill / 2;
+}
+
+/*
+ * Mix one period of all inputs. If the master mute is on, the inputs are
+ * still consumed to keep them in pace with the hardware, but nothing is
+ * mixed and silence is written. Master gain changes are ramped in small
+ * steps within the period.
+ *
+ * must be called with mLock
+ */
+void AudioPortMixer::mix(uint32_t frames, int16_t *out)
+{
+    uint32_t samples = frames * mParams.channels;
+    int32_t state = mMaster ? mMaster->getState() : GainRamp::kUnityQ30;
+
+    /* Inputs are mixed at their own pace, then resampled to the device's */
+    uint32_t inFrames = frames;
+    int32_t *acc = &mMixBuffer[0];
+    if (mDriftComp) {
+        inFrames = mResampler.getInputFrames(frames);
+        acc = mResampler.getInputBuffer();
+    }
+    mInFramesMixed += inFrames;
+
+    /* Frames before a synchronized start are silent, the inputs wait */
+    uint32_t offset = getHeldFrames(frames);
+    if (offset > inFrames)
+        offset = inFrames;
+
+    if (MasterVolume::isMuted(state)) {
+        for (InputVect::iterator i = mInputs.begin(); i != mInputs.end(); ++i) {
+            if (offset < inFrames)
+                (*i)->mix(NULL, inFrames - offset, mFramesWritten + offset, frames - offset);
+        }
+        if (mDriftComp) {
+            memset(acc, 0, inFrames * mParams.channels * sizeof(int32_t));
+            mResampler.process(&mMixBuffer[0], frames);
+        }
+        mixChimes(NULL, frames);
+        memset(out, 0, samples * sizeof(int16_t));
+        mMasterGain = 0;
+        return;
+    }
+
+    /* Zones whose hold expired are free for the lower priority inputs again */
+    for (uint32_t z = 0; z < mZones.size(); z++) {
+        if (mZones[z].holdEnd <= mFramesWritten)
+            mZones[z].priority = 0;
+        mActive[z] = mZones[z].priority;
+        mOnsets[z] = 0;
+    }
+
+    /* Inputs that had data for a slot in this period, for the headroom */
+    for (uint32_t slot = 0; slot < mSlotInputs.size(); slot++)
+        mSlotInputs[slot] = 0;
+
+    memset(acc, 0, inFrames * mParams.channels * sizeof(int32_t));
+    for (InputVect::iterator i = mInputs.begin(); i != mInputs.end(); ++i) {
+        if ((offset == inFrames) || !duck(*i, acc, offset, inFrames, frames - offset))
+            continue;
+        uint32_t slots = (*i)->getSlotMask();
+        for (uint32_t slot = 0; slot < mSlotInputs.size(); slot++) {
+            if (slots & (1 << slot))
+                mSlotInputs[slot]++;
+        }
+    }
+
+    if (mDriftComp)
+        mResampler.process(&mMixBuffer[0], frames);
+
+    /* Chimes are in the device's timeline, past the drift resampler */
+    mixChimes(&mMixBuffer[0], frames);
+
+    mEq.process(&mMixBuffer[0], frames);
+    mLimiter.process(&mMixBuffer[0], frames);
+
+    bool slotUnity = updateSlotGains();
+
+    int32_t target = MasterVolume::getGain(state);
+    if ((target == GainRamp::kUnityQ30) && (mMasterGain == target) && slotUnity) {
+        saturateQ15(&mMixBuffer[0], out, samples);
+        return;
+    }
+
+    int32_t steps = (frames + kMasterRampFrames - 1) / kMasterRampFrames;
+    int32_t step = (target - mMasterGain) / steps;
+
+    for (uint32_t slot = 0; slot < mSlotGains.size(); slot++)
+        mSlotSteps[slot] = (mSlotTargets[slot] - mSlotGains[slot]) / steps;
+
+    for (uint32_t offset = 0; offset < frames; offset += kMasterRampFrames) {
+        uint32_t n = frames - offset;
+        if (n > kMasterRampFrames)
+            n = kMasterRampFrames;
+
+        /* Land exactly on the target on the last step */
+        bool last = (offset + n == frames);
+        mMasterGain = last ? target : mMasterGain + step;
+
+        /* Q30 x Q30 to Q31, unity is saturated to the largest Q31 value */
+        bool flat = true;
+        for (uint32_t slot = 0; slot < mSlotGains.size(); slot++) {
+            mSlotGains[slot] = last ? mSlotTargets[slot] : mSlotGains[slot] + mSlotSteps[slot];
+            int64_t gain = ((int64_t)mMasterGain * mSlotGains[slot]) >> 29;
+            mGainsQ31[slot] = (gain > 0x7fffffff) ? 0x7fffffff : (int32_t)gain;
+            if (mGainsQ31[slot] != mGainsQ31[0])
+                flat = false;
+        }
+
+        uint32_t base = offset * mParams.channels;
+        if (flat) {
+            scaleSaturateQ15(&mMixBuffer[base], out + base, n * mParams.channels,
+                             mGainsQ31[0]);
+        } else {
+            scaleSaturateSlotsQ15(&mMixBuffer[base], out + base, n, mParams.channels,
+                                  &mGainsQ31[0]);
+        }
+    }
+}
+
+/*
+ * Headroom gains of the slots for the inputs counted in this period, the
+ * gains ramp to them over the period. True if they all are at unity.
+ *
+ * must be called with mLock
+ */
+bool AudioPortMixer::updateSlotGains()
+{
+    bool unity = true;
+    bool shared = false;
+
+    for (uint32_t slot = 0; slot < mSlotGains.size(); slot++) {
+        uint32_t inputs = mSlotInputs[slot];
+        int32_t target = GainRamp::kUnityQ30;
+
+        if (inputs > 1) {
+            shared = true;
+            if (mHeadroom[slot] == HEADROOM_POWER)
+                target = (int32_t)(GainRamp::kUnityQ30 / sqrtf((float)inputs));
+            else if (mHeadroom[slot] == HEADROOM_SAFE)
+                target = GainRamp::kUnityQ30 / inputs;
+        }
+
+        mSlotTargets[slot] = target;
+        if ((target != GainRamp::kUnityQ30) || (mSlotGains[slot] != GainRamp::kUnityQ30))
+            unity = false;
+    }
+
+    if (shared)
+        mSharedPeriods++;
+
+    return unity;
+}
+
+/*
+ * The processing that alters the content is bypassed while the direct
+ * input is the only one attached: the limiter and the drift resampler.
+ * Switching resets them, so the look-ahead delay changes right away and
+ * the presented position follows. The clock is still estimated meanwhile,
+ * but the content follows the device's clock, the skew is dropped when
+ * the compensation starts again.
+ *
+ * must be called with mLock
+ */
+void AudioPortMixer::updateBypass()
+{
+    bool bypass = mDirectInput && (mInputs.size() == 1) && (mInputs[0] == mDirectInput);
+    if (bypass == mBypass)
+        return;
+
+    ALOGV("%s: %s the limiter and drift compensation for the direct input", getName(),
+          bypass ? "bypass" : "restore");
+
+    mBypass = bypass;
+    if (!bypass)
+        mDirectOwned = false;
+    mLimiter.setEnabled(mLimiterOn && !bypass);
+
+    bool driftComp = mDriftOn && !bypass;
+    if (driftComp != mDriftComp) {
+        if (driftComp)
+            mResampler.reset();
+        mDriftComp = driftComp;
+        resetDrift();
+    }
+}
+
+/*
+ * The device can be handed over to the direct input while the mix would
+ * leave its data unchanged: it plays alone, so the limiter and the drift
+ * resampler are bypassed, and there is no chime, zone EQ, pending
+ * synchronized start (measured by the render thread), headroom or master
+ * gain, nor a duck of the input still ramping.
+ *
+ * must be called with mLock
+ */
+bool AudioPortMixer::isDirectOwnable() const
+{
+    if (!mBypass || mActiveChimes || mEq.getZoneMask())
+        return false;
+
+    if ((mStartState != START_NONE) && (mStartState != START_DONE))
+        return false;
+
+    for (uint32_t slot = 0; slot < mSlotGains.size(); slot++) {
+        if (mSlotGains[slot] != GainRamp::kUnityQ30)
+            return false;
+    }
+
+    int32_t state = mMaster ? mMaster->getState() : GainRamp::kUnityQ30;
+    return (state == GainRamp::kUnityQ30) && (mMasterGain == GainRamp::kUnityQ30);
+}
+
+/*
+ * Set the zone gains of an input from the higher priority inputs mixed
+ * so far, then mix it from 'offset' to the end of the period. All inputs
+ * start at the same offset, so the onsets are relative to it too. The
+ * input's own onsets are needed only if there is a lower priority input
+ * that it could duck. 'frames' counts input frames, the part past the
+ * offset plays over 'hwSpan' device frames.
+ *
+ * must be called with mLock
+ */
+uint32_t AudioPortMixer::duck(AudioOutPort *input, int32_t *acc, uint32_t offset,
+                              uint32_t frames, uint32_t hwSpan)
+{
+    uint64_t hwFrames = mFramesWritten + offset;
+    acc += offset * mParams.channels;
+
+    uint32_t priority = input->getPriority();
+    bool ducking = (mDuckGain != GainRamp::kUnityQ30);
+    uint32_t zones = mZones.size();
+
+    uint32_t attack = (kDuckAttackMs * mParams.sampleRate) / 1000;
+    uint32_t release = (kDuckReleaseMs * mParams.sampleRate) / 1000;
+
+    for (uint32_t z = 0; z < zones; z++) {
+        if (ducking && (mActive[z] > priority))
+            input->setZoneTarget(z, mDuckGain, attack, mOnsets[z]);
+        else
+            input->setZoneTarget(z, GainRamp::kUnityQ30, release, 0);
+    }
+
+    bool detect = ducking && (priority > mInputs.back()->getPriority());
+    if (!detect)
+        return input->mix(acc, frames - offset, hwFrames, hwSpan);
+
+    for (uint32_t z = 0; z < zones; z++)
+        mInputOnsets[z] = kNoOnset;
+
+    uint32_t mixed = input->mix(acc, frames - offset, hwFrames, hwSpan, &mInputOnsets[0]);
+
+    uint64_t holdEnd = mFramesWritten + frames + (kDuckHoldMs * mParams.sampleRate) / 1000;
+    for (uint32_t z = 0; z < zones; z++) {
+        if (mInputOnsets[z] == kNoOnset)
+            continue;
+
+        if (priority > mActive[z]) {
+            mActive[z] = priority;
+            mOnsets[z] = mInputOnsets[z];
+        }
+        if (priority > mZones[z].priority) {
+            mZones[z].priority = priority;
+            mDucks++;
+        }
+        mZones[z].holdEnd = holdEnd;
+    }
+
+    return mixed;
+}
+
+/*
+ * Frames of the next 'frames' to mix that come before a synchronized
+ * start. The start frame is only known once the device runs: it's the
+ * frame presented at the deadline according to the device's timestamp,
+ * less the limiter's delay. A deadline that is closer than the frames
+ * already queued starts the inputs right away, the late start shows up
+ * in the start error.
+ *
+ * must be called with mLock
+ */
+uint32_t AudioPortMixer::getHeldFrames(uint32_t frames)
+{
+    if (mStartState == START_ARMED) {
+        struct timespec ts;
+        uint32_t avail;
+
+        if (getAvail(avail, ts)) {
+            /* Not running yet, the silence written now primes the device */
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            if (ts.tv_sec * kNsPerSec + ts.tv_nsec < mStartDeadline)
+                return frames;
+            mStartFrame = mFramesWritten;
+        } else {
+            uint32_t queued = (avail < mBufferFrames) ? (mBufferFrames - avail) : 0;
+            int64_t presented = (int64_t)mFramesWritten - queued - mLimiter.getDelay();
+            int64_t ns = mStartDeadline - (ts.tv_sec * kNsPerSec + ts.tv_nsec);
+            int64_t frame = presented + (ns * mParams.sampleRate) / kNsPerSec;
+            mStartFrame = (frame > (int64_t)mFramesWritten) ? frame : mFramesWritten;
+        }
+
+        mStartState = START_SCHEDULED;
+        ALOGV("%s: start at frame %llu, %llu frames from now", getName(),
+              mStartFrame, mStartFrame - mFramesWritten);
+    }
+
+    if (mStartState != START_SCHEDULED)
+        return 0;
+
+    if (mStartFrame >= mFramesWritten + frames)
+        return frames;
+
+    mStartState = START_RUNNING;
+
+    return (uint32_t)(mStartFrame - mFramesWritten);
+}
+
+/*
+ * Presentation time of the start frame, extrapolated back from the first
+ * timestamp taken after it was presented
+ *
+ * must be called with mLock
+ */
+void AudioPortMixer::measureStart()
+{
+    struct timespec ts;
+    uint32_t avail;
+
+    if ((mStartState != START_RUNNING) || getAvail(avail, ts))
+        return;
+
+    uint32_t queued = (avail < mBufferFrames) ? (mBufferFrames - avail) : 0;
+    uint64_t startFrame = mStartFrame + mLimiter.getDelay();
+    if (mFramesWritten < startFrame + queued)
+        return;
+
+    uint64_t since = mFramesWritten - queued - startFrame;
+    int64_t presented = ts.tv_sec * kNsPerSec + ts.tv_nsec -
+                        (int64_t)((since * kNsPerSec) / mParams.sampleRate);
+
+    mStartError = presented - mStartDeadline;
+    mStartState = START_DONE;
+
+    ALOGV("%s: started %lld us off the deadline", getName(), mStartError / 1000);
+}
+
+/*
+ * Mix the chimes that sound in this period at their exact frames. Each
+ * loop that ends in the period starts the next one, so loops are seamless
+ * when the period is the length of the clip. With no mix buffer (mute)
+ * the voices just advance.
+ *
+ * must be called with mLock
+ */
+void AudioPortMixer::mixChimes(int32_t *acc, uint32_t frames)
+{
+    if (!mActiveChimes)
+        return;
+
+    uint64_t end = mFramesWritten + frames;
+
+    for (ChimeVect::iterator i = mChimes.begin(); i != mChimes.end(); ++i) {
+        bool mixed = false;
+
+        while ((i->chime != NULL) && (i->start < end)) {
+            uint64_t from = (i->start > mFramesWritten) ? i->start : mFramesWritten;
+            uint64_t clipEnd = i->start + i->frames;
+
+            if (from < clipEnd) {
+                uint32_t offset = (uint32_t)(from - mFramesWritten);
+                uint32_t n = (uint32_t)(((clipEnd < end) ? clipEnd : end) - from);
+                mixVoice(*i, acc ? acc + offset * mParams.channels : NULL,
+                         (uint32_t)(from - i->start), n);
+                mixed = true;
+                if (i->chime == NULL)
+                    break;
+            }
+
+            if (clipEnd > end)
+                break;
+
+            if (i->stopping || (i->loops == 1)) {
+                endVoice(*i);
+                break;
+            }
+
+            if (i->loops)
+                i->loops--;
+            i->start += i->period;
+        }
+
+        /* Chimes count as one more input for the headroom of their slots */
+        if (acc && mixed) {
+            for (uint32_t slot = 0; slot < mSlotInputs.size(); slot++) {
+                if (i->slotMask & (1 << slot))
+                    mSlotInputs[slot]++;
+            }
+        }
+    }
+
+    if (!mActiveChimes)
+        mChimeEnd = end + mLimiter.getDelay();
+}
+
+/*
+ * Mix frames of a voice's clip from 'offset' into the zones of its slots,
+ * a mono clip goes to both slots of a zone. A voice that is fading out
+ * ends with its fade, possibly before 'frames'.
+ *
+ * must be called with mLock
+ */
+void AudioPortMixer::mixVoice(ChimeVoice &voice, int32_t *acc, uint32_t offset,
+                              uint32_t frames)
+{
+    uint32_t fadeFrames = (kChimeFadeMs * mParams.sampleRate) / 1000;
+
+    if (voice.fade && (frames > voice.fade))
+        frames = voice.fade;
+
+    if (acc) {
+        const int16_t *pcm = voice.pcm + offset * voice.channels;
+        uint32_t right = (voice.channels == 2) ? 1 : 0;
+
+        for (uint32_t zone = 0; zone < mParams.channels / 2; zone++) {
+            if (!(voice.slotMask & (3 << (2 * zone))))
+                continue;
+
+            int32_t *dst = acc + 2 * zone;
+            for (uint32_t i = 0; i < frames; i++) {
+                int32_t gain = voice.gain;
+                if (voice.fade)
+                    gain = (int32_t)(((int64_t)gain * (voice.fade - i)) / fadeFrames);
+
+                const int16_t *src = pcm + i * voice.channels;
+                dst[0] += (src[0] * gain) >> 15;
+                dst[1] += (src[right] * gain) >> 15;
+                dst += mParams.channels;
+            }
+        }
+    }
+
+    if (voice.fade) {
+        voice.fade -= frames;
+        if (!voice.fade)
+            endVoice(voice);
+    }
+}
+
+/* must be called with mLock */
+void AudioPortMixer::endVoice(ChimeVoice &voice)
+{
+    ALOGV("%s: chime '%s' ended", getName(), voice.chime->getName());
+
+    voice.chime.clear();
+    voice.pcm = NULL;
+    mActiveChimes--;
+    mChimesPlayed++;
+}
+
+/*
+ * Close the device kept open by chimes alone, once the last one has been
+ * presented. The render thread exits right after.
+ *
+ * must be called with mLock
+ */
+bool AudioPortMixer::closeIdle()
+{
+    struct timespec ts;
+    uint32_t avail;
+
+    if (!mChimeOpen || mActiveChimes || !mInputs.empty())
+        return false;
+
+    if (!getAvail(avail, ts)) {
+        uint32_t queued = (avail < mBufferFrames) ? (mBufferFrames - avail) : 0;
+        if (mFramesWritten < mChimeEnd + queued)
+            return false;
+    }
+
+    ALOGV("%s: close, chimes are over", getName());
+
+    mPcm->close();
+    mChimeOpen = false;
+
+    return true;
+}
+
+/* must be called with mLock */
+void AudioPortMixer::resetDrift()
+{
+    mDriftAnchored = false;
+    mPhaseBaseUs = mClockPhaseUs;
+    mSkewFrames = 0.0;
+}
+
+/*
+ * Drift estimation and compensation, from the device's timestamp. The
+ * device's phase is how many frames it is ahead of CLOCK_MONOTONIC since
+ * the anchor, its slope over kDriftWindowMs windows is the drift. The
+ * content (input frames presented) must follow the reference clock: the
+ * resampler ratio is the ratio of the reference and device clocks, plus a
+ * small correction of the accumulated skew. A jump of the device position,
+ * e.g. an underrun, re-anchors the estimation instead.
+ *
+ * must be called with mLock
+ */
+void AudioPortMixer::updateDrift()
+{
+    struct timespec ts;
+    uint32_t avail;
+
+    if (getAvail(avail, ts))
+        return;
+
+    double rate = mParams.sampleRate;
+    int64_t now = ts.tv_sec * kNsPerSec + ts.tv_nsec;
+    uint32_t queued = (avail < mBufferFrames) ? (mBufferFrames - avail) : 0;
+    queued += mLimiter.getDelay();
+    uint64_t presented = (mFramesWritten > queued) ? (mFramesWritten - queued) : 0;
+    double ratio = mDriftComp ? mResampler.getRatio() : 1.0;
+    double content = mInFramesMixed - (mFramesWritten - presented) * ratio;
+    int32_t refPhaseUs = mClockRef ? mClockRef->getClockPhaseUs() : 0;
+    double refPpm = mClockRef ? mClockRef->getClockPpb() / 1000.0 : 0.0;
+
+    if (!mDriftAnchored) {
+        mAnchorNs = now;
+        mAnchorFrames = presented;
+        mAnchorContent = content;
+        mAnchorRefPhaseUs = refPhaseUs;
+        mWindowNs = now;
+        mWindowPhase = 0.0;
+        mDriftAnchored = true;
+        if (mDriftComp && mClockValid)
+            mResampler.setRatio((1.0 + refPpm / 1e6) / (1.0 + mClockPpm / 1e6));
+        return;
+    }
+
+    double elapsed = (now - mAnchorNs) * rate / kNsPerSec;
+    double phase = (double)presented - (double)mAnchorFrames - elapsed;
+
+    if (now - mWindowNs >= kDriftWindowMs * 1000000LL) {
+        double ppm = (phase - mWindowPhase) * 1e6 / ((now - mWindowNs) * rate / kNsPerSec);
+        if (fabs(ppm) > 2 * DriftResampler::kMaxPpm) {
+            ALOGW("%s: device position jumped, re-anchoring drift estimation", getName());
+            mReanchors++;
+            resetDrift();
+            return;
+        }
+        mClockPpm = mClockValid ? mClockPpm + (ppm - mClockPpm) / kDriftSmoothing : ppm;
+        mClockValid = true;
+        mWindowNs = now;
+        mWindowPhase = phase;
+        android_atomic_release_store((int32_t)(mClockPpm * 1000), &mClockPpb);
+    }
+    android_atomic_release_store(mPhaseBaseUs + (int32_t)(phase * 1e6 / rate), &mClockPhaseUs);
+
+    if (!mDriftComp || !mClockValid)
+        return;
+
+    double reference = elapsed + (refPhaseUs - mAnchorRefPhaseUs) * rate / 1e6;
+    mSkewFrames = (content - mAnchorContent) - reference;
+    if (fabs(mSkewFrames) > kMaxSkewMs * rate / 1000) {
+        ALOGW("%s: content is %.0f frames off its clock, re-anchoring", getName(), mSkewFrames);
+        mReanchors++;
+        resetDrift();
+        return;
+    }
+
+    double correction = -mSkewFrames / (kSkewCorrectionSecs * rate);
+    double max = kMaxCorrectionPpm / 1e6;
+    if (correction > max)
+        correction = max;
+    else if (correction < -max)
+        correction = -max;
+
+    mResampler.setRatio((1.0 + refPpm / 1e6) / (1.0 + mClockPpm / 1e6) + correction);
+}
+
+/*
+ * Mix and write one period. MMAP devices get the mix in place, in as
+ * many chunks as needed to wrap around the hardware buffer.
+ *
+ * must be called with mLock
+ */
+int AudioPortMixer::writePeriod(uint32_t frames)
+{
+    if (!mPcm->isMmap()) {
+        mix(frames, &mOutBuffer[0]);
+        return mPcm->write(&mOutBuffer[0], frames);
+    }
+
+    while (frames) {
+        int16_t *area;
+        uint32_t n = frames;
+
+        int ret = mPcm->mmapBegin(area, n);
+        if (ret)
+            return ret;
+
+        /* No room, the fill level check lets the next render wait for it */
+        if (!n)
+            return -EAGAIN;
+
+        mix(n, area);
+
+        ret = mPcm->mmapCommit(n);
+        if (ret)
+            return ret;
+
+        frames -= n;
+        mFramesWritten += n;
+    }
+
+    return 0;
+}
+
+/*
+ * Write the direct input's frames straight to the device, as many as fit
+ * in the kernel buffer right now, so it never blocks. The device is taken
+ * back as soon as the mix could alter the data. Frames that the input
+ * queued in its ring before the handover go first, mixed as in bypass,
+ * so the data stays in order. 'hwFrames' is the device frame of the first
+ * one written.
+ *
+ * Returns the frames written, or -EAGAIN if the input has to go through
+ * its ring and the mix.
+ */
+int AudioPortMixer::writeDirect(const AudioOutPort *input, const int16_t *buffer,
+                                uint32_t frames, uint64_t &hwFrames)
+{
+    /* Not locked, the direct input is set up once and the other ports don't contend */
+    if (input != mDirectInput)
+        return -EAGAIN;
+
+    AutoMutex lock(mLock);
+
+    if (!mPcm->isOpen() || (input != mDirectInput) || !isDirectOwnable()) {
+        mDirectOwned = false;
+        return -EAGAIN;
+    }
+
+    if (!mDirectOwned) {
+        if (!input->isUnityGain())
+            return -EAGAIN;
+        ALOGV("%s: device handed over to %s", getName(), input->getName());
+        mDirectOwned = true;
+        mHandovers++;
+    }
+
+    /* A stopped device is empty, a period is written without blocking */
+    struct timespec ts;
+    uint32_t avail;
+    if (getAvail(avail, ts))
+        avail = mParams.frameCount;
+
+    uint32_t queued = input->getQueuedFrames();
+    while (queued && avail) {
+        uint32_t n = queued;
+        if (n > avail)
+            n = avail;
+        if (n > mParams.frameCount)
+            n = mParams.frameCount;
+        int ret = writePeriod(n);
+        if (!mPcm->isMmap())
+            mFramesWritten += n;
+        if (ret)
+            break;
+        queued -= n;
+        avail -= n;
+    }
+
+    /* Ring not flushed yet, the input retries once the device frees room */
+    if (queued)
+        frames = 0;
+    if (frames > avail)
+        frames = avail;
+
+    hwFrames = mFramesWritten;
+    uint32_t done = 0;
+    int ret = 0;
+
+    if (!mPcm->isMmap()) {
+        if (frames)
+            ret = mPcm->write(buffer, frames);
+        if (!ret)
+            done = frames;
+    } else {
+        while (done < frames) {
+            int16_t *area;
+            uint32_t n = frames - done;
+
+            ret = mPcm->mmapBegin(area, n);
+            if (ret || !n)
+                break;
+
+            memcpy(area, buffer + done * mParams.channels, mParams.framesToBytes(n));
+
+            ret = mPcm->mmapCommit(n);
+            if (ret)
+                break;
+
+            done += n;
+        }
+    }
+
+    /* The content follows the device's clock, as in bypass */
+    mFramesWritten += done;
+    mInFramesMixed += done;
+    if (done) {
+        updateDrift();
+        mDirectWrites.event();
+    }
+
+    /* The render thread writes whatever is left, and logs its own errors */
+    if (ret) {
+        ALOGE("%s: failed to write %u direct frames %d", getName(), frames, ret);
+        mDirectOwned = false;
+        return done ? (int)done : -EAGAIN;
+    }
+
+    return done;
+}
+
+bool AudioPortMixer::render()
+{
+    uint32_t frames = mParams.frameCount;
+    uint32_t fill, wake;
+    struct timespec ts;
+    uint32_t avail;
+    int ret;
+
+    /*
+     * Sleep outside of the lock once the kernel buffer is filled up to
+     * the current level, so the write is immediate and the frames written
+     * counter is consistent with the hardware pointer when read by
+     * getPresentedFrames()
+     */
+    mLock.lock();
+    getFillLevels(fill, wake);
+    ret = getAvail(avail, ts);
+    if (mDirectOwned && !isDirectOwnable())
+        mDirectOwned = false;
+    bool direct = mDirectOwned;
+    mLock.unlock();
+
+    if (!ret) {
+        uint32_t queued = (avail < mBufferFrames) ? (mBufferFrames - avail) : 0;
+
+        /* The direct input keeps the buffer filled itself, see writeDirect() */
+        if (direct && (queued > wake)) {
+            usleep(((queued - wake) * 1000000ULL) / mParams.sampleRate);
+            mWakeups.event();
+            return true;
+        }
+
+        if (!direct && (queued + frames > fill)) {
+            uint32_t sleepFrames = (queued > wake) ? (queued - wake) : frames;
+            usleep((sleepFrames * 1000000ULL) / mParams.sampleRate);
+            mWakeups.event();
+            return true;
+        }
+    }
+
+    AutoMutex lock(mLock);
+
+    if (!mPcm->isOpen() || closeIdle())
+        return false;
+
+    /*
+     * Handed over meanwhile, the next loop watches the fill level. Or the
+     * direct input is late: the mix takes the device back before it runs
+     * dry, and gets it back once the input has caught up.
+     */
+    if (mDirectOwned) {
+        if (!direct)
+            return true;
+        if (!getAvail(avail, ts) && (avail < mBufferFrames) && (mBufferFrames - avail > wake))
+            return true;
+        ALOGW("%s: direct input is late, mixing it again", getName());
+        mDirectOwned = false;
+        mTakebacks++;
+    }
+
+    nsecs_t start = systemTime();
+    uint64_t written = mFramesWritten;
+
+    ret = writePeriod(frames);
+    if (ret)
+        ALOGE("%s: failed to write %u frames %d", getName(), frames, ret);
+
+    /*
+     * Inputs consumed their data regardless, keep the counters in sync.
+     * MMAP periods are counted as they are committed.
+     */
+    if (!mPcm->isMmap())
+        mFramesWritten += frames;
+    measureStart();
+    updateDrift();
+    mRenderStats.record(systemTime() - start);
+    mPeriods.event();
+
+    /* Don't spin if the device keeps failing */
+    if (ret && (mFramesWritten == written))
+        usleep((frames * 1000000ULL) / mParams.sampleRate);
+
+    return true;
+}
+
+uint64_t AudioPortMixer::getFramesWritten() const
+{
+    AutoMutex lock(mLock);
+    return mFramesWritten;
+}
+
+int AudioPortMixer::getPresentedFrames(uint64_t &frames, struct timespec &ts) const
+{
+    AutoMutex lock(mLock);
+    uint32_t avail;
+
+    if (mPcm->isOpen() && !getAvail(avail, ts)) {
+        /* Frames in the limiter's delay line are not in the kernel buffer yet */
+        uint32_t queued = (avail < mBufferFrames) ? (mBufferFrames - avail) : 0;
+        queued += mLimiter.getDelay();
+        uint64_t presented = (mFramesWritten > queued) ? (mFramesWritten - queued) : 0;
+        if (presented > mLastPresented)
+            mLastPresented = presented;
+    } else {
+        /* Port is idle or not started yet, nothing new has been presented */
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+    }
+
+    frames = mLastPresented;
+
+    ALOGVV("%s: presented %llu frames at %ld.%09ld", getName(),
+           frames, ts.tv_sec, ts.tv_nsec);
+
+    return 0;
+}
+
+int AudioPortMixer::dump(int fd) const
+{
+    String8 result;
+    uint32_t fill = 0, wake = 0;
+
+    mLock.lock();
+    bool open = mPcm->isOpen();
+    if (open)
+        getFillLevels(fill, wake);
+    result.appendFormat("  %s: %s %s, %u inputs, fill %u frames, wake at %u frames\n",
+                        getName(), mPcm->getType(), open ? "open" : "closed",
+                        mInputs.size(), fill, wake);
+
+    uint32_t ducked = 0;
+    for (uint32_t z = 0; z < mZones.size(); z++) {
+        if (mZones[z].priority)
+            ducked |= 1 << z;
+    }
+    result.appendFormat("    ducking: gain %.4f, %u ducks, zones 0x%x ducked now\n",
+                        (float)mDuckGain / GainRamp::kUnityQ30, mDucks, ducked);
+    result.appendFormat("    headroom:");
+    for (uint32_t slot = 0; slot < mHeadroom.size(); slot++) {
+        result.appendFormat(" %s", (mHeadroom[slot] == HEADROOM_POWER) ? "power" :
+                                   (mHeadroom[slot] == HEADROOM_SAFE) ? "safe" : "none");
+    }
+    result.appendFormat(", %u periods with shared slots\n", mSharedPeriods);
+    result.appendFormat("    EQ: zones 0x%x\n", mEq.getZoneMask());
+    if (mLimiter.isEnabled()) {
+        result.appendFormat("    limiter: %.1f dBFS, %u frames look-ahead, "
+                            "gain reduction (dB, now/max):",
+                            mLimiter.getThreshold(), ZoneLimiter::kLookahead);
+        for (uint32_t z = 0; z < mLimiter.getZones(); z++) {
+            result.appendFormat(" %.1f/%.1f", mLimiter.getReduction(z),
+                                mLimiter.getMaxReduction(z));
+        }
+        result.appendFormat("\n");
+    } else {
+        result.appendFormat("    limiter: %s\n",
+                            mLimiterOn ? "bypassed, direct input alone" : "off");
+    }
+    result.appendFormat("    clock: %+.1f ppm, drift compensation %s (ratio %+.1f ppm, "
+                        "skew %.1f frames, %u re-anchors), reference %s\n",
+                        mClockPpm, mDriftComp ? "on" : mDriftOn ? "bypassed" : "off",
+                        (mResampler.getRatio() - 1.0) * 1e6, mSkewFrames, mReanchors,
+                        mClockRef ? mClockRef->getName() : "monotonic");
+    result.appendFormat("    direct input: %s, %u handovers, %u taken back late\n",
+                        mDirectOwned ? "writes the device" : mBypass ? "mixed alone" : "mixed",
+                        mHandovers, mTakebacks);
+    result.appendFormat("    chimes: %u playing, %u played%s\n", mActiveChimes,
+                        mChimesPlayed, mChimeOpen ? ", keep the device open" : "");
+    if (mStartState == START_DONE) {
+        result.appendFormat("    synchronized start: %lld us off the deadline\n",
+                            mStartError / 1000);
+    } else if (mStartState != START_NONE) {
+        result.appendFormat("    synchronized start: pending, deadline %lld ns\n",
+                            mStartDeadline);
+    }
+    mLock.unlock();
+
+    mWakeups.dump(result);
+    mPeriods.dump(result);
+    mDirectWrites.dump(result);
+    mRenderStats.dump(result);
+
+    ::write(fd, result.string(), result.size());
+
+    return 0;
+}
+
+}; // namespace android
@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUDIO_PORT_MIXER_H_
+#define _AUDIO_PORT_MIXER_H_
+
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include <cutils/atomic.h>
+#include <utils/threads.h>
+#include <utils/Thread.h>
+
+#include <tiaudioutils/Base.h>
+
+#include <AudioChime.h>
+#include <AudioDsp.h>
+#include <AudioPcmDevice.h>
+#include <AudioStats.h>
+
+namespace android {
+
+using namespace tiaudioutils;
+using std::string;
+using std::vector;
+
+class AudioOutPort;
+
+/**
+ * Owner of an ALSA playback device. The PCM writers of the different
+ * output profiles (e.g. regular and fast) don't write to the device
+ * directly, they write to AudioOutPort inputs that are mixed by this
+ * class in its own render thread, one hardware period at a time.
+ *
+ * The device is open while at least one input is attached. Master
+ * volume and mute are applied to the mix right before it's written.
+ *
+ * The kernel buffer is large, but it's only filled up to the period size
+ * of the inputs: two device periods when a fast input is attached, and
+ * the whole buffer when only deep buffer inputs are. In the latter case
+ * the render thread writes in bursts and sleeps in between, which cuts
+ * the number of CPU wakeups.
+ *
+ * With an MMAP device the mix is saturated straight into the hardware
+ * buffer, there is no output buffer copy nor write() syscall.
+ *
+ * Inputs are mixed from the highest to the lowest priority. As soon as an
+ * input has signal in a zone (a stereo pair of slots), the lower priority
+ * inputs are ducked in that zone starting at that very frame, e.g. a
+ * navigation prompt over media. The duck is held for a while after the
+ * signal stops, then released with a slower ramp.
+ *
+ * Slots fed by more than one input are summed in 32 bits and saturated
+ * once. Each slot has a headroom policy that attenuates such a sum by the
+ * number of inputs that fed the slot in the period: not at all (plain
+ * saturation), by 1/sqrt(n) (equal power) or by 1/n (never clips).
+ *
+ * Each zone can have its own EQ, run on the mix of all the inputs before
+ * the gains and the saturation, so the zone's tuning costs no extra pass
+ * over the stream buffers. A look-ahead limiter follows, so that loud
+ * mixes are not clipped by the final saturation to 16 bits. It delays the
+ * mix by a few frames, which the presented position accounts for. It's
+ * bypassed while the direct input plays alone, so that its content stays
+ * bit-exact; when another input joins, the limiter starts again from an
+ * empty look-ahead.
+ *
+ * While the direct input plays alone and nothing else would alter it (no
+ * chime, EQ, synchronized start nor master gain), the mixer hands the
+ * device over to it: its writes go straight to the PCM, or are copied into
+ * the MMAP buffer, instead of through its ring and the mix. The render
+ * thread only watches the fill level meanwhile, and takes the device back
+ * if the input is late. Anything else to mix ends the handover too.
+ *
+ * The start of the inputs can be held until a CLOCK_MONOTONIC deadline,
+ * so that several ports start in sync. The device keeps running with
+ * silence meanwhile and the inputs fill up without being consumed. Once
+ * the device runs, the frame that it will present at the deadline is
+ * derived from its timestamp, and the inputs start at that very frame.
+ *
+ * Each device runs from its own clock. Its drift against CLOCK_MONOTONIC
+ * is estimated from the hardware timestamps versus the frames presented,
+ * and the inputs are consumed at a slightly different rate than the
+ * device's, through a drift resampler, so that the content follows the
+ * monotonic clock (or another device's clock, e.g. to keep a pipe between
+ * the two balanced). The remaining skew is corrected too, so it stays
+ * bounded no matter how long the ports run. Like the limiter, it's
+ * bypassed while the direct input plays alone.
+ *
+ * Chimes are mixed into the zones right in the device's timeline, without
+ * a stream or an input: each voice starts, loops and stops at an exact
+ * device frame. They keep the device open on their own while they play.
+ */
+class AudioPortMixer {
+ public:
+    enum Headroom {
+        HEADROOM_NONE,
+        HEADROOM_POWER,
+        HEADROOM_SAFE,
+    };
+
+    AudioPortMixer(AudioPcmDevice *pcm, const PcmParams &params,
+                   const MasterVolume *master = NULL);
+    virtual ~AudioPortMixer();
+
+    const char *getName() const { return mName.c_str(); }
+    uint32_t getCardId() const { return mCardId; }
+    uint32_t getPortId() const { return mPortId; }
+    const PcmParams &getParams() const { return mParams; }
+    int setSampleRate(uint32_t rate);
+    void setDuckGain(float gain);
+    void setHeadroom(uint32_t slotMask, Headroom headroom);
+    int setZoneEq(uint32_t slotMask, const vector<BiquadSpec> &specs);
+    void setLimiter(bool enabled, float thresholdDb);
+    void setDirectInput(const AudioOutPort *input);
+    void startAt(int64_t deadlineNs);
+    int getStartError(int64_t &errorNs) const;
+    void setDriftCompensation(bool enabled);
+    void setClockReference(const AudioPortMixer *reference);
+    int playChime(const sp<AudioChime> &chime, uint32_t slotMask, uint32_t loops,
+                  uint32_t periodMs, float gainDb, uint32_t delayMs);
+    void stopChime(const sp<AudioChime> &chime, uint32_t slotMask, bool now);
+
+    /* Device clock against CLOCK_MONOTONIC, lock-free for the other mixers */
+    int32_t getClockPpb() const { return android_atomic_acquire_load(&mClockPpb); }
+    int32_t getClockPhaseUs() const { return android_atomic_acquire_load(&mClockPhaseUs); }
+
+    int attach(AudioOutPort *input);
+    void detach(AudioOutPort *input);
+    bool isOpen() const;
+    int stop();
+
+    /* Called by the direct input's writer */
+    int writeDirect(const AudioOutPort *input, const int16_t *buffer, uint32_t frames,
+                    uint64_t &hwFrames);
+
+    uint64_t getFramesWritten() const;
+    int getPresentedFrames(uint64_t &frames, struct timespec &ts) const;
+    int dump(int fd) const;
+
+    static const uint32_t kPeriodCount = 16;
+    static const uint32_t kMinFillPeriods = 2;
+    static const uint32_t kMasterRampFrames = 32;
+    static const uint32_t kDuckAttackMs = 10;
+    static const uint32_t kDuckReleaseMs = 250;
+    static const uint32_t kDuckHoldMs = 500;
+    static const int16_t kDuckThreshold = 33; /* -60 dBFS */
+    static const int64_t kNsPerSec = 1000000000LL;
+    static const uint32_t kDriftWindowMs = 1000;
+    static const uint32_t kDriftSmoothing = 8;
+    static const uint32_t kSkewCorrectionSecs = 10;
+    static const uint32_t kMaxCorrectionPpm = 200;
+    static const uint32_t kMaxSkewMs = 20;
+    static const uint32_t kMaxChimes = 4;
+    static const uint32_t kChimeFadeMs = 5;
+
+ protected:
+    class RenderThread : public Thread {
+     public:
+        RenderThread(AudioPortMixer *mixer)
+            : Thread(false), mMixer(mixer) {}
+        virtual bool threadLoop() { return !exitPending() && mMixer->render(); }
+     private:
+        AudioPortMixer *mMixer;
+    };
+
+    typedef vector<AudioOutPort*> InputVect;
+
+    /* Highest priority with signal in the zone, until the hold expires */
+    struct ZoneState {
+        uint32_t priority;
+        uint64_t holdEnd;
+    };
+    typedef vector<ZoneState> ZoneVect;
+
+    /* Chime being played, the clip starts again every 'period' frames */
+    struct ChimeVoice {
+        sp<AudioChime> chime;
+        const int16_t *pcm;
+        uint32_t frames;
+        uint32_t channels;
+        uint32_t slotMask;
+        uint32_t period;
+        uint32_t loops;     /* Remaining, including the current one. 0 is forever */
+        uint64_t start;     /* Device frame of the current loop */
+        int32_t gain;       /* Q15 */
+        bool stopping;      /* Stops at the end of the current loop */
+        uint32_t fade;      /* Frames left of a fade-out, when stopped now */
+    };
+    typedef vector<ChimeVoice> ChimeVect;
+
+    enum StartState {
+        START_NONE,      /* Inputs run freely */
+        START_ARMED,     /* Held, start frame not known until the device runs */
+        START_SCHEDULED, /* Held until mStartFrame */
+        START_RUNNING,   /* Started, presentation time not measured yet */
+        START_DONE,      /* Started, mStartError is valid */
+    };
+
+    int open();
+    void close();
+    bool render();
+    int getAvail(uint32_t &avail, struct timespec &ts) const;
+    void getFillLevels(uint32_t &fill, uint32_t &wake) const;
+    void mix(uint32_t frames, int16_t *out);
+    uint32_t duck(AudioOutPort *input, int32_t *acc, uint32_t offset, uint32_t frames,
+                  uint32_t hwSpan);
+    uint32_t getHeldFrames(uint32_t frames);
+    void mixChimes(int32_t *acc, uint32_t frames);
+    void mixVoice(ChimeVoice &voice, int32_t *acc, uint32_t offset, uint32_t frames);
+    void endVoice(ChimeVoice &voice);
+    bool closeIdle();
+    void measureStart();
+    void updateDrift();
+    void resetDrift();
+    bool updateSlotGains();
+    void updateBypass();
+    bool isDirectOwnable() const;
+    int writePeriod(uint32_t frames);
+
+    uint32_t mCardId;
+    uint32_t mPortId;
+    string mName;
+    PcmParams mParams;
+    const MasterVolume *mMaster;
+    AudioPcmDevice *mPcm;
+    uint32_t mBufferFrames;
+    uint64_t mFramesWritten;
+    mutable uint64_t mLastPresented;
+    int32_t mMasterGain;
+    int32_t mDuckGain;
+    InputVect mInputs;
+    ZoneVect mZones;
+    vector<uint32_t> mActive;
+    vector<uint32_t> mOnsets;
+    vector<uint32_t> mInputOnsets;
+    uint32_t mDucks;
+    vector<Headroom> mHeadroom;
+    vector<uint32_t> mSlotInputs;
+    vector<int32_t> mSlotGains;
+    vector<int32_t> mSlotTargets;
+    vector<int32_t> mSlotSteps;
+    vector<int32_t> mGainsQ31;
+    uint32_t mSharedPeriods;
+    StartState mStartState;
+    int64_t mStartDeadline;
+    uint64_t mStartFrame;
+    int64_t mStartError;
+    DriftResampler mResampler;
+    bool mDriftOn;
+    bool mDriftComp;
+    const AudioPortMixer *mClockRef;
+    bool mDriftAnchored;
+    int64_t mAnchorNs;
+    uint64_t mAnchorFrames;
+    double mAnchorContent;
+    int32_t mAnchorRefPhaseUs;
+    int32_t mPhaseBaseUs;
+    int64_t mWindowNs;
+    double mWindowPhase;
+    double mClockPpm;
+    bool mClockValid;
+    double mSkewFrames;
+    uint64_t mInFramesMixed;
+    uint32_t mReanchors;
+    volatile int32_t mClockPpb;
+    volatile int32_t mClockPhaseUs;
+    ChimeVect mChimes;
+    uint32_t mActiveChimes;
+    uint32_t mChimesPlayed;
+    bool mChimeOpen;
+    uint64_t mChimeEnd;
+    ZoneEq mEq;
+    ZoneLimiter mLimiter;
+    bool mLimiterOn;
+    const AudioOutPort *mDirectInput;
+    bool mBypass;
+    bool mDirectOwned;
+    uint32_t mHandovers;
+    uint32_t mTakebacks;
+    RateStats mWakeups;
+    RateStats mPeriods;
+    RateStats mDirectWrites;
+    LatencyStats mRenderStats;
+    vector<int32_t> mMixBuffer;
+    vector<int16_t> mOutBuffer;
+    sp<RenderThread> mThread;
+    Mutex mOpenLock;
+    mutable Mutex mLock;
+};
+
+}; // namespace android
+
+#endif /* _AUDIO_PORT_MIXER_H_ */
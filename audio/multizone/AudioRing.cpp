@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioRing"
+// #define LOG_NDEBUG 0
+// #define VERY_VERBOSE_LOGGING
+#ifdef VERY_VERBOSE_LOGGING
+#define ALOGVV ALOGV
+#else
+#define ALOGVV(...) do { } while(0)
+#endif
+
+#include <string.h>
+
+#include <cutils/log.h>
+#include <cutils/atomic.h>
+
+#include <AudioRing.h>
+
+namespace android {
+
+AudioRing::AudioRing(const PcmParams &params, uint32_t frames)
+    : mParams(params), mSize(1), mFrameSize(params.frameSize()),
+      mSilenceBuffer(false), mUnderruns(0)
+{
+    /* Power of two size, indexes are masked instead of wrapped */
+    while (mSize < frames)
+        mSize <<= 1;
+
+    mData.resize(mSize * mFrameSize);
+    mSilence.resize(mParams.frameCount * mFrameSize, 0);
+
+    mRead.value = 0;
+    mWrite.value = 0;
+
+    ALOGV("AudioRing: %u frames of %u bytes", mSize, mFrameSize);
+}
+
+bool AudioRing::initCheck() const
+{
+    return mFrameSize && (mData.size() == mSize * mFrameSize) && !mSilence.empty();
+}
+
+uint32_t AudioRing::availableToWrite() const
+{
+    uint32_t read = android_atomic_acquire_load(&mRead.value);
+    uint32_t write = mWrite.value;
+
+    return mSize - (write - read);
+}
+
+uint32_t AudioRing::write(const void *buffer, uint32_t frames)
+{
+    const uint8_t *data = (const uint8_t *)buffer;
+    uint32_t write = mWrite.value;
+    uint32_t avail = availableToWrite();
+
+    if (frames > avail)
+        frames = avail;
+
+    /* Up to two copies, before and after the wrap point */
+    uint32_t offset = write & (mSize - 1);
+    uint32_t first = mSize - offset;
+    if (first > frames)
+        first = frames;
+
+    memcpy(&mData[offset * mFrameSize], data, first * mFrameSize);
+    if (frames > first)
+        memcpy(&mData[0], data + first * mFrameSize, (frames - first) * mFrameSize);
+
+    /* Data must be visible before the consumer sees the new index */
+    android_atomic_release_store(write + frames, &mWrite.value);
+
+    ALOGVV("AudioRing: wrote %u frames", frames);
+
+    return frames;
+}
+
+uint32_t AudioRing::availableToRead() const
+{
+    uint32_t write = android_atomic_acquire_load(&mWrite.value);
+    uint32_t read = mRead.value;
+
+    return write - read;
+}
+
+int AudioRing::getNextBuffer(BufferProvider::Buffer *buffer)
+{
+    uint32_t avail = availableToRead();
+    uint32_t frames = buffer->frameCount;
+
+    if (!avail) {
+        /* Keep the PcmWriter going, the stream will catch up */
+        android_atomic_inc(&mUnderruns);
+        mSilenceBuffer = true;
+        buffer->raw = &mSilence[0];
+        buffer->frameCount = (frames < mParams.frameCount) ? frames : mParams.frameCount;
+        return 0;
+    }
+
+    /* Only the contiguous region, the caller asks again for the rest */
+    uint32_t offset = mRead.value & (mSize - 1);
+    uint32_t contiguous = mSize - offset;
+    if (frames > avail)
+        frames = avail;
+    if (frames > contiguous)
+        frames = contiguous;
+
+    mSilenceBuffer = false;
+    buffer->raw = &mData[offset * mFrameSize];
+    buffer->frameCount = frames;
+
+    return 0;
+}
+
+void AudioRing::releaseBuffer(BufferProvider::Buffer *buffer)
+{
+    if (!mSilenceBuffer) {
+        uint32_t read = mRead.value;
+        android_atomic_release_store(read + buffer->frameCount, &mRead.value);
+    }
+
+    mSilenceBuffer = false;
+    buffer->frameCount = 0;
+}
+
+uint32_t AudioRing::getUnderruns() const
+{
+    return android_atomic_acquire_load(&mUnderruns);
+}
+
+void AudioRing::flush()
+{
+    android_atomic_release_store(android_atomic_acquire_load(&mWrite.value), &mRead.value);
+}
+
+}; // namespace android
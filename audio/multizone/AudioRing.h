@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUDIO_RING_H_
+#define _AUDIO_RING_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+#include <tiaudioutils/Base.h>
+
+namespace android {
+
+using namespace tiaudioutils;
+using std::vector;
+
+/**
+ * Lock-free single-producer/single-consumer ring of PCM frames. The
+ * producer is the stream's write() and the consumer is the PcmWriter
+ * thread, which pulls the data through the BufferProvider interface.
+ *
+ * Read and write indexes are free running and live in separate cache
+ * lines to avoid false sharing between the two threads. The consumer
+ * gets silence if the ring underruns, so the PcmWriter never stalls.
+ */
+class AudioRing : public BufferProvider {
+ public:
+    AudioRing(const PcmParams &params, uint32_t frames);
+    virtual ~AudioRing() {}
+
+    bool initCheck() const;
+    uint32_t getSize() const { return mSize; }
+
+    /* Producer side */
+    uint32_t availableToWrite() const;
+    uint32_t write(const void *buffer, uint32_t frames);
+
+    /* Consumer side */
+    uint32_t availableToRead() const;
+    virtual int getNextBuffer(BufferProvider::Buffer *buffer);
+    virtual void releaseBuffer(BufferProvider::Buffer *buffer);
+    uint32_t getUnderruns() const;
+
+    /* Only when there is no consumer, e.g. stream is not registered */
+    void flush();
+
+    static const uint32_t kCacheLineSize = 64;
+
+ protected:
+    struct Index {
+        volatile int32_t value;
+        uint8_t pad[kCacheLineSize - sizeof(int32_t)];
+    } __attribute__((aligned(kCacheLineSize)));
+
+    PcmParams mParams;
+    uint32_t mSize;
+    uint32_t mFrameSize;
+    vector<uint8_t> mData;
+    vector<uint8_t> mSilence;
+    Index mRead;
+    Index mWrite;
+    bool mSilenceBuffer;
+    volatile int32_t mUnderruns;
+};
+
+}; // namespace android
+
+#endif /* _AUDIO_RING_H_ */
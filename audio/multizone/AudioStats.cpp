@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioStats"
+// #define LOG_NDEBUG 0
+
+#include <cutils/log.h>
+#include <cutils/atomic.h>
+
+#include <AudioStats.h>
+
+namespace android {
+
+LatencyStats::LatencyStats(const char *name)
+    : mName(name)
+{
+    reset();
+}
+
+void LatencyStats::record(nsecs_t duration)
+{
+    uint32_t us = (duration > 0) ? (uint32_t)(duration / 1000) : 0;
+    uint32_t bucket = 0;
+
+    while ((bucket < kNumBuckets - 1) && (us >> (bucket + 1)))
+        bucket++;
+
+    android_atomic_inc(&mBuckets[bucket]);
+    android_atomic_inc(&mCount);
+
+    int32_t max;
+    do {
+        max = android_atomic_acquire_load(&mMaxUs);
+        if ((int32_t)us <= max)
+            break;
+    } while (android_atomic_release_cas(max, us, &mMaxUs));
+}
+
+void LatencyStats::reset()
+{
+    for (uint32_t i = 0; i < kNumBuckets; i++)
+        android_atomic_release_store(0, &mBuckets[i]);
+
+    android_atomic_release_store(0, &mCount);
+    android_atomic_release_store(0, &mMaxUs);
+}
+
+uint32_t LatencyStats::getCount() const
+{
+    return android_atomic_acquire_load(&mCount);
+}
+
+uint32_t LatencyStats::getMaxUs() const
+{
+    return android_atomic_acquire_load(&mMaxUs);
+}
+
+uint32_t LatencyStats::getPercentileUs(uint32_t percent) const
+{
+    uint64_t count = getCount();
+    if (!count)
+        return 0;
+
+    /* Rank of the sample, rounded up */
+    uint64_t rank = (count * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    for (uint32_t i = 0; i < kNumBuckets; i++) {
+        seen += android_atomic_acquire_load(&mBuckets[i]);
+        if (seen >= rank)
+            return 2U << i;
+    }
+
+    return getMaxUs();
+}
+
+void LatencyStats::dump(String8 &result) const
+{
+    result.appendFormat("    %s: count %u p50 <%u us p90 <%u us p99 <%u us max %u us\n",
+                        mName, getCount(), getPercentileUs(50), getPercentileUs(90),
+                        getPercentileUs(99), getMaxUs());
+}
+
+/* ---------------------------------------------------------------------------------------- */
+
+RateStats::RateStats(const char *name)
+    : mName(name)
+{
+    reset();
+}
+
+void RateStats::event()
+{
+    android_atomic_inc(&mCount);
+}
+
+void RateStats::reset()
+{
+    mStart = systemTime();
+    android_atomic_release_store(0, &mCount);
+}
+
+uint32_t RateStats::getCount() const
+{
+    return android_atomic_acquire_load(&mCount);
+}
+
+float RateStats::getRate() const
+{
+    nsecs_t elapsed = systemTime() - mStart;
+    if (elapsed <= 0)
+        return 0.0f;
+
+    return (getCount() * 1000000000.0f) / elapsed;
+}
+
+void RateStats::dump(String8 &result) const
+{
+    result.appendFormat("    %s: count %u, %.1f per second\n",
+                        mName, getCount(), getRate());
+}
+
+}; // namespace android
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUDIO_STATS_H_
+#define _AUDIO_STATS_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/String8.h>
+
+namespace android {
+
+/**
+ * Latency histogram with power-of-two buckets in microseconds. Bucket 'i'
+ * counts the samples in [2^i, 2^(i+1)) usecs, so percentiles are reported
+ * as the upper bound of the bucket they fall into.
+ *
+ * Samples can be recorded from any thread without locking, the dump is
+ * only approximate if it races with record().
+ */
+class LatencyStats {
+ public:
+    LatencyStats(const char *name);
+
+    void record(nsecs_t duration);
+    void reset();
+
+    uint32_t getCount() const;
+    uint32_t getMaxUs() const;
+    uint32_t getPercentileUs(uint32_t percent) const;
+
+    void dump(String8 &result) const;
+
+    static const uint32_t kNumBuckets = 24;
+
+ protected:
+    const char *mName;
+    volatile int32_t mBuckets[kNumBuckets];
+    volatile int32_t mCount;
+    volatile int32_t mMaxUs;
+};
+
+/**
+ * Event counter that also reports the average rate of events per second
+ * since the last reset, e.g. write() calls or thread wakeups.
+ */
+class RateStats {
+ public:
+    RateStats(const char *name);
+
+    void event();
+    void reset();
+
+    uint32_t getCount() const;
+    float getRate() const;
+
+    void dump(String8 &result) const;
+
+ protected:
+    const char *mName;
+    volatile int32_t mCount;
+    nsecs_t mStart;
+};
+
+/**
+ * Same as AutoMutex, but the time the lock is held is recorded in the
+ * given stats.
+ */
+class TimedAutoMutex {
+ public:
+    TimedAutoMutex(Mutex &lock, LatencyStats &stats)
+        : mLock(lock), mStats(stats)
+    {
+        mLock.lock();
+        mStart = systemTime();
+    }
+
+    ~TimedAutoMutex()
+    {
+        mStats.record(systemTime() - mStart);
+        mLock.unlock();
+    }
+
+ private:
+    Mutex &mLock;
+    LatencyStats &mStats;
+    nsecs_t mStart;
+};
+
+}; // namespace android
+
+#endif /* _AUDIO_STATS_H_ */
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUDIO_STREAM_POOL_H_
+#define _AUDIO_STREAM_POOL_H_
+
+#include <vector>
+
+#include <cutils/log.h>
+#include <utils/StrongPointer.h>
+
+#include <tiaudioutils/Base.h>
+
+namespace android {
+
+using namespace tiaudioutils;
+using std::vector;
+
+/**
+ * Pool of idle tiaudioutils streams (e.g. AdaptedOutStream), so that the
+ * resampler state and buffers allocated by their constructors are reused
+ * by the next stream opened with the same configuration. Streams must be
+ * stopped before they go back to the pool, start() resets their resampler
+ * and buffers on reuse. Streams still started are refused, their state
+ * would leak into the next owner.
+ *
+ * Not thread-safe, the owner serializes the access.
+ */
+template <class T>
+class AudioStreamPool {
+ public:
+    /* Stream configuration: PCM params plus an opaque slot map descriptor */
+    struct Key {
+        uint32_t sampleRate;
+        uint32_t channels;
+        uint32_t sampleBits;
+        uint32_t frameCount;
+        uint32_t slots;
+
+        Key(const PcmParams &params, uint32_t slots_)
+            : sampleRate(params.sampleRate), channels(params.channels),
+              sampleBits(params.sampleBits), frameCount(params.frameCount),
+              slots(slots_) {}
+
+        bool operator==(const Key &other) const {
+            return (sampleRate == other.sampleRate) && (channels == other.channels) &&
+                   (sampleBits == other.sampleBits) && (frameCount == other.frameCount) &&
+                   (slots == other.slots);
+        }
+    };
+
+    AudioStreamPool(uint32_t maxPerKey)
+        : mMaxPerKey(maxPerKey), mHits(0), mMisses(0) {}
+
+    /* Idle stream for the configuration, NULL if the caller must create it */
+    sp<T> acquire(const Key &key) {
+        for (typename vector<Entry>::iterator i = mEntries.begin(); i != mEntries.end(); ++i) {
+            if (i->key == key) {
+                sp<T> stream = i->stream;
+                mEntries.erase(i);
+                mHits++;
+                return stream;
+            }
+        }
+        mMisses++;
+        return NULL;
+    }
+
+    /* Streams beyond the per-configuration limit are simply dropped */
+    void release(const Key &key, const sp<T> &stream) {
+        uint32_t count = 0;
+        for (typename vector<Entry>::const_iterator i = mEntries.begin(); i != mEntries.end(); ++i) {
+            if (i->key == key)
+                count++;
+        }
+        if ((stream == NULL) || (count >= mMaxPerKey))
+            return;
+
+        if (stream->isStarted()) {
+            ALOGE("AudioStreamPool: stream %p is still started, not pooled", stream.get());
+            return;
+        }
+
+        Entry entry = { key, stream };
+        mEntries.push_back(entry);
+    }
+
+    /* Applies to the next releases, the streams already pooled are kept */
+    void setMaxPerKey(uint32_t maxPerKey) { mMaxPerKey = maxPerKey; }
+
+    /* e.g. when the configurations of the pooled streams can't be used anymore */
+    void clear() { mEntries.clear(); }
+
+    uint32_t getSize() const { return mEntries.size(); }
+    uint32_t getHits() const { return mHits; }
+    uint32_t getMisses() const { return mMisses; }
+
+ protected:
+    struct Entry {
+        Key key;
+        sp<T> stream;
+    };
+
+    vector<Entry> mEntries;
+    uint32_t mMaxPerKey;
+    uint32_t mHits;
+    uint32_t mMisses;
+};
+
+}; // namespace android
+
+#endif /* _AUDIO_STREAM_POOL_H_ */
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2013 Texas Instruments
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of the writer period sizes of the output profiles: a writer
+ * feeds an AudioOutPort in periods of the fast, regular and deep buffer
+ * sizes, and the port mixer plays it on a HostPcmDevice, so no codec is
+ * needed. The writes and the render thread's wakeups are compared with
+ * the 1024-frame regular writer, which is the baseline.
+ *
+ * Usage: multizone_writebench [seconds]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include <AudioPcmDevice.h>
+#include <AudioPortMixer.h>
+#include <AudioOutPort.h>
+
+using namespace android;
+using std::vector;
+
+/* Same as the CPU port of AudioHwDevice */
+static const uint32_t kChannels = 2;
+static const uint32_t kSampleBits = 16;
+static const uint32_t kSampleRate = 44100;
+static const uint32_t kMixerFrames = 256;
+
+struct WriterSize {
+    const char *name;
+    uint32_t frames;
+};
+
+/* Baseline first */
+static const WriterSize kSizes[] = {
+    { "regular", 1024 },
+    { "fast", 256 },
+    { "deep buffer", 8192 },
+};
+
+/* The render thread's counters are only reported by the dump otherwise */
+class BenchMixer : public AudioPortMixer {
+ public:
+    BenchMixer(AudioPcmDevice *pcm, const PcmParams &params)
+        : AudioPortMixer(pcm, params) {}
+
+    uint32_t getWakeups() const { return mWakeups.getCount(); }
+    uint32_t getPeriods() const { return mPeriods.getCount(); }
+};
+
+struct Result {
+    uint32_t writes;
+    uint32_t wakeups;
+    uint32_t periods;
+    uint32_t underruns;
+    double secs;
+};
+
+static int64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int run(BenchMixer &mixer, const WriterSize &size, uint32_t secs, Result &result)
+{
+    AudioOutPort port(&mixer, size.name);
+    PcmParams params(kChannels, kSampleBits, kSampleRate, size.frames);
+
+    /* 1 kHz tone, the same buffer is written over and over */
+    vector<int16_t> buffer(size.frames * kChannels);
+    for (uint32_t i = 0; i < size.frames; i++) {
+        int16_t sample = (int16_t)(8192 * sinf((2 * M_PI * 1000 * i) / kSampleRate));
+        for (uint32_t ch = 0; ch < kChannels; ch++)
+            buffer[i * kChannels + ch] = sample;
+    }
+
+    int ret = port.open(params);
+    if (ret) {
+        fprintf(stderr, "failed to open the %s port %d\n", size.name, ret);
+        return ret;
+    }
+
+    /* Each write blocks until the mixer frees room in the port's ring */
+    memset(&result, 0, sizeof(result));
+    int64_t start = now();
+    int64_t end = start + secs * 1000000000LL;
+    while (now() < end) {
+        ret = port.write(&buffer[0], size.frames);
+        if (ret < 0) {
+            fprintf(stderr, "failed to write to the %s port %d\n", size.name, ret);
+            break;
+        }
+        result.writes++;
+    }
+
+    result.secs = (double)(now() - start) / 1000000000LL;
+    result.wakeups = mixer.getWakeups();
+    result.periods = mixer.getPeriods();
+    result.underruns = port.getUnderruns();
+
+    port.close();
+
+    return (ret < 0) ? ret : 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t secs = (argc > 1) ? strtoul(argv[1], NULL, 0) : 10;
+    uint32_t count = sizeof(kSizes) / sizeof(kSizes[0]);
+    vector<Result> results(count);
+
+    /* The mixer owns the device */
+    PcmParams params(kChannels, kSampleBits, kSampleRate, kMixerFrames);
+    BenchMixer mixer(new HostPcmDevice(0, 0), params);
+
+    printf("%u channels, %u Hz, mixer period %u frames, %u periods, %u s per writer\n",
+           kChannels, kSampleRate, kMixerFrames, AudioPortMixer::kPeriodCount, secs);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (run(mixer, kSizes[i], secs, results[i]))
+            return 1;
+
+        const Result &r = results[i];
+        const Result &base = results[0];
+        printf("%-12s %5u frames: %6u writes (%6.1f/s, %.2fx), %6u wakeups (%6.1f/s, %.2fx), "
+               "%u periods, %u underruns\n",
+               kSizes[i].name, kSizes[i].frames,
+               r.writes, r.writes / r.secs, (double)r.writes / base.writes,
+               r.wakeups, r.wakeups / r.secs, (double)r.wakeups / base.wakeups,
+               r.periods, r.underruns);
+    }
+
+    return 0;
+}
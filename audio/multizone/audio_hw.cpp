@@ -192,6 +192,26 @@ static int out_get_next_write_timestamp(const struct audio_stream_out *stream,
     return out->getNextWriteTimestamp(timestamp);
 }
 
+static int out_get_presentation_position(const struct audio_stream_out *stream,
+                                         uint64_t *frames, struct timespec *timestamp)
+{
+    const AudioStreamOut *out = tocStreamOut((audio_stream_out *)stream);
+    return out->getPresentationPosition(frames, timestamp);
+}
+
+static int out_set_callback(struct audio_stream_out *stream,
+                            stream_callback_t callback, void *cookie)
+{
+    AudioStreamOut *out = toStreamOut(stream);
+    return out->setCallback(callback, cookie);
+}
+
+static int out_drain(struct audio_stream_out *stream, audio_drain_type_t type)
+{
+    AudioStreamOut *out = toStreamOut(stream);
+    return out->drain(type);
+}
+
 /* audio_stream_in implementation */
 
 static uint32_t in_get_sample_rate(const struct audio_stream *stream)
@@ -323,6 +343,9 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     out->stream.write = out_write;
     out->stream.get_render_position = out_get_render_position;
     out->stream.get_next_write_timestamp = out_get_next_write_timestamp;
+    out->stream.get_presentation_position = out_get_presentation_position;
+    out->stream.set_callback = out_set_callback;
+    out->stream.drain = out_drain;
 
     out->streamOut = hwDev->openOutputStream(handle, devices, flags, config);
     if (!out->streamOut) {
@@ -383,12 +406,24 @@ static int adev_set_master_volume(struct audio_hw_device *dev, float volume)
     return hwDev->setMasterVolume(volume);
 }
 
+static int adev_get_master_volume(struct audio_hw_device *dev, float *volume)
+{
+    const AudioHwDevice *hwDev = toAudioHwDev(dev);
+    return hwDev->getMasterVolume(volume);
+}
+
 static int adev_set_master_mute(struct audio_hw_device *dev, bool muted)
 {
     AudioHwDevice *hwDev = toAudioHwDev(dev);
     return hwDev->setMasterMute(muted);
 }
 
+static int adev_get_master_mute(struct audio_hw_device *dev, bool *muted)
+{
+    const AudioHwDevice *hwDev = toAudioHwDev(dev);
+    return hwDev->getMasterMute(muted);
+}
+
 static int adev_set_mode(struct audio_hw_device *dev, audio_mode_t mode)
 {
     AudioHwDevice *hwDev = toAudioHwDev(dev);
@@ -479,7 +514,8 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
 
 static int adev_dump(const audio_hw_device_t *device, int fd)
 {
-    return 0;
+    const AudioHwDevice *hwDev = tocAudioHwDev(device);
+    return hwDev->dump(fd);
 }
 
 static uint32_t adev_get_supported_devices(const struct audio_hw_device *dev)
@@ -519,7 +555,9 @@ static int adev_open(const hw_module_t* module, const char* name, hw_device_t**
     adev->device.init_check = adev_init_check;
     adev->device.set_voice_volume = adev_set_voice_volume;
     adev->device.set_master_volume = adev_set_master_volume;
+    adev->device.get_master_volume = adev_get_master_volume;
     adev->device.set_master_mute = adev_set_master_mute;
+    adev->device.get_master_mute = adev_get_master_mute;
     adev->device.set_mode = adev_set_mode;
     adev->device.set_mic_mute = adev_set_mic_mute;
     adev->device.get_mic_mute = adev_get_mic_mute;